@@ -0,0 +1,56 @@
+#ifndef CONCURRENCY_H
+#define CONCURRENCY_H
+
+// The controller reconsiders the limit at most this often
+#define CONCURRENCY_INTERVAL_MS 200
+
+// Highest number of children kept in flight per effective CPU (sleep-bound suites oversubscribe up to this)
+#define CONCURRENCY_MAX_PER_CPU 8
+
+// Share of an interval some task spent stalled (from /proc/pressure/*) above which the limit is halved
+#define CONCURRENCY_CPU_PRESSURE 0.25
+#define CONCURRENCY_MEMORY_PRESSURE 0.10
+
+// Weight of each finished child in the CPU utilisation average (1 / CONCURRENCY_UTIL_WEIGHT)
+#define CONCURRENCY_UTIL_WEIGHT 4
+
+// AIMD controller for the number of children in flight. It starts at the effective CPU count
+// and adds one child per interval while pressure is low and the children seen so far leave CPU
+// time unused, and halves the limit as soon as /proc/pressure/cpu or /proc/pressure/memory
+// shows tasks stalling.
+typedef struct {
+    int limit;                // children that may be in flight right now
+    int min_limit;
+    int max_limit;
+    int effective_cpus;
+    double utilisation;       // moving average of CPU time / wall time of finished children
+    long last_update_ms;
+    long cpu_stall_us;        // "some" stall totals at last_update_ms, -1 if PSI is unavailable
+    long memory_stall_us;
+} concurrency_t;
+
+
+// Number of CPUs this process can actually use: the affinity mask, capped by the cgroup CPU
+// quota (cpu.max on cgroup v2, cpu.cfs_quota_us on v1) of every cgroup up the hierarchy
+int get_effective_cpus();
+
+
+// Create a controller that never goes above max_children (nor below one child)
+concurrency_t *create_concurrency(int max_children);
+
+
+// Most children that should be in flight at the moment
+int concurrency_limit(concurrency_t *concurrency);
+
+
+// Account for a finished child that used cpu_usec of CPU time over wall_ms (cpu_usec < 0 if unknown)
+void concurrency_record(concurrency_t *concurrency, long cpu_usec, long wall_ms);
+
+
+// Adjust the limit from the pressure seen since the last update (no-op within CONCURRENCY_INTERVAL_MS)
+void concurrency_update(concurrency_t *concurrency);
+
+
+void free_concurrency(concurrency_t *concurrency);
+
+#endif // CONCURRENCY_H
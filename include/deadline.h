@@ -0,0 +1,49 @@
+#ifndef DEADLINE_H
+#define DEADLINE_H
+
+#include <sys/types.h>
+
+// One child's deadline in the heap
+typedef struct {
+    long deadline_ms;     // CLOCK_MONOTONIC time (ms) at which the child runs out of time
+    int slot;             // slot of the child (index into the caller's pids array)
+} deadline_entry_t;
+
+// Min-heap of per-child deadlines, driven by a CLOCK_MONOTONIC timerfd that is always
+// armed for the earliest deadline in the heap
+typedef struct {
+    deadline_entry_t *heap;
+    int size;
+    int *pos;             // pos[slot] = index of slot's entry in heap, -1 if it has none
+    int num_slots;
+    int timer_fd;
+} deadline_heap_t;
+
+
+// Create an empty heap for children in slots [0, num_slots)
+deadline_heap_t *create_deadline_heap(int num_slots);
+
+
+// Give the child in slot a deadline timeout_ms from now
+void deadline_add(deadline_heap_t *deadlines, int slot, long timeout_ms);
+
+
+// Forget the deadline of slot (e.g. because the child has been reaped)
+void deadline_remove(deadline_heap_t *deadlines, int slot);
+
+
+// Pop the slot of a child whose deadline is at or before now_ms, or return -1 if none has expired
+int deadline_pop_expired(deadline_heap_t *deadlines, long now_ms);
+
+
+// Arm the timerfd for the earliest deadline in the heap, or disarm it if the heap is empty
+void deadline_arm_timer(deadline_heap_t *deadlines);
+
+
+// Consume the timerfd's expiration count so it stops polling readable (call before popping)
+void deadline_drain_timer(deadline_heap_t *deadlines);
+
+
+void free_deadline_heap(deadline_heap_t *deadlines);
+
+#endif // DEADLINE_H
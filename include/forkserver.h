@@ -0,0 +1,56 @@
+#ifndef FORKSERVER_H
+#define FORKSERVER_H
+
+#include <signal.h>
+#include <sys/types.h>
+#include "launcher.h"
+
+// Fd number the control socket is placed at in the student process
+#define FORKSRV_FD 198
+
+// Environment variable telling the shim which fd the control socket is on
+#define FORKSRV_ENV "AUTOGRADER_FORKSRV_FD"
+
+// Default location of the LD_PRELOAD shim, overridable with the AUTOGRADER_FORKSRV_SHIM variable
+#define FORKSRV_SHIM_PATH "lib/forkserver_shim.so"
+#define FORKSRV_SHIM_ENV "AUTOGRADER_FORKSRV_SHIM"
+
+// How long a freshly started server has to report that it reached main()
+#define FORKSRV_HANDSHAKE_MS 2000
+
+// Byte the shim sends once the student process is initialized and waiting for requests
+#define FORKSRV_READY 'R'
+
+// Maximum length of the argv[1] passed through a request
+#define FORKSRV_ARG_MAX 256
+
+// One fork request. It travels with two or three fds (SCM_RIGHTS): the write end of the status
+// pipe the server reports the child's wait status and CPU time on (a reaper_status_t), the child's stdout, and optionally its stdin.
+typedef struct {
+    int argc;                         // argc of the forked main(): 1 (REDIR) or 2
+    char arg[FORKSRV_ARG_MAX];        // argv[1] when argc == 2
+} forksrv_request_t;
+
+// A student process stopped before main() by the shim, forking once per request
+typedef struct {
+    pid_t pid;
+    int ctl_fd;           // our end of the control socket
+} forkserver_t;
+
+
+// Start exe_path under the shim and wait for it to reach main(). Returns NULL if it cannot be
+// started or never reaches main() (e.g. a statically linked binary that ignores LD_PRELOAD), in which case the caller
+// should launch that executable with spawn_solution() instead.
+forkserver_t *start_forkserver(char *exe_path, const sigset_t *child_mask);
+
+
+// Ask the server to fork and run main() for the pair described by plan (same argv/stdin rules
+// as spawn_solution()). Sets plan->output_fd and *status_fd: the child's wait status and CPU time
+// can be read from *status_fd as a reaper_status_t once it exits (see reaper_add()). Returns the pid of the forked child.
+pid_t forkserver_spawn(forkserver_t *server, spawn_plan_t *plan, int *status_fd);
+
+
+// Close the control socket (the server exits once its running children are done) and reap it
+void stop_forkserver(forkserver_t *server);
+
+#endif // FORKSERVER_H
@@ -0,0 +1,50 @@
+#ifndef HISTORY_H
+#define HISTORY_H
+
+// Default location of the persisted runtime history (relative to the working directory)
+#define HISTORY_FILE ".autograder_history"
+
+// Runtime statistics for one executable path
+typedef struct {
+    char *exe_path;       // path to executable (key)
+    long avg_ms;          // moving average of the wall-clock time of one (executable, parameter) pair
+    int runs;             // number of pairs recorded so far
+} history_entry_t;
+
+// Open addressing hash table of history entries, keyed by executable path
+typedef struct {
+    char *path;                 // file the history is loaded from and saved to
+    history_entry_t *entries;   // entries[i].exe_path == NULL for empty buckets
+    int capacity;               // always a power of two
+    int count;
+} runtime_history_t;
+
+
+// Load the history stored in path. A missing file gives an empty history.
+runtime_history_t *load_runtime_history(const char *path);
+
+
+// Make room for n more entries, so that the next n lookups never rehash the table
+void history_reserve(runtime_history_t *history, int n);
+
+
+// Returns the index of exe_path's entry, adding an entry with runs == 0 if it is not present.
+// Indices are invalidated when an added entry makes the table grow (see history_reserve()).
+int history_lookup(runtime_history_t *history, const char *exe_path);
+
+
+// Expected runtime of one pair of exe_path, or fallback_ms if it has never been run
+long history_expected_ms(runtime_history_t *history, const char *exe_path, long fallback_ms);
+
+
+// Fold the runtime of one finished pair into the entry at index idx
+void history_record(runtime_history_t *history, int idx, long elapsed_ms);
+
+
+// Write the history back to its file (atomically, via a temporary file and rename())
+void save_runtime_history(runtime_history_t *history);
+
+
+void free_runtime_history(runtime_history_t *history);
+
+#endif // HISTORY_H
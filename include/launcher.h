@@ -0,0 +1,54 @@
+#ifndef LAUNCHER_H
+#define LAUNCHER_H
+
+#include <limits.h>
+#include <signal.h>
+#include <sys/types.h>
+
+// How the parameter reaches the student program (see template.c)
+typedef enum {
+    INPUT_EXEC,     // as argv[1]
+    INPUT_REDIR,    // on stdin, redirected from the parameter's sealed memfd
+    INPUT_PIPE      // on stdin, written by the parent into a pipe; argv[1] is the pipe's fd
+} input_mode_t;
+
+// The input mode the autograder was compiled for (make exec/redir/pipe)
+#if defined(REDIR)
+    #define BUILD_INPUT_MODE INPUT_REDIR
+#elif defined(PIPE)
+    #define BUILD_INPUT_MODE INPUT_PIPE
+#else
+    #define BUILD_INPUT_MODE INPUT_EXEC
+#endif
+
+// Everything needed to start one (executable, parameter) pair. It is filled in by the parent
+// before spawning, so the child does nothing but apply the file actions and exec.
+typedef struct {
+    input_mode_t mode;
+    char *exe_path;
+    char *param;
+    char *argv[3];                  // { executable name, param or pipe fd, NULL }
+    char input_path[PATH_MAX];      // /proc/self/fd/<memfd>, the child's stdin (REDIR only)
+    int output_fd;                  // set by spawn_solution(): non-blocking read end of the child's stdout pipe
+} spawn_plan_t;
+
+
+// Fill in plan for running exe_path on param. Only the pointers are kept, so both strings
+// must outlive the plan. In REDIR mode input_fd is the parameter's memfd (see create_input_memfds()).
+void init_spawn_plan(spawn_plan_t *plan, char *exe_path, char *param, input_mode_t mode, int input_fd);
+
+
+// Start the pair described by plan with posix_spawn() (a CLONE_VM|CLONE_VFORK child in glibc,
+// so no page tables are copied). The child starts with the signal mask in child_mask and its
+// stdout is a pipe whose read end is left in plan->output_fd for the caller to drain and close.
+// Returns -1 if the executable cannot be started; only that pair fails, so the caller records a
+// verdict for it and carries on.
+pid_t spawn_solution(spawn_plan_t *plan, const sigset_t *child_mask);
+
+
+// Same as spawn_solution(), but the child is created inside the cgroup whose directory fd is
+// cgroup_fd (clone3() with CLONE_INTO_CGROUP). This is a fork()-style clone, so it copies the
+// parent's page tables; it is only used in sandbox mode. Returns -1 if the exec() fails.
+pid_t spawn_solution_in_cgroup(spawn_plan_t *plan, const sigset_t *child_mask, int cgroup_fd);
+
+#endif // LAUNCHER_H
@@ -0,0 +1,79 @@
+#ifndef NETPROTO_H
+#define NETPROTO_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <limits.h>
+#include <sys/uio.h>
+#include "verdict_cache.h"
+
+// Wire protocol between the coordinator and its agents (see coordinator.c and agent.c). Every
+// message is a net_header_t followed by length bytes of payload; all integers are big-endian.
+#define NET_PROTOCOL_VERSION 2
+#define NET_MAX_PAYLOAD (256U << 20)   // largest message accepted (a shipped binary)
+#define NET_SEND_TIMEOUT_SECS 10       // a peer that stops reading this long is given up on
+#define NET_RECV_TIMEOUT_SECS 10       // the coordinator gives up on an agent that stalls mid-message
+
+typedef enum {
+    NET_HELLO = 1,    // agent -> coordinator: u32 protocol version
+    NET_WELCOME,      // coordinator -> agent: u32 input_mode_t of the run
+    NET_REQUEST,      // agent -> coordinator: u32 free slots, u32 1 if the agent has nothing running
+    NET_ASSIGN,       // coordinator -> agent: u32 count, then count pairs (see net_put_pair())
+    NET_FETCH,        // agent -> coordinator: content digest of a binary it does not have
+    NET_BINARY,       // coordinator -> agent: content digest, then the binary's bytes
+    NET_VERDICT,      // agent -> coordinator: u32 pair id, u32 status
+    NET_BYE           // coordinator -> agent: every pair is graded, exit
+} net_message_t;
+
+typedef struct {
+    uint32_t type;            // net_message_t
+    uint32_t length;          // bytes of payload that follow
+} net_header_t;
+
+// A pair as sent in NET_ASSIGN
+typedef struct {
+    uint32_t pair_id;         // opaque to the agent, echoed in NET_VERDICT
+    int32_t param;
+    content_digest_t digest;  // the binary, see digest_executable()
+    char name[NAME_MAX + 1];  // executable name (argv[0] of the child)
+} net_pair_t;
+
+// Bytes net_put_pair() writes for a pair called name
+#define NET_PAIR_SIZE(name_len) (4 + 4 + SHA256_DIGEST_SIZE + 2 + (name_len))
+
+
+// Send one message whose payload is gathered from iov (count entries). Returns -1 on failure.
+int net_send(int fd, uint32_t type, const struct iovec *iov, int count);
+
+
+// Receive one message with blocking reads: *payload is malloc'd (NULL if empty) and must be freed.
+// Returns -1 on EOF, error or an oversized message.
+int net_recv(int fd, uint32_t *type, char **payload, uint32_t *length);
+
+
+// Big-endian encoding helpers. net_get_*() read from *cursor and advance it; they return -1 instead
+// of reading past end.
+void net_put_u32(char *out, uint32_t value);
+void net_put_u64(char *out, uint64_t value);
+int net_get_u32(const char **cursor, const char *end, uint32_t *value);
+int net_get_u64(const char **cursor, const char *end, uint64_t *value);
+int net_get_digest(const char **cursor, const char *end, content_digest_t *digest);
+
+// Encode pair at out (NET_PAIR_SIZE(strlen(pair->name)) bytes); decode one from *cursor
+size_t net_put_pair(char *out, const net_pair_t *pair);
+int net_get_pair(const char **cursor, const char *end, net_pair_t *pair);
+
+
+// Listen on port on all interfaces. Returns the listening socket; exits on failure.
+int net_listen(const char *port);
+
+
+// Accept an agent on listen_fd. Its reads time out after NET_RECV_TIMEOUT_SECS, so a stalled agent
+// cannot hold the coordinator up. Returns -1 on failure.
+int net_accept(int listen_fd);
+
+
+// Connect to host:port. Returns the socket, or -1 (after saying why) on failure.
+int net_connect(const char *host, const char *port);
+
+#endif // NETPROTO_H
@@ -0,0 +1,43 @@
+#ifndef PLACEMENT_H
+#define PLACEMENT_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+// Where the NUMA topology is read from: one node<N>/cpulist per node
+#define PLACEMENT_NODE_DIR "/sys/devices/system/node"
+
+// Largest CPU number understood (the size of a cpu_set_t)
+#define PLACEMENT_MAX_CPUS 1024
+
+// A set of CPUs within one NUMA node
+typedef struct {
+    int node;             // NUMA node every CPU of the set belongs to (0 without NUMA information, -1 if unknown)
+    int num_cpus;
+    int *cpus;            // in increasing order
+} cpu_placement_t;
+
+
+// CPUs this process may run on, in increasing order, as a malloc'd array. Returns their number,
+// or -1 if the affinity mask cannot be read.
+int get_allowed_cpus(int **cpus);
+
+
+// Split the CPUs this process may run on into num_workers disjoint sets that each lie within a
+// single NUMA node. Workers go to nodes in proportion to their CPUs, and every worker gets at least
+// one CPU, so num_workers must not exceed the number of allowed CPUs. Returns a malloc'd array of
+// num_workers placements, or NULL if the CPUs cannot be determined.
+cpu_placement_t *plan_worker_placement(int num_workers);
+
+
+void free_worker_placement(cpu_placement_t *placement, int num_workers);
+
+
+// Restrict pid (0 for the calling thread) to cpus. Returns -1 on failure.
+int set_cpu_affinity(pid_t pid, const int *cpus, int num_cpus);
+
+
+// Write cpus as a cpulist ("0-3,8,10-11") into buffer
+void format_cpu_list(const int *cpus, int num_cpus, char *buffer, size_t size);
+
+#endif // PLACEMENT_H
@@ -0,0 +1,105 @@
+#ifndef REAPER_H
+#define REAPER_H
+
+#include <signal.h>
+#include <sys/types.h>
+#include "deadline.h"
+#include "watchdog.h"
+
+// Maximum number of epoll events handled per epoll_wait() call
+#define REAPER_MAX_EVENTS 64
+
+// Bytes of each child's stdout kept for the verdict; anything beyond is drained and discarded
+#define REAPER_OUTPUT_SIZE 256
+
+// A reaped child waiting to be handed to the caller
+typedef struct {
+    int slot;
+    int status;           // wait status, as filled in by waitpid()
+    long cpu_usec;        // user + system CPU time of the child, -1 if unknown
+} reaped_child_t;
+
+// What the parent of a child we cannot wait on (see reaper_add()) writes to its status pipe once
+// the child has exited
+typedef struct {
+    int status;           // wait status, as filled in by waitpid()
+    long cpu_usec;        // user + system CPU time of the child, -1 if unknown
+} reaper_status_t;
+
+// Event-driven child reaper. Every child gets a pidfd registered with one epoll instance
+// (or, on kernels without pidfd_open(), a single signalfd for SIGCHLD), next to the
+// timerfd of the per-child deadline heap, so completions are handled in the order they
+// happen regardless of how many children are in flight. The read end of each child's
+// stdout pipe lives in the same epoll set and is drained into a bounded buffer.
+typedef struct {
+    int epoll_fd;
+    int use_pidfd;                // 1 for pidfd mode, 0 for the signalfd(SIGCHLD) fallback
+    int signal_fd;                // signalfd for SIGCHLD in fallback mode, -1 otherwise
+    int num_slots;
+    pid_t *pids;                  // pids[slot] of the running children, -1 for idle slots
+    int *pidfds;                  // pidfds[slot], -1 if none
+    int *status_fds;              // status_fds[slot] for children we cannot wait on (see reaper_add()), -1 if none
+    int *output_fds;              // read end of the child's stdout pipe, -1 once closed
+    char (*output)[REAPER_OUTPUT_SIZE + 1];  // captured stdout of each slot (+1 for the null terminator)
+    int *output_len;
+    long *cpu_usec;               // CPU time of the child last reaped in each slot, -1 if unknown
+    int *failed;                  // verdict of a pair in slot that could not be started (see reaper_add_failed()), 0 otherwise
+    deadline_heap_t *deadlines;   // per-child deadlines, driven by a timerfd in the same epoll set
+    watchdog_t *watchdog;         // classifies stuck and spinning children early, also on a timerfd
+
+    reaped_child_t *reaped;       // FIFO of children reaped but not yet returned (at most num_slots)
+    int reaped_head;
+    int reaped_count;
+} reaper_t;
+
+
+// Create a reaper for children in slots [0, num_slots)
+reaper_t *create_reaper(int num_slots);
+
+
+// Start tracking the child pid running in slot, killing it if it is still running after timeout_ms.
+// output_fd is the non-blocking read end of its stdout pipe (or -1); the reaper takes ownership of it.
+// A child that is not ours to wait on (one forked by a fork server) is tracked through status_fd
+// instead: the pipe its parent writes a reaper_status_t to. Pass -1 for our own children.
+void reaper_add(reaper_t *reaper, int slot, pid_t pid, int output_fd, int status_fd, long timeout_ms);
+
+
+// Record that the pair in slot could not be started (its executable cannot be exec()ed). The next
+// reaper_wait() returns slot right away, and reaper_verdict() gives verdict for it.
+void reaper_add_failed(reaper_t *reaper, int slot, int verdict);
+
+
+// Also return from reaper_wait() when fd becomes readable. The reaper never reads it: the caller
+// has to drain it, or every reaper_wait() returns at once.
+void reaper_wake_on(reaper_t *reaper, int fd);
+
+
+// Block until a tracked child exits (or is killed at its deadline) and return its slot.
+// The child has been reaped and its wait status is stored in *status. Returns -1 instead if an
+// fd given to reaper_wake_on() became readable before any child was reaped.
+int reaper_wait(reaper_t *reaper, int *status);
+
+
+// STUCK or INFINITE_LOOP if the watchdog killed the child last reaped in slot, the verdict given to
+// reaper_add_failed() for a pair that never started, 0 otherwise (the verdict then follows from the
+// wait status and output, see get_verdict())
+int reaper_verdict(reaper_t *reaper, int slot);
+
+
+// User + system CPU time (usec) of the child last reaped in slot, -1 if it is not known (a pair
+// that never started, or a child whose parent went away without reporting)
+long reaper_cpu_usec(reaper_t *reaper, int slot);
+
+
+// Null-terminated stdout captured from the child last reaped in slot (at most REAPER_OUTPUT_SIZE bytes)
+const char *reaper_output(reaper_t *reaper, int slot);
+
+
+// Signal mask new children should start with (the one in effect before the reaper blocked
+// SIGCHLD), or NULL if the reaper left the mask alone
+const sigset_t *reaper_child_sigmask();
+
+
+void free_reaper(reaper_t *reaper);
+
+#endif // REAPER_H
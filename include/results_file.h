@@ -0,0 +1,70 @@
+#ifndef RESULTS_FILE_H
+#define RESULTS_FILE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "utils.h"
+
+#define RESULTS_FILE_MAGIC "AGRS"
+#define RESULTS_FILE_VERSION 1
+
+/*
+Binary results file. Everything is in native byte order and each section starts 8-byte aligned:
+
+    results_file_header_t
+    int32_t  params[num_params]                          parameter vector, stored once
+    uint8_t  status[num_executables][num_params]         status matrix (CORRECT, INCORRECT, ...)
+    uint32_t name_offsets[num_executables + 1]           row i's name is strings[name_offsets[i]], its null terminator at name_offsets[i + 1] - 1
+    char     strings[]                                   null-terminated executable names
+
+Rows are in the same order as results.txt, which can be exported from the file at any time
+(export_results_text(), or "autograder export <file>").
+*/
+typedef struct {
+    char magic[4];            // RESULTS_FILE_MAGIC
+    uint16_t version;         // RESULTS_FILE_VERSION
+    uint16_t reserved;
+    uint32_t num_executables;
+    uint32_t num_params;
+    uint64_t params_offset;
+    uint64_t status_offset;
+    uint64_t names_offset;
+    uint64_t strings_offset;
+    uint64_t file_size;
+} results_file_header_t;
+
+// A results file mapped read-only into memory
+typedef struct {
+    void *map;
+    size_t size;
+    const results_file_header_t *header;
+    const int32_t *params;
+    const uint8_t *status;
+    const uint32_t *name_offsets;
+    const char *strings;
+} results_file_t;
+
+
+// Write results (already in output order, see sort_results()) to path. Returns -1 on failure.
+int write_results_binary(autograder_results_t *results, int num_executables, int total_params, const char *path);
+
+
+// Map the results file at path. Returns NULL (after saying why) if it cannot be read or is malformed.
+results_file_t *open_results_file(const char *path);
+
+
+// Name of row i
+const char *results_file_name(results_file_t *file, int i);
+
+
+// Status row of row i: num_params bytes
+const uint8_t *results_file_row(results_file_t *file, int i);
+
+
+// Write the file out as results.txt (same bytes as write_results_to_file()). Returns -1 on failure.
+int export_results_text(results_file_t *file, const char *path);
+
+
+void close_results_file(results_file_t *file);
+
+#endif // RESULTS_FILE_H
@@ -0,0 +1,61 @@
+#ifndef SANDBOX_H
+#define SANDBOX_H
+
+#include <limits.h>
+
+// Limits written into every pair's cgroup (see cpu.max, memory.max and pids.max in the cgroup v2 docs)
+#define SANDBOX_CPU_MAX "100000 100000"     // at most one CPU's worth of time per pair
+#define SANDBOX_MEMORY_MAX "256M"
+#define SANDBOX_PIDS_MAX "32"
+
+// Controllers the sandbox enables for the pair cgroups
+#define SANDBOX_CONTROLLERS "+cpu +memory +pids"
+
+// How many times (10 ms apart) free_sandbox() retries removing a cgroup that still has dying processes
+#define SANDBOX_RMDIR_RETRIES 100
+
+// Without cgroup.kill, how many times a leaf's cgroup.procs is read and everything in it SIGKILLed
+// (a process may fork between the read and the kill)
+#define SANDBOX_KILL_ROUNDS 8
+
+// Runs every (executable, parameter) pair in its own cgroup v2 leaf under a delegated subtree:
+//
+//     <delegated root>/autograder.<pid>/pair<N>
+//
+// Children are cloned straight into their leaf (CLONE_INTO_CGROUP), so anything they fork is
+// caught too. Releasing a pair kills the whole leaf with one write to cgroup.kill, or, on kernels
+// older than 5.14 that do not have it, by SIGKILLing every pid in the leaf's cgroup.procs.
+typedef struct {
+    char run_path[PATH_MAX];  // <delegated root>/autograder.<pid>
+    int run_fd;               // directory fd of run_path
+    int has_limits;           // 1 if cpu/memory/pids could be enabled for the leaves
+    int has_kill;             // 1 if the kernel has cgroup.kill
+    int num_slots;
+    int *leaf_fds;            // directory fd of each slot's leaf, -1 if the slot has none
+    char (*leaf_names)[32];   // pair<N> of each slot
+    unsigned long next_leaf;  // N of the next leaf
+    char (*stale)[32];        // leaves whose last processes were still dying when released
+    int num_stale;
+    int capacity_stale;
+} sandbox_t;
+
+
+// Set up the run directory under delegated_root, which must be a cgroup v2 directory we may
+// create children in. Returns NULL (after saying why) if it cannot be used.
+sandbox_t *create_sandbox(const char *delegated_root, int num_slots);
+
+
+// Create a fresh leaf for the pair about to run in slot and return its directory fd, to be
+// passed to spawn_solution_in_cgroup()
+int sandbox_prepare(sandbox_t *sandbox, int slot);
+
+
+// Kill everything left in the slot's leaf, read its CPU time (usec) and peak memory (bytes,
+// -1 without the memory controller) and remove it. Failures are reported, never fatal.
+void sandbox_release(sandbox_t *sandbox, int slot, long *cpu_usec, long *memory_peak);
+
+
+// Remove the leaves and the run directory
+void free_sandbox(sandbox_t *sandbox);
+
+#endif // SANDBOX_H
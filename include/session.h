@@ -0,0 +1,93 @@
+#ifndef SESSION_H
+#define SESSION_H
+
+#include <sys/types.h>
+#include "deadline.h"
+#include "watchdog.h"
+
+/*
+Persistent sessions: one student process answers every parameter of its executable in turn, so it
+is started (and pays its exec and startup cost) once instead of once per parameter. The process
+gets one end of a SOCK_SEQPACKET socket as argv[1]. Every message keeps its boundaries, like a
+message queue's (see mq_template.c):
+
+    worker -> student: a parameter in decimal ("42"), or SESSION_END once there are no more
+    student -> worker: the answer to that parameter, exactly "0" (correct) or "1"; anything else is INCORRECT
+
+Each parameter has its own deadline, and the watchdog classifies it from the CPU time used since it
+was sent. A process that crashes or is killed ends its session: the parameter it was working on
+gets the verdict, and the next parameter starts a new process. One that exits without answering
+gets INCORRECT for the parameter, and one that closes its socket is replaced before the next.
+*/
+#define SESSION_END "END"
+#define SESSION_MESSAGE_SIZE 64      // largest message either side sends
+#define SESSION_MAX_EVENTS 64        // epoll events handled per epoll_wait() call
+#define SESSION_END_MS 100           // a process told SESSION_END is killed if it is still running after this
+
+// A parameter whose verdict is known, waiting to be handed to the caller
+typedef struct {
+    int slot;
+    int status;           // CORRECT, INCORRECT, ...
+    long duration_ms;     // from sending the parameter (or starting the process for it) to the verdict
+} session_answer_t;
+
+// Sessions in slots [0, num_slots), all driven by one epoll set like the children of a reaper
+// (see reaper.h). Every process holds a pidfd, its socket and its stdout pipe (drained and
+// discarded, the answers come over the socket) in the set, next to the timerfds of the
+// per-parameter deadlines and of the watchdog.
+typedef struct {
+    int epoll_fd;
+    int num_slots;
+    char **exe_paths;             // executable of each slot's session (not copied), NULL if none
+    pid_t *pids;                  // process of each slot, -1 if none is running
+    int *pidfds;
+    int *sockets;                 // our end of the process's socket, -1 once closed
+    int *output_fds;              // read end of the process's stdout pipe, -1 once closed
+    int *pending;                 // 1 while a parameter waits for its answer
+    long *sent_ms;                // monotonic time (ms) the pending parameter was sent
+    deadline_heap_t *deadlines;   // one deadline per pending parameter
+    watchdog_t *watchdog;         // watches processes only while they work on a parameter
+
+    session_answer_t *answers;    // FIFO of verdicts not yet returned (at most num_slots)
+    int answers_head;
+    int answers_count;
+} session_pool_t;
+
+
+// Create a pool for sessions in slots [0, num_slots). Exits if the kernel has no pidfd_open().
+session_pool_t *create_session_pool(int num_slots);
+
+
+// Start the session of exe_path in an idle slot. No process is started until session_ask().
+void session_open(session_pool_t *sessions, int slot, char *exe_path);
+
+
+// 1 if the session in slot has a process running, i.e. session_ask() will not start one
+int session_alive(session_pool_t *sessions, int slot);
+
+
+// Send param to the session in slot, starting its process first if it has none, and give the
+// answer timeout_ms. The session must not have a parameter pending. If the executable cannot be
+// started, the parameter is INCORRECT (returned by the next session_wait()).
+void session_ask(session_pool_t *sessions, int slot, int param, long timeout_ms);
+
+
+// Also return from session_wait() when fd becomes readable. As with reaper_wake_on(), the caller
+// has to drain it.
+void session_wake_on(session_pool_t *sessions, int fd);
+
+
+// Block until a pending parameter is answered, or its process crashes or runs out of time, and
+// return its slot. The verdict is stored in *status, the time it took in *duration_ms. Returns -1
+// instead if an fd given to session_wake_on() became readable before any verdict was known.
+int session_wait(session_pool_t *sessions, int *status, long *duration_ms);
+
+
+// End the session in slot: send SESSION_END, give the process SESSION_END_MS to exit and reap it.
+// The slot is idle afterwards.
+void session_close(session_pool_t *sessions, int slot);
+
+
+void free_session_pool(session_pool_t *sessions);
+
+#endif // SESSION_H
@@ -0,0 +1,30 @@
+#ifndef SHA256_H
+#define SHA256_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// SHA-256 (FIPS 180-4). Binaries are identified by their digest wherever a collision would
+// matter: an agent running the wrong binary, or a verdict reused for another one.
+#define SHA256_DIGEST_SIZE 32
+#define SHA256_BLOCK_SIZE 64
+
+typedef struct {
+    uint32_t state[8];
+    uint64_t length;                        // bytes hashed so far
+    unsigned char block[SHA256_BLOCK_SIZE]; // partial block not yet compressed
+    size_t block_used;
+} sha256_t;
+
+
+void sha256_init(sha256_t *ctx);
+
+
+// Hash size more bytes of data
+void sha256_update(sha256_t *ctx, const void *data, size_t size);
+
+
+// Finish the hash and store it in digest. ctx must be initialized again before it is reused.
+void sha256_final(sha256_t *ctx, unsigned char digest[SHA256_DIGEST_SIZE]);
+
+#endif // SHA256_H
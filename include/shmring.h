@@ -0,0 +1,158 @@
+#ifndef SHMRING_H
+#define SHMRING_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Shared-memory transport between mq_autograder and its workers (replaces the SysV message queue).
+// One memfd holds a pair of single-producer/single-consumer rings per worker: dispatch
+// (autograder -> worker) and results (worker -> autograder). Sending a record is a copy into the
+// ring and a release store of the head; a sleeping peer is woken through a futex only when it
+// actually sleeps, so a busy run makes no syscalls per message.
+//
+// The same region holds the work queue: every (executable, parameter) pair, written once by the
+// autograder before the workers start. Workers claim the next pair with an atomic increment
+// whenever they have a free slot (shm_claim_pair()), so a worker stuck behind timeouts simply
+// claims fewer pairs and the run ends when the total work is done. In session mode (see session.h)
+// each executable's pairs are queued together and a worker claims them as one run.
+#define SHM_RING_SIZE (64 * 1024)   // bytes of records per ring, a power of two
+#define SHM_RECORD_ALIGN 8          // records start at multiples of this
+#define SHM_MAX_RECORD (SHM_RING_SIZE / 2)   // largest payload a ring accepts
+#define SHM_WAIT_MS 100             // sleepers wake at least this often to check that their peer is alive
+#define SHM_MAGIC 0x4d51524e        // "MQRN"
+#define SHM_VERSION 4
+
+// Record types exchanged by mq_autograder and its workers
+typedef enum {
+    SHM_RECORD_PAD = 0,   // filler up to the end of the ring, skipped by shm_ring_peek()
+    MQ_ACK,               // worker -> autograder: attached to the region
+    MQ_SYNACK,            // autograder -> worker: start testing
+    MQ_RESULTS,           // worker -> autograder: mq_results_header_t, then count mq_result_t
+    MQ_DONE               // worker -> autograder: finished testing
+} shm_record_type_t;
+
+// Precedes every record's payload, which is padded to SHM_RECORD_ALIGN
+typedef struct {
+    uint32_t type;            // shm_record_type_t
+    uint32_t length;          // bytes of payload
+} shm_record_t;
+
+// A futex someone sleeps on. Only its owner sets sleeping; anyone may bump seq to wake it.
+typedef struct {
+    uint32_t seq;
+    uint32_t sleeping;        // 1 while the owner is waiting (or about to) on seq
+} shm_waiter_t;
+
+// Positions are free-running byte counts (mod 2^32); head and tail sit on their own cache lines
+// so the producer and consumer never write the same line
+typedef struct {
+    _Alignas(64) uint32_t head;   // bytes ever written - stored by the producer only
+    _Alignas(64) uint32_t tail;   // bytes ever consumed - stored by the consumer only
+    _Alignas(64) char data[SHM_RING_SIZE];
+} shm_ring_t;
+
+typedef struct {
+    _Alignas(64) shm_waiter_t waiter;   // the worker sleeps here (dispatch empty or results full)
+    shm_ring_t dispatch;                // autograder -> worker
+    shm_ring_t results;                 // worker -> autograder
+} shm_channel_t;
+
+// A pair of the work queue
+typedef struct {
+    int32_t param;
+    uint32_t path_offset;     // of the executable path (null-terminated) from the start of the region
+    uint32_t exe_id;          // row of the executable in the autograder's results
+    uint16_t param_idx;       // column of the parameter
+    uint16_t reserved;
+} shm_pair_t;
+
+// Results are sent in batches: an MQ_RESULTS record holds this header and count results. The header
+// is checked by the autograder, so a worker built against another layout is caught at once.
+#define MQ_RESULTS_VERSION 1
+#define MQ_RESULTS_BATCH 128        // results per MQ_RESULTS record at most
+#define MQ_RESULTS_FLUSH_MS 100     // a partial batch is sent once its oldest result is this old, even if no other comes
+
+typedef struct {
+    uint16_t version;         // MQ_RESULTS_VERSION
+    uint16_t record_size;     // sizeof(mq_result_t)
+    uint32_t count;
+} mq_results_header_t;
+
+typedef struct {
+    uint32_t exe_id;          // from the pair
+    uint16_t param_idx;       // from the pair
+    uint8_t status;           // CORRECT, INCORRECT, ...
+    uint8_t reserved;
+    uint32_t duration_ms;     // wall time from launch to reaping
+} mq_result_t;
+
+// Layout: this header, channels[num_workers], shm_pair_t pairs[num_pairs], then the paths
+typedef struct {
+    uint32_t magic;           // SHM_MAGIC
+    uint32_t version;         // SHM_VERSION
+    uint32_t num_workers;
+    uint32_t num_pairs;
+    uint64_t size;            // bytes of the whole region
+    uint64_t pairs_offset;    // of pairs[] from the start of the region
+    uint32_t session_params;  // 0: pairs are claimed one at a time; otherwise runs of this many, one executable each
+    uint32_t reserved;
+    _Alignas(64) uint32_t next_pair;    // first pair nobody has claimed yet - on its own cache line
+    _Alignas(64) shm_waiter_t waiter;   // the autograder sleeps here (all results empty or a dispatch full)
+    shm_channel_t channels[];           // channels[worker_id - 1]
+} shm_channels_t;
+
+
+// Create the shared region for num_workers workers and a queue of num_pairs pairs whose paths take
+// paths_size bytes, in a memfd that is inherited across exec(). Sets *fd to the memfd. Fill the
+// queue (see shm_pairs() and shm_paths()) before starting the workers. Exits on failure.
+shm_channels_t *create_shm_channels(int num_workers, int num_pairs, size_t paths_size, int *fd);
+
+
+// Map the region created by create_shm_channels() from its inherited fd. Exits on failure.
+shm_channels_t *attach_shm_channels(int fd);
+
+
+void free_shm_channels(shm_channels_t *channels);
+
+
+// The work queue and the area its paths are stored in (path_offset counts from the region itself)
+shm_pair_t *shm_pairs(shm_channels_t *channels);
+char *shm_paths(shm_channels_t *channels);
+
+
+// Claim the next pair of the work queue. Returns its index, or -1 once every pair is claimed.
+int shm_claim_pair(shm_channels_t *channels);
+
+
+// Claim the next count pairs of the work queue at once (an executable's run in session mode).
+// Returns the index of the first, or -1 once every pair is claimed. The run is cut short at the
+// end of the queue.
+int shm_claim_run(shm_channels_t *channels, uint32_t count);
+
+
+// Append a record to ring and wake peer if it sleeps. Returns -1 if the ring is full; wait for the
+// consumer (see shm_prepare_wait()) and try again. length must not exceed SHM_MAX_RECORD.
+int shm_ring_try_send(shm_ring_t *ring, shm_waiter_t *peer, uint32_t type, const void *payload, uint32_t length);
+
+
+// The next record of ring, or NULL if it is empty. The payload stays valid (and in the ring)
+// until shm_ring_consume().
+const char *shm_ring_peek(shm_ring_t *ring, uint32_t *type, uint32_t *length);
+
+
+// Release the record returned by shm_ring_peek() and wake peer if it waits for space
+void shm_ring_consume(shm_ring_t *ring, shm_waiter_t *peer);
+
+
+// Sleep on self until someone wakes it or timeout_ms passes. Call shm_prepare_wait() first and
+// check the condition being waited for once more: if it now holds, call shm_cancel_wait(),
+// otherwise shm_wait() with the value shm_prepare_wait() returned.
+uint32_t shm_prepare_wait(shm_waiter_t *self);
+void shm_cancel_wait(shm_waiter_t *self);
+void shm_wait(shm_waiter_t *self, uint32_t seq, long timeout_ms);
+
+
+// Wake waiter if its owner sleeps on it. A fence and a load when it does not.
+void shm_wake(shm_waiter_t *waiter);
+
+#endif // SHMRING_H
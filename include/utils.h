@@ -17,11 +17,25 @@
 #include <errno.h>
 #include <sys/ipc.h>
 #include <sys/msg.h>
+#include <stdint.h>
 
 
 #define TIMEOUT_SECS 10    // Timeout threshold for stuck/infinite loop
+#define TIMEOUT_MS (TIMEOUT_SECS * 1000L)  // Per-child budget, measured from the child's own start
 #define MAX_INT_CHARS 10 // Maximum number of characters in an integer
 
+// Report writer (see write_results_rows())
+#define REPORT_STATUS_CELL 11              // "%9s) " - width of every status cell
+#define REPORT_BLOCK_BYTES (8 << 20)       // rows are formatted and written this many bytes at a time
+#define REPORT_THREAD_MIN_CELLS (1 << 18)  // smaller matrices are formatted by the calling thread alone
+#define REPORT_MAX_THREADS 16
+
+// Sidecar index of a results file (see write_results_index())
+#define RESULTS_INDEX_SUFFIX ".idx"
+#define RESULTS_INDEX_MAGIC "AGIX"
+#define RESULTS_INDEX_VERSION 1
+#define RESULTS_INDEX_EMPTY UINT32_MAX     // row of an unused bucket
+
 /************************* ONLY FOR MESSAGE QUEUES *************************/
 // Message queue msgtyp for general messages between mq_autograder and worker
 #define BROADCAST_MTYPE 4061  
@@ -30,14 +44,56 @@
 #define MESSAGE_SIZE 100
 /************************* ONLY FOR MESSAGE QUEUES *************************/
 
-// Main struct for storing the results of the autograder
+// Main struct for storing the results of the autograder: one row per executable. The rows are views
+// into a single arena (see create_results()) holding the parameter vector once, a dense
+// num_executables x num_params status matrix and the executable paths, so nothing is malloc'd per row.
 typedef struct {
-    char *exe_path;       // path to executable
-    int *params_tested;   // array of parameters tested
-    int *status;          // array of exit status codes for each parameter
+    char *exe_path;       // path to executable (interned in the arena)
+    int *params_tested;   // parameters tested - the same vector for every row
+    uint8_t *status;      // this row of the status matrix (CORRECT, INCORRECT, ...; 0 until graded)
+    long *cpu_usec;       // CPU time of each parameter's cgroup in usec (sandbox mode only, NULL otherwise)
+    long *memory_peak;    // peak memory of each parameter's cgroup in bytes, -1 if unknown (sandbox mode only)
 } autograder_results_t;
 
 
+/*
+Sidecar index written next to every results.txt (as <path>.idx), so one executable's row can be
+found without reading the rest of the file. Every row of results.txt has the same length, so row r
+starts at r * row_len; the index maps executable names to row numbers:
+
+    results_index_header_t
+    results_index_bucket_t buckets[capacity]     open addressing, linear probing, FNV-1a of the name
+
+Buckets only hold a hash, so a hit is confirmed against the name at the start of the row itself.
+*/
+typedef struct {
+    char magic[4];            // RESULTS_INDEX_MAGIC
+    uint16_t version;         // RESULTS_INDEX_VERSION
+    uint16_t reserved;
+    uint32_t num_rows;
+    uint32_t capacity;        // power of two, at least twice num_rows
+    uint64_t row_len;         // bytes per row, '\n' included
+    uint64_t results_size;    // size of the results file the index was built for
+} results_index_header_t;
+
+typedef struct {
+    uint32_t hash;            // low 32 bits of the name's FNV-1a hash
+    uint32_t row;             // RESULTS_INDEX_EMPTY if the bucket is unused
+} results_index_bucket_t;
+
+
+// Rows of a results matrix for write_results_rows(), already in output order. Statuses come from
+// status_rows[i][j] or, when it is not NULL, from the dense matrix byte_rows[i * num_params + j].
+typedef struct {
+    int num_rows;
+    int num_params;
+    const int *params;        // tested parameter of each column
+    const char **names;       // executable name of each row
+    const uint8_t **status_rows;
+    const uint8_t *byte_rows;
+} results_rows_t;
+
+
 // Message buffer struct for message queue
 typedef struct {
     long mtype;
@@ -50,7 +106,9 @@ enum {
     CORRECT = 1,            // Corresponds to case 1: Exit with status 0 (correct answer)
     INCORRECT,              // Corresponds to case 2: Exit with status 1 (incorrect answer)
     SEGFAULT,               // Corresponds to case 3: Triggering a segmentation fault
-    STUCK_OR_INFINITE       // Corresponds to case 4 and 5: Stuck, or in an infinite loop
+    STUCK_OR_INFINITE,      // Corresponds to case 4 or 5, when the child is only caught by its deadline
+    STUCK,                  // Corresponds to case 5: Blocked in pause() (classified by the watchdog)
+    INFINITE_LOOP           // Corresponds to case 4: Used up its CPU budget (classified by the watchdog)
 };
 
 
@@ -58,6 +116,12 @@ enum {
 // Example: solutions/sol_1 -> sol_1
 char *get_exe_name(char *path);
 
+// Name of an executable in the reports: its path relative to the directory last scanned by
+// scan_executables() (so executables in per-student subdirectories stay distinct), or its file name
+// if it is not under that directory
+// Example: solutions/alice/sol_1 -> alice/sol_1
+char *get_result_name(char *path);
+
 // Function to convert status macro to the corresponding message
 // Example: CORRECT -> "correct"
 const char* get_status_message(int status);
@@ -68,28 +132,74 @@ const char* get_status_message(int status);
 char **get_student_executables(char *solution_dir, int *num_executables);
 
 
-// Count the number of times the pattern "processor" occurs in /proc/cpuinfo
-int get_batch_size();
+// Called with the path of every directory scan_executables() reads, solution_dir included
+typedef void (*scan_visit_fn)(const char *dir_path);
+
+// One-pass scan of solution_dir with getdents64(): d_type decides what each entry is, and
+// fstatat() is only called when it cannot (DT_UNKNOWN, symlinks). Only files that can be executed
+// and start with an ELF header or "#!" are returned. With recursive set, non-hidden subdirectories
+// are scanned too (symlinked directories are not followed). visit may be NULL. Entries that vanish
+// mid-scan are skipped. Returns a malloc'd array of malloc'd paths, like get_student_executables().
+char **scan_executables(char *solution_dir, int recursive, scan_visit_fn visit, int *num_executables);
+
 
+// Whether scan_executables() would return path: a non-hidden regular file (or a symlink to one)
+// that can be executed and starts with an ELF header or "#!"
+int is_submission(const char *path);
 
-// Create the input/<input>.in files for each parameter
-void create_input_files(char **argv_params, int num_parameters);
 
+// Write each parameter once into its own sealed memfd and return the malloc'd array of fds.
+// Children read their stdin from /proc/self/fd/<fd> (see launcher.c), which gives each of them
+// an independent offset into the one shared page-cache copy.
+int *create_input_memfds(char **argv_params, int num_parameters);
 
-// Setup timer to determine if child processes are stuck
-void start_timer(int seconds, void (*timeout_handler)(int));
 
+// Current CLOCK_MONOTONIC time in milliseconds, used for per-child deadlines
+long get_time_ms();
 
-// Cancel the timer
-void cancel_timer();
 
+// Close the memfds from create_input_memfds() and free the array
+void close_input_memfds(int *input_fds, int num_parameters);
 
-// Unlink all of the input/<input>.in files
-void remove_input_files(char **argv_params, int num_parameters);
 
+// Determine the outcome of a finished child from its wait status and what it wrote to stdout
+// Example: exited and printed "0" -> CORRECT, killed by SIGSEGV -> SEGFAULT. Output that is not a
+// number (or is neither 0 nor 1) is INCORRECT.
+int get_verdict(int wait_status, const char *output);
 
-// Unlink all of the output/<executable>.<param> files in the current batch
-void remove_output_files(autograder_results_t *results, int tested, int current_batch_size, char *param);
+
+// Allocate the results of num_executables executables and total_params parameters as one arena:
+// the rows, the parameter vector (atoi() of params), the zeroed status matrix, the CPU/memory
+// matrices if with_usage is set, and copies of exe_paths. Release it with free_results().
+autograder_results_t *create_results(char **exe_paths, int num_executables, char **params, int total_params, int with_usage);
+
+
+void free_results(autograder_results_t *results);
+
+
+// Sort results into output order: by the number after the last '_' of the executable name, then
+// by natural order of the whole name (so names without a number sort sensibly too).
+// O(n log n); each name is parsed once.
+void sort_results(autograder_results_t *results, int num_executables);
+
+
+// Write rows in the results.txt format (see write_results_to_file()) to path. Every row has the
+// same length, so rows are formatted from preformatted cells into large blocks (split across
+// threads for big matrices) and written with writev(). The sidecar index (see
+// write_results_index()) is written next to it. Returns -1 on failure.
+int write_results_rows(const results_rows_t *rows, const char *path);
+
+
+// Write the index of the results file at results_path, whose rows are names[0..num_rows) and
+// row_len bytes long, to results_path + RESULTS_INDEX_SUFFIX. Returns -1 on failure.
+int write_results_index(const char *results_path, const char **names, int num_rows, long row_len);
+
+
+// Find exe_name's row in the results file at results_path: one bucket probe or two in the index and
+// a single pread() of the row. Falls back to scanning the file if the index is missing, stale or
+// has no row for exe_name.
+// Returns the row (malloc()ed, without the '\n') or NULL if exe_name is not in the file.
+char *find_results_row(const char *results_path, const char *exe_name);
 
 
 /*
@@ -125,13 +235,26 @@ double get_score(char *results_file);
 
 
 /*
-This function goes through each executable and calculates the score using scores().
-Then it writes the scores to a file called scores.txt. The format of the file is
+Writes the CPU time and peak memory measured by the sandbox (see sandbox.h) to usage_file, one line
+per executable in the same order and layout as results.txt:
+
+<exe_name:strlen(longest_exe_name)>:<p1:5> (<cpu_ms:8.1f>ms <peak_kib:8>K)...
+
+The peak is "-" when the memory controller was unavailable.
+*/
+void write_usage_to_file(autograder_results_t *results, int num_executables, int total_params, char *usage_file);
+
+
+/*
+This function goes through each executable and calculates the score straight from its status
+row in results (no re-parsing of results.txt). Then it writes the scores to scores_file in one
+buffered pass. The format of the file is
 
-<exe_name:strlen(longest_exe_name)>: <score:5.3f>
+<exe_name:strlen(longest_exe_name)>: <score:5.3f> (<n> correct, <n> incorrect, <n> crash, <n> stuck/inf, <n> stuck, <n> infinite)
 
-where <exe_name> is the name of the executable and <score> is the score of the executable.
+where <exe_name> is the name of the executable, <score> is the share of correct parameters and
+the counts break the parameters down by verdict.
 */
-void write_scores_to_file(autograder_results_t *results, int num_executables, char *results_file);
+void write_scores_to_file(autograder_results_t *results, int num_executables, int total_params, char *scores_file);
 
 #endif // UTILS_H
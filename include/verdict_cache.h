@@ -0,0 +1,98 @@
+#ifndef VERDICT_CACHE_H
+#define VERDICT_CACHE_H
+
+#include <stdint.h>
+#include "sha256.h"
+
+// Default location of the persisted verdict cache (relative to the working directory)
+#define VERDICT_CACHE_FILE ".autograder_cache"
+
+// First line of the cache file. Bump it whenever the grader would give a pair another verdict than
+// before (or the format changes): a file from another version is ignored and every pair is graded.
+#define VERDICT_CACHE_VERSION "autograder-verdicts 4"
+
+// Only verdicts that follow from the binary and the parameter alone are cached. STUCK_OR_INFINITE,
+// STUCK and INFINITE_LOOP depend on the timeout and the watchdog racing the machine's load, so a
+// pair that got one is graded again next run.
+#define VERDICT_CACHEABLE(status) ((status) >= CORRECT && (status) <= SEGFAULT)
+
+// SHA-256 of an executable's contents. It names the binary in the verdict cache, on the wire and in
+// the agents' caches, where two binaries sharing a name would make one's verdicts the other's.
+typedef struct {
+    unsigned char bytes[SHA256_DIGEST_SIZE];
+} content_digest_t;
+
+// Characters format_digest() writes, including the null terminator
+#define CONTENT_DIGEST_HEX_SIZE (2 * SHA256_DIGEST_SIZE + 1)
+
+// The verdict of one (executable, parameter) pair. A verdict only holds for the exact binary, the
+// way the parameter was passed and the timeout and CPU budget it ran under, so all of them are part
+// of the key. The parameter is kept as given on the command line: the child gets that string, so
+// "1", "01" and "+1" are different pairs.
+typedef struct {
+    char *exe_path;           // path to executable (NULL for empty buckets)
+    content_digest_t digest;  // of the executable's contents, see digest_executable()
+    int input_mode;           // input_mode_t the pair was run with
+    long timeout_ms;          // per-child budget the pair was run with
+    long cpu_budget_ms;       // watchdog CPU budget the pair was run with (WATCHDOG_CPU_BUDGET_MS)
+    char *param;              // as passed to the child
+    int status;               // CORRECT, INCORRECT, ...
+} verdict_entry_t;
+
+// The version of an executable seen in this run
+typedef struct {
+    char *exe_path;           // NULL for empty buckets
+    content_digest_t digest;
+} verdict_version_t;
+
+// Open addressing hash table of verdicts
+typedef struct {
+    char *path;                 // file the cache is loaded from and saved to
+    verdict_entry_t *entries;
+    int capacity;               // always a power of two
+    int count;
+    verdict_version_t *versions;  // current version of each executable, see verdict_cache_retain()
+    int versions_capacity;        // always a power of two
+    int versions_count;
+} verdict_cache_t;
+
+
+// Load the cache stored in path. A missing file gives an empty cache.
+verdict_cache_t *load_verdict_cache(const char *path);
+
+
+// Digest the contents of the executable at path into *digest. Returns -1 if it cannot be read.
+int digest_executable(const char *path, content_digest_t *digest);
+
+
+// Write digest in lowercase hex to hex (CONTENT_DIGEST_HEX_SIZE bytes)
+void format_digest(const content_digest_t *digest, char *hex);
+
+
+// Parse the CONTENT_DIGEST_HEX_SIZE - 1 hex digits at hex into *digest. Returns -1 if they are not.
+int parse_digest(const char *hex, content_digest_t *digest);
+
+
+// Record digest as the current version of exe_path. The verdicts of its other versions are
+// dropped when the cache is saved (a resubmission replaces them).
+void verdict_cache_retain(verdict_cache_t *cache, const char *exe_path, const content_digest_t *digest);
+
+
+// Cached status of the pair, or 0 if it has not been graded under this key before
+int verdict_cache_lookup(verdict_cache_t *cache, const char *exe_path, const content_digest_t *digest,
+                         int input_mode, long timeout_ms, long cpu_budget_ms, const char *param);
+
+
+// Remember the status of a freshly graded pair. Statuses that are not VERDICT_CACHEABLE are ignored.
+void verdict_cache_store(verdict_cache_t *cache, const char *exe_path, const content_digest_t *digest,
+                         int input_mode, long timeout_ms, long cpu_budget_ms, const char *param, int status);
+
+
+// Write the cache back to its file (atomically, via a temporary file and rename()). Pairs whose
+// parameter is empty or contains whitespace cannot be written in the line format and are left out.
+void save_verdict_cache(verdict_cache_t *cache);
+
+
+void free_verdict_cache(verdict_cache_t *cache);
+
+#endif // VERDICT_CACHE_H
@@ -0,0 +1,68 @@
+#ifndef WATCHDOG_H
+#define WATCHDOG_H
+
+#include <sys/types.h>
+
+// How often every running child's /proc entries are sampled
+#define WATCHDOG_INTERVAL_MS 50
+
+// A child seen blocked in pause()/sigsuspend() for this long (with no other runnable thread) is stuck
+#define WATCHDOG_STUCK_MS 250
+
+// A child that has used this much CPU time (user + system) is in an infinite loop. It is set on its
+// own rather than derived from TIMEOUT_SECS: well below the timeout, so a spinning child is killed
+// early, but above the CPU time a correct solution may need (test_cases/slow spins for about 4 s).
+// Verdicts are cached per budget (see verdict_cache.h), so changing it grades every pair again.
+#define WATCHDOG_CPU_BUDGET_MS 5000
+
+// Classifies running children from /proc/<pid>/stat and /proc/<pid>/wchan, so pause()d children
+// are killed long before their TIMEOUT_SECS deadline and spinning ones are told apart from them. Sampling is driven
+// by a periodic timerfd the owner polls next to its other fds.
+typedef struct {
+    int num_slots;
+    int timer_fd;
+    int *watched;         // 1 if the child in slot is being sampled
+    long *blocked_since;  // time (ms) the child was first seen blocked in pause(), -1 if it is not
+    int *verdict;         // STUCK or INFINITE_LOOP once the child is classified (and killed), 0 before
+    unsigned long *cpu_base;  // CPU ticks the child had used when it was (re)watched; only the rest counts
+    long clock_ticks;     // sysconf(_SC_CLK_TCK), the unit of utime/stime in /proc/<pid>/stat
+} watchdog_t;
+
+
+// Create a watchdog for children in slots [0, num_slots)
+watchdog_t *create_watchdog(int num_slots);
+
+
+// Start sampling the child in slot and clear the slot's verdict
+void watchdog_watch(watchdog_t *watchdog, int slot);
+
+
+// Same as watchdog_watch() for a child that keeps running from one piece of work to the next (a
+// session moving on to its next parameter, see session.h): only the CPU time it uses from now on
+// counts against WATCHDOG_CPU_BUDGET_MS
+void watchdog_rewatch(watchdog_t *watchdog, int slot, pid_t pid);
+
+
+// Stop sampling the child in slot (it has been reaped). The verdict is kept for the caller.
+void watchdog_forget(watchdog_t *watchdog, int slot);
+
+
+// Handle a tick of the timerfd: sample every watched child (pids[slot]) and SIGKILL the ones
+// that are classified. They are then reaped like any other child.
+void watchdog_sample(watchdog_t *watchdog, pid_t *pids);
+
+
+// Classify the child in slot one last time as its deadline kills it. A child still runnable at
+// that point was starved of CPU rather than idle, so it counts as an infinite loop even if it
+// never reached WATCHDOG_CPU_BUDGET_MS; one blocked in pause() is stuck. Otherwise the verdict
+// is left to the wait status (STUCK_OR_INFINITE).
+void watchdog_expire(watchdog_t *watchdog, int slot, pid_t pid);
+
+
+// STUCK or INFINITE_LOOP if the watchdog classified the child last run in slot, 0 otherwise
+int watchdog_verdict(watchdog_t *watchdog, int slot);
+
+
+void free_watchdog(watchdog_t *watchdog);
+
+#endif // WATCHDOG_H
@@ -0,0 +1,344 @@
+#include "utils.h"
+#include "reaper.h"
+#include "launcher.h"
+#include "concurrency.h"
+#include "verdict_cache.h"
+#include "netproto.h"
+
+// Where shipped binaries are kept between runs: <cache>/<content digest>/.blob, hard-linked to the
+// name each pair runs it under (the name is the child's argv[0])
+#define AGENT_CACHE_DIR ".agent_cache"
+
+int sock;                 // Connection to the coordinator
+input_mode_t mode;        // How parameters are passed, as announced by the coordinator
+char *cache_dir;
+int num_slots;
+
+// Digests whose blob this agent has checked (or fetched) in this run. A blob found in the cache is
+// only trusted once its contents are seen to match its directory's name.
+content_digest_t *verified;
+int num_verified;
+int verified_capacity;
+
+// Information about the child processes running in each slot - same as in worker.c
+int *child_status;        // Contains status of the child in each slot (-1 for idle, 1 for still running)
+pid_t *slot_pid;
+uint32_t *slot_pair;      // Coordinator's id of the pair running in each slot
+spawn_plan_t *slot_plan;
+char (*slot_path)[PATH_MAX];               // Cached binary of each slot
+char (*slot_param)[MAX_INT_CHARS + 2];     // Parameter of each slot as a string (+2 for sign and null terminator)
+int *slot_input_fd;       // Input memfd of each slot (REDIR only, -1 otherwise)
+long *slot_start;         // Monotonic time (ms) at which the child in each slot was launched
+
+// Reaps children in the order they finish and enforces their deadlines - same as in autograder.c
+reaper_t *reaper;
+
+// Limits the children in flight from CPU quota and pressure - same as in autograder.c
+concurrency_t *concurrency;
+
+
+// The coordinator is gone: the run is over for this agent, and its children must not outlive it
+void lost_coordinator() {
+    fprintf(stderr, "Lost the connection to the coordinator\n");
+    for (int i = 0; i < num_slots; i++) {
+        if (child_status[i] == 1 && slot_pid[i] != -1) {
+            kill(slot_pid[i], SIGKILL);
+        }
+    }
+    exit(EXIT_FAILURE);
+}
+
+
+// Fetch the binary with digest from the coordinator into blob_path (under dir)
+int fetch_binary(const content_digest_t *digest, const char *dir, const char *blob_path) {
+    struct iovec iov = { (void *) digest->bytes, SHA256_DIGEST_SIZE };
+    if (net_send(sock, NET_FETCH, &iov, 1) == -1) {
+        lost_coordinator();
+    }
+    uint32_t type, length;
+    char *payload;
+    if (net_recv(sock, &type, &payload, &length) == -1) {
+        lost_coordinator();
+    }
+    const char *cursor = payload;
+    content_digest_t received;
+    if (type != NET_BINARY || net_get_digest(&cursor, payload + length, &received) == -1
+            || memcmp(&received, digest, sizeof(received)) != 0) {
+        fprintf(stderr, "Unexpected reply to a binary request\n");
+        lost_coordinator();
+    }
+
+    // Written under a temporary name and renamed, so no agent sharing the cache sees half a binary
+    char tmp_path[PATH_MAX];
+    snprintf(tmp_path, sizeof(tmp_path), "%s/.tmp.%d", dir, getpid());
+    if (mkdir(dir, 0755) == -1 && errno != EEXIST) {
+        perror("Failed to create cache directory");
+        free(payload);
+        return -1;
+    }
+    int fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0755);
+    if (fd == -1) {
+        perror("Failed to write binary");
+        free(payload);
+        return -1;
+    }
+    size_t size = payload + length - cursor;
+    int failed = write(fd, cursor, size) != (ssize_t) size;
+    failed |= close(fd) == -1;
+    free(payload);
+
+    content_digest_t stored;
+    if (failed || digest_executable(tmp_path, &stored) == -1 || memcmp(&stored, digest, sizeof(stored)) != 0
+            || rename(tmp_path, blob_path) == -1) {
+        fprintf(stderr, "Failed to store binary %s\n", dir);
+        unlink(tmp_path);
+        return -1;
+    }
+    return 0;
+}
+
+
+// 1 if digest's blob has been checked in this run
+int is_verified(const content_digest_t *digest) {
+    for (int i = 0; i < num_verified; i++) {
+        if (memcmp(&verified[i], digest, sizeof(*digest)) == 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+
+// Put the path of pair's binary (fetched if it is not cached yet) in path. Returns -1 on failure.
+int cached_binary(const net_pair_t *pair, char *path) {
+    char hex[CONTENT_DIGEST_HEX_SIZE];
+    char dir[PATH_MAX];
+    char blob_path[PATH_MAX];
+    format_digest(&pair->digest, hex);
+    snprintf(dir, sizeof(dir), "%s/%s", cache_dir, hex);
+    snprintf(blob_path, sizeof(blob_path), "%s/%s/.blob", cache_dir, hex);
+    snprintf(path, PATH_MAX, "%s/%s/%s", cache_dir, hex, pair->name);
+
+    // A blob left by an earlier run (or by another agent sharing the cache) may be truncated or
+    // replaced; it is digested once per run and fetched again unless it matches
+    if (!is_verified(&pair->digest)) {
+        content_digest_t digest;
+        if ((digest_executable(blob_path, &digest) == -1 || memcmp(&digest, &pair->digest, sizeof(digest)) != 0)
+                && fetch_binary(&pair->digest, dir, blob_path) == -1) {
+            return -1;
+        }
+        if (num_verified == verified_capacity) {
+            verified_capacity = verified_capacity > 0 ? verified_capacity * 2 : 16;
+            verified = realloc(verified, verified_capacity * sizeof(content_digest_t));
+            if (verified == NULL) {
+                fprintf(stderr, "Error occured at line %d: realloc failed\n", __LINE__ - 2);
+                exit(EXIT_FAILURE);
+            }
+        }
+        verified[num_verified++] = pair->digest;
+    }
+
+    // The name is only used if it is a link to that very blob
+    struct stat blob_st, path_st;
+    if (stat(blob_path, &blob_st) == -1) {
+        perror("Failed to stat cached binary");
+        return -1;
+    }
+    if (stat(path, &path_st) == 0 && path_st.st_dev == blob_st.st_dev && path_st.st_ino == blob_st.st_ino) {
+        return 0;
+    }
+    if ((unlink(path) == -1 && errno != ENOENT) || (link(blob_path, path) == -1 && errno != EEXIST)) {
+        perror("Failed to link cached binary");
+        return -1;
+    }
+    return 0;
+}
+
+
+// Execute a pair using posix_spawn(), exactly like worker.c
+void execute_pair(const net_pair_t *pair, int slot) {
+    if (cached_binary(pair, slot_path[slot]) == -1) {
+        // Without the binary this agent cannot grade anything reliably; its pairs go to other agents
+        lost_coordinator();
+    }
+    snprintf(slot_param[slot], sizeof(slot_param[slot]), "%d", pair->param);
+    slot_input_fd[slot] = -1;
+    if (mode == INPUT_REDIR) {
+        char *param = slot_param[slot];
+        int *fds = create_input_memfds(&param, 1);
+        slot_input_fd[slot] = fds[0];
+        free(fds);
+    }
+    init_spawn_plan(&slot_plan[slot], slot_path[slot], slot_param[slot], mode, slot_input_fd[slot]);
+
+    slot_pid[slot] = spawn_solution(&slot_plan[slot], reaper_child_sigmask());
+    slot_pair[slot] = pair->pair_id;
+    child_status[slot] = 1;
+    slot_start[slot] = get_time_ms();
+    if (slot_pid[slot] == -1) {
+        reaper_add_failed(reaper, slot, INCORRECT);   // cannot be started
+        return;
+    }
+    reaper_add(reaper, slot, slot_pid[slot], slot_plan[slot].output_fd, -1, TIMEOUT_MS);
+}
+
+
+// Wait for the next child to finish (or time out), and send its verdict to the coordinator
+void report_next_verdict() {
+    int status;
+    int slot = reaper_wait(reaper, &status);
+    concurrency_record(concurrency, reaper_cpu_usec(reaper, slot), get_time_ms() - slot_start[slot]);
+
+    // A child the watchdog classified early was killed, so its wait status alone would read as a timeout
+    int final_status = reaper_verdict(reaper, slot);
+    if (final_status == 0) {
+        final_status = get_verdict(status, reaper_output(reaper, slot));
+    }
+    if (slot_input_fd[slot] != -1) {
+        close(slot_input_fd[slot]);
+    }
+    child_status[slot] = -1;
+
+    char verdict[8];
+    struct iovec iov = { verdict, sizeof(verdict) };
+    net_put_u32(verdict, slot_pair[slot]);
+    net_put_u32(verdict + 4, final_status);
+    if (net_send(sock, NET_VERDICT, &iov, 1) == -1) {
+        lost_coordinator();
+    }
+}
+
+
+// Ask for up to free_slots pairs and start them. Returns 0 once the coordinator says the run is over.
+int request_pairs(int free_slots, int idle) {
+    char request[8];
+    struct iovec iov = { request, sizeof(request) };
+    net_put_u32(request, free_slots);
+    net_put_u32(request + 4, idle);
+    if (net_send(sock, NET_REQUEST, &iov, 1) == -1) {
+        lost_coordinator();
+    }
+
+    // An idle agent's request is held by the coordinator until there is work (or the run is over)
+    uint32_t type, length;
+    char *payload;
+    if (net_recv(sock, &type, &payload, &length) == -1) {
+        lost_coordinator();
+    }
+    if (type == NET_BYE) {
+        free(payload);
+        return 0;
+    }
+    const char *cursor = payload;
+    const char *end = payload + length;
+    uint32_t count;
+    if (type != NET_ASSIGN || net_get_u32(&cursor, end, &count) == -1 || count > (uint32_t) free_slots) {
+        fprintf(stderr, "Unexpected reply to a request for pairs\n");
+        lost_coordinator();
+    }
+    for (uint32_t i = 0; i < count; i++) {
+        net_pair_t pair;
+        if (net_get_pair(&cursor, end, &pair) == -1) {
+            fprintf(stderr, "Malformed pair from the coordinator\n");
+            lost_coordinator();
+        }
+        int slot = 0;
+        while (child_status[slot] != -1) {
+            slot++;
+        }
+        execute_pair(&pair, slot);
+    }
+    free(payload);
+    return 1;
+}
+
+
+int main(int argc, char *argv[]) {
+    if (argc < 3 || argc > 4) {
+        fprintf(stderr, "Usage: %s <coordinator host> <port> [<cache dir>]\n", argv[0]);
+        return 1;
+    }
+    cache_dir = argc == 4 ? argv[3] : AGENT_CACHE_DIR;
+    if (mkdir(cache_dir, 0755) == -1 && errno != EEXIST) {
+        perror("Failed to create cache directory");
+        return 1;
+    }
+
+    sock = net_connect(argv[1], argv[2]);
+    if (sock == -1) {
+        return 1;
+    }
+    char hello[4];
+    struct iovec iov = { hello, sizeof(hello) };
+    net_put_u32(hello, NET_PROTOCOL_VERSION);
+    uint32_t type, length, announced_mode;
+    char *payload;
+    if (net_send(sock, NET_HELLO, &iov, 1) == -1 || net_recv(sock, &type, &payload, &length) == -1) {
+        fprintf(stderr, "Handshake with the coordinator failed\n");
+        return 1;
+    }
+    const char *cursor = payload;
+    if (type != NET_WELCOME || net_get_u32(&cursor, payload + length, &announced_mode) == -1 || announced_mode > INPUT_PIPE) {
+        fprintf(stderr, "Handshake with the coordinator failed\n");
+        return 1;
+    }
+    mode = announced_mode;
+    free(payload);
+
+    // Enough slots for the controller to oversubscribe every usable CPU, like the autograder
+    num_slots = get_effective_cpus() * CONCURRENCY_MAX_PER_CPU;
+    child_status = malloc(num_slots * sizeof(int));
+    slot_pid = malloc(num_slots * sizeof(pid_t));
+    slot_pair = malloc(num_slots * sizeof(uint32_t));
+    slot_plan = malloc(num_slots * sizeof(spawn_plan_t));
+    slot_path = malloc(num_slots * sizeof(*slot_path));
+    slot_param = malloc(num_slots * sizeof(*slot_param));
+    slot_input_fd = malloc(num_slots * sizeof(int));
+    slot_start = malloc(num_slots * sizeof(long));
+    if (child_status == NULL || slot_pid == NULL || slot_pair == NULL || slot_plan == NULL || slot_path == NULL
+            || slot_param == NULL || slot_input_fd == NULL || slot_start == NULL) {
+        fprintf(stderr, "Error occured at line %d: malloc failed\n", __LINE__ - 3);
+        exit(EXIT_FAILURE);
+    }
+    for (int j = 0; j < num_slots; j++) {
+        child_status[j] = -1;
+    }
+    reaper = create_reaper(num_slots);
+    concurrency = create_concurrency(num_slots);
+
+    // Keep the slots the controller allows busy, and send each verdict back as soon as it is known
+    int more = 1;
+    int running = 0;
+    int graded = 0;
+    while (more || running > 0) {
+        concurrency_update(concurrency);
+        int free_slots = concurrency_limit(concurrency) - running;
+        if (more && free_slots > 0) {
+            more = request_pairs(free_slots, running == 0);
+            running = 0;
+            for (int j = 0; j < num_slots; j++) {
+                running += child_status[j] != -1;
+            }
+        }
+        if (running > 0) {
+            report_next_verdict();
+            running--;
+            graded++;
+        }
+    }
+    printf("Graded %d pairs\n", graded);
+
+    close(sock);
+    free_reaper(reaper);
+    free_concurrency(concurrency);
+    free(child_status);
+    free(slot_pid);
+    free(slot_pair);
+    free(slot_plan);
+    free(slot_path);
+    free(slot_param);
+    free(slot_input_fd);
+    free(slot_start);
+    free(verified);
+    return 0;
+}
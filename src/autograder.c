@@ -1,349 +1,1138 @@
 #include "utils.h"
+#include "history.h"
+#include "reaper.h"
+#include "launcher.h"
+#include "forkserver.h"
+#include "sandbox.h"
+#include "concurrency.h"
+#include "results_file.h"
+#include "verdict_cache.h"
 
-// Batch size is determined at runtime now
-pid_t *pids;
+#include <getopt.h>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <sys/timerfd.h>
+
+#define WATCH_SETTLE_MS 200     // --watch grades once the directory has been quiet this long
+
+// An (executable, parameter) pair in the global work queue
+typedef struct {
+    int exe_idx;          // index into results
+    int param_idx;        // index into params
+    long expected_ms;     // expected runtime taken from the runtime history
+    int generation;       // exe_generation of the executable when the pair was queued
+} work_item_t;
 
 // Stores the results of the autograder (see utils.h for details)
 autograder_results_t *results;
 
+char *testdir;            // Directory holding the executables to grade
 int num_executables;      // Number of executables in test directory
-int curr_batch_size;      // At most batch_size executables will be run at once
-int total_params;         // Total number of parameters to test - (argc - 2)
+int batch_size;           // Number of pool slots - the most children the controller may ever run at once
+int total_params;         // Total number of parameters to test - the arguments after <testdir>
+char **params;            // Parameters to test - the arguments after <testdir>
+int *input_fds;           // Sealed memfd holding each parameter (REDIR only, NULL otherwise)
+
+// All (executable, parameter) pairs, longest expected runtime first from queue_head on
+work_item_t *work_queue;
+int num_pairs;
+int queue_capacity;
+int queue_head;           // Next work item to launch
+int running;              // Number of slots with a running child
 
-// Contains status of child processes (-1 for done, 1 for still running)
+// Per-executable runtime history and each executable's index into it
+runtime_history_t *history;
+int *history_idx;
+long fallback_ms;         // Expected runtime of executables that have never been run
+
+// Contains status of the child in each slot (-1 for idle, 1 for still running)
 int *child_status;
 
+// Index into work_queue of the pair running in each slot
+int *slot_item;
 
-// TODO (Change 3): Timeout handler for alarm signal - kill remaining running child processes
-void timeout_handler(int signum) {
-    for (int j = 0; j < curr_batch_size; j++) {
-        if (child_status[j] == 1) {  // Checks if child is still running
-            if (kill(pids[j], SIGKILL) == -1) {  // does check on kill signal to see if successful
-                perror("Kill Failed");
-                exit(EXIT_FAILURE);
-            }
+// Monotonic time (ms) at which the child in each slot was launched
+long *slot_start;
+
+// Launch plan (argv, redirections, output path) of the pair running in each slot
+spawn_plan_t *slot_plan;
+
+// Reaps the running children in the order they finish and enforces their deadlines
+reaper_t *reaper;
+
+// Decides how many of the slots may be busy at the moment
+concurrency_t *concurrency;
+
+// Binary results file to write (--binary <file>), NULL for none. results.txt is then exported
+// from it unless --no-text is given (it can still be exported later with "autograder export").
+// scores.txt is computed from memory and always written.
+char *binary_path;
+int write_text = 1;
+
+// Fork-server mode (--forkserver): each executable is started once, stopped before main(), and
+// forked per parameter. servers[i] is NULL until executable i is first needed and NULL again once
+// it has no pairs left (or if it cannot be run as a server, see server_failed).
+int use_forkserver;
+forkserver_t **servers;
+int *server_failed;       // 1 if executable i is launched with posix_spawn() instead
+int *pairs_left;          // Pairs of executable i not yet reaped
+
+// Servers of executables that changed with pairs still in flight, stopped once nothing is running
+forkserver_t **retired_servers;
+int num_retired;
+int retired_capacity;
+
+// Sandbox mode (--cgroup <dir>): every pair runs in its own cgroup v2 leaf under <dir>, with
+// CPU/memory/pids limits, and its CPU time and peak memory end up in usage.txt
+char *cgroup_root;
+sandbox_t *sandbox;
+
+// Verdicts of earlier runs, keyed by the executable's contents (see verdict_cache.h). Cached pairs are
+// filled into results up front and left out of the work queue; --no-cache grades everything again
+// (but still refreshes the cache).
+int use_cache = 1;
+verdict_cache_t *verdict_cache;
+content_digest_t *exe_digest;   // Content digest of executable i
+int *exe_digested;              // 0 if executable i could not be read, so its verdicts are not cached
+
+// Watch mode (--watch): every submission that lands in the test directory, changes or goes away
+// is fed into the work queue, even while other pairs are still running, and only its row is
+// graded again. Rows are never moved while watching (a removed executable's row is only marked),
+// so the per-executable arrays and queued pairs keep their indices; a pair queued before its
+// executable changed is told apart by its generation and dropped.
+int watch;
+int watch_fd = -1;              // inotify instance; every directory a scan visits is added to it
+int settle_fd = -1;             // timerfd, armed for WATCH_SETTLE_MS by every change
+char **watch_dirs;              // directory of each inotify watch descriptor
+int watch_dirs_capacity;
+char **changed_paths;           // files changed since the last batch was applied
+int num_changed;
+int changed_capacity;
+int rescan_needed;              // a directory came or went, or inotify dropped events
+int changes_settled;            // the pending changes have been quiet for WATCH_SETTLE_MS
+int reports_stale;              // rows changed since the reports were last written
+
+// Per-executable bookkeeping, sized for exe_capacity executables
+int exe_capacity;
+int *exe_live;                  // 0 once executable i has been removed (--watch)
+int *exe_generation;            // bumped whenever executable i changes or goes away
+struct stat *exe_stat;          // executable i's file when it was last digested
+
+// Also grade executables in subdirectories of the test directory (--recursive), e.g. one per student
+int recursive;
+
+
+// Fork the pair from the executable's fork server, starting the server if needed. Returns -1 if
+// the executable has to be launched normally instead.
+pid_t fork_from_server(int exe_idx, spawn_plan_t *plan, int *status_fd) {
+    if (server_failed[exe_idx]) {
+        return -1;
+    }
+    if (servers[exe_idx] == NULL) {
+        servers[exe_idx] = start_forkserver(plan->exe_path, reaper_child_sigmask());
+        if (servers[exe_idx] == NULL) {
+            server_failed[exe_idx] = 1;
+            return -1;
         }
     }
+
+    pid_t pid = forkserver_spawn(servers[exe_idx], plan, status_fd);
+    if (pid == -1) {
+        stop_forkserver(servers[exe_idx]);
+        servers[exe_idx] = NULL;
+        server_failed[exe_idx] = 1;
+    }
+    return pid;
 }
 
 
-// Execute the student's executable using exec()
-void execute_solution(char *executable_path, char *input, int batch_idx) {
-    #ifdef PIPE
+// Execute the student's executable using posix_spawn() (or its fork server)
+void execute_solution(char *executable_path, int exe_idx, int param_idx, int slot) {
+    // TODO (Change 1 & 2): Capture STDOUT through a pipe and pass the input the way this
+    //                      build expects (argv, the input memfd or a pipe)
+    spawn_plan_t *plan = &slot_plan[slot];
+    int input_fd = input_fds != NULL ? input_fds[param_idx] : -1;
+    init_spawn_plan(plan, executable_path, params[param_idx], BUILD_INPUT_MODE, input_fd);
 
-        // TODO: Setup pipe
-        int pipefd[2];
-        if (pipe(pipefd) == -1) {
-            fprintf(stderr, "Error occured at line %d: pipe failed", __LINE__ - 1);
-            exit(EXIT_FAILURE);
+    int status_fd = -1;
+    pid_t pid = -1;
+    if (sandbox != NULL) {
+        // Never outside its leaf: a pair that cannot be started there fails like any other
+        pid = spawn_solution_in_cgroup(plan, reaper_child_sigmask(), sandbox_prepare(sandbox, slot));
+    } else {
+        if (use_forkserver) {
+            pid = fork_from_server(exe_idx, plan, &status_fd);
         }
-    #endif
+        if (pid == -1) {
+            pid = spawn_solution(plan, reaper_child_sigmask());
+        }
+    }
 
-    pid_t pid = fork();
+    child_status[slot] = 1;
+    slot_start[slot] = get_time_ms();
 
-    // Child process
-    if (pid == 0) {
-        char *executable_name = get_exe_name(executable_path);
+    // A pair that cannot be started is INCORRECT; the rest of the run goes on
+    if (pid == -1) {
+        reaper_add_failed(reaper, slot, INCORRECT);
+        return;
+    }
 
-        // TODO (Change 1): Redirect STDOUT to output/<executable>.<input> file
+    // Track the child with its own deadline to determine if it is stuck
+    reaper_add(reaper, slot, pid, plan->output_fd, status_fd, TIMEOUT_MS);
+}
 
-        int len_output_path = strlen("output/") + strlen(executable_name) + strlen(input) + 2;  // +2 for the null terminator and the dot
-        char *output_path = malloc(len_output_path);
-        if (output_path == NULL) {
-            fprintf(stderr, "Error occured at line %d: malloc failed\n", __LINE__ - 2);
-            exit(EXIT_FAILURE);
+
+// One pair of executable exe_idx is done with. Its fork server is no longer needed once the last one is in.
+void finish_pair(int exe_idx) {
+    pairs_left[exe_idx]--;
+    if (pairs_left[exe_idx] == 0 && servers[exe_idx] != NULL) {
+        stop_forkserver(servers[exe_idx]);
+        servers[exe_idx] = NULL;
+    }
+}
+
+
+// Wait for any running child to finish (or time out) and check its result. Returns the freed slot,
+// or -1 if a watched change came in first.
+int monitor_and_evaluate_solutions() {
+    // Children that run past their deadline are killed while we wait
+    int status;
+    int slot = reaper_wait(reaper, &status);
+    if (slot == -1) {
+        return -1;
+    }
+    work_item_t *item = &work_queue[slot_item[slot]];
+    autograder_results_t *result = &results[item->exe_idx];
+    char *param = params[item->param_idx];
+    int param_idx = item->param_idx;
+
+    long elapsed_ms = get_time_ms() - slot_start[slot];
+    concurrency_record(concurrency, reaper_cpu_usec(reaper, slot), elapsed_ms);
+
+    // The executable changed or went away while the pair ran, so its verdict is of no use
+    if (item->generation != exe_generation[item->exe_idx]) {
+        if (sandbox != NULL) {
+            long cpu_usec, memory_peak;
+            sandbox_release(sandbox, slot, &cpu_usec, &memory_peak);
         }
-        snprintf(output_path, len_output_path, "output/%s.%s", executable_name, input);
+        finish_pair(item->exe_idx);
+        child_status[slot] = -1;
+        return slot;
+    }
 
-        int fd;
-        if ((fd = open(output_path, O_CREAT | O_WRONLY | O_TRUNC, 0644)) == -1) {
-            free(output_path);
-            fprintf(stderr, "Error occured at line %d: open failed\n", __LINE__ - 2);
-            exit(EXIT_FAILURE);
+    // Record how long the pair took so the next run can schedule it better
+    history_record(history, history_idx[item->exe_idx], elapsed_ms);
+
+    // TODO: Determine if the child process finished normally, segfaulted, or timed out
+    // A child the watchdog classified early was killed, so its wait status alone would read as a timeout
+    int final_status = reaper_verdict(reaper, slot);
+    if (final_status == 0) {
+        final_status = get_verdict(status, reaper_output(reaper, slot));
+    }
+
+    // TODO: Also, update the results struct with the status of the child process
+    result->status[param_idx] = final_status;
+    if (exe_digested[item->exe_idx]) {
+        verdict_cache_store(verdict_cache, result->exe_path, &exe_digest[item->exe_idx], BUILD_INPUT_MODE,
+                            TIMEOUT_MS, WATCHDOG_CPU_BUDGET_MS, param, final_status);
+    }
+
+    // NOTE: The status comes from what the child wrote to its stdout (captured by the reaper),
+    //       NOT the exit status like in Project 1.
+
+    // Kill whatever the child left behind in its cgroup and record what the pair used
+    if (sandbox != NULL) {
+        sandbox_release(sandbox, slot, &result->cpu_usec[param_idx], &result->memory_peak[param_idx]);
+    }
+
+    finish_pair(item->exe_idx);
+
+    // Mark the slot as idle so the next pair can be launched into it
+    child_status[slot] = -1;
+
+    return slot;
+}
+
+
+// Order work items by expected runtime (longest first), keeping the parameter-major order for ties.
+// Fork servers break ties executable-major instead, so each server is only alive for a short stretch.
+int compare_work_items(const void *a, const void *b) {
+    const work_item_t *item_a = a;
+    const work_item_t *item_b = b;
+    if (item_a->expected_ms != item_b->expected_ms) {
+        return item_a->expected_ms < item_b->expected_ms ? 1 : -1;
+    }
+    if (use_forkserver && item_a->exe_idx != item_b->exe_idx) {
+        return item_a->exe_idx - item_b->exe_idx;
+    }
+    if (item_a->param_idx != item_b->param_idx) {
+        return item_a->param_idx - item_b->param_idx;
+    }
+    return item_a->exe_idx - item_b->exe_idx;
+}
+
+
+// Make room in the per-executable arrays for count executables
+void reserve_executables(int count) {
+    if (count <= exe_capacity) {
+        return;
+    }
+    int capacity = exe_capacity > 0 ? exe_capacity : 16;
+    while (capacity < count) {
+        capacity *= 2;
+    }
+    exe_digest = realloc(exe_digest, capacity * sizeof(content_digest_t));
+    exe_digested = realloc(exe_digested, capacity * sizeof(int));
+    exe_live = realloc(exe_live, capacity * sizeof(int));
+    exe_generation = realloc(exe_generation, capacity * sizeof(int));
+    exe_stat = realloc(exe_stat, capacity * sizeof(struct stat));
+    history_idx = realloc(history_idx, capacity * sizeof(int));
+    servers = realloc(servers, capacity * sizeof(forkserver_t *));
+    server_failed = realloc(server_failed, capacity * sizeof(int));
+    pairs_left = realloc(pairs_left, capacity * sizeof(int));
+    if (exe_digest == NULL || exe_digested == NULL || exe_live == NULL || exe_generation == NULL || exe_stat == NULL ||
+        history_idx == NULL || servers == NULL || server_failed == NULL || pairs_left == NULL) {
+        fprintf(stderr, "Error occured at line %d: realloc failed\n", __LINE__ - 2);
+        exit(EXIT_FAILURE);
+    }
+    exe_capacity = capacity;
+}
+
+
+// Start the bookkeeping of a new row i
+void init_executable(int i) {
+    exe_digested[i] = 0;
+    exe_live[i] = 1;
+    exe_generation[i] = 0;
+    servers[i] = NULL;
+    server_failed[i] = 0;
+    pairs_left[i] = 0;
+}
+
+
+// Digest executable i and remember what its file looked like. Returns 1 if the contents are new
+// (or cannot be read), 0 if they are the ones digested last time.
+int digest_submission(int i) {
+    content_digest_t previous = exe_digest[i];
+    int had_digest = exe_digested[i];
+    if (stat(results[i].exe_path, &exe_stat[i]) == -1) {
+        memset(&exe_stat[i], 0, sizeof(struct stat));
+    }
+    exe_digested[i] = digest_executable(results[i].exe_path, &exe_digest[i]) == 0;
+    if (!exe_digested[i]) {
+        return 1;
+    }
+    verdict_cache_retain(verdict_cache, results[i].exe_path, &exe_digest[i]);
+    return !had_digest || memcmp(&previous, &exe_digest[i], sizeof(content_digest_t)) != 0;
+}
+
+
+// Fill in the pairs of executable i whose verdict is cached. Their status is then non-zero, which
+// keeps them out of the work queue. Returns the number of pairs filled in.
+int apply_verdict_cache(int i) {
+    // usage.txt needs every pair measured, so sandbox runs only refresh the cache
+    if (!exe_digested[i] || !use_cache || sandbox != NULL) {
+        return 0;
+    }
+    int hits = 0;
+    for (int j = 0; j < total_params; j++) {
+        int status = verdict_cache_lookup(verdict_cache, results[i].exe_path, &exe_digest[i],
+                                          BUILD_INPUT_MODE, TIMEOUT_MS, WATCHDOG_CPU_BUDGET_MS, params[j]);
+        if (status != 0) {
+            results[i].status[j] = status;
+            hits++;
         }
-        if (dup2(fd, STDOUT_FILENO) == -1) {
-            fprintf(stderr, "Error occured at line %d: dup2 failed\n", __LINE__ - 1);
-            exit(EXIT_FAILURE);
+    }
+    return hits;
+}
+
+
+// Append the pairs of executable i that still have to be graded to the work queue. The caller
+// sorts the queue afterwards.
+void queue_executable(int i) {
+    // Nothing queued is still referenced once the queue has drained, so start it over
+    if (queue_head == num_pairs && running == 0) {
+        queue_head = 0;
+        num_pairs = 0;
+    }
+    if (num_pairs + total_params > queue_capacity) {
+        int capacity = queue_capacity > 0 ? queue_capacity : total_params;
+        while (capacity < num_pairs + total_params) {
+            capacity *= 2;
         }
-        if (close(fd) == -1) {
-            fprintf(stderr, "Error occured at line %d: close failed\n", __LINE__ - 1);
+        work_queue = realloc(work_queue, capacity * sizeof(work_item_t));
+        if (work_queue == NULL) {
+            fprintf(stderr, "Error occured at line %d: realloc failed\n", __LINE__ - 2);
             exit(EXIT_FAILURE);
         }
-        free(output_path);
+        queue_capacity = capacity;
+    }
 
-        // TODO (Change 2): Handle different cases for input source
-        #ifdef EXEC
+    long expected_ms = history_expected_ms(history, results[i].exe_path, fallback_ms);
+    for (int j = 0; j < total_params; j++) {
+        if (results[i].status[j] != 0) {
+            continue;
+        }
+        work_item_t *item = &work_queue[num_pairs++];
+        item->exe_idx = i;
+        item->param_idx = j;
+        item->expected_ms = expected_ms;
+        item->generation = exe_generation[i];
+        pairs_left[i]++;
+    }
+}
 
-            execl(executable_path, executable_name, input, NULL);
-            
-        #elif REDIR
 
-            // TODO: Redirect STDIN to input/<input>.in file
-            int len_input_path = strlen("input/") + strlen(input) + strlen(".in") + 1;  // +1 for the null terminator
-            char *input_path = malloc(len_input_path);    // +1 for the null terminator
-            if (input_path == NULL) {
-                fprintf(stderr, "Error occured at line %d: malloc failed\n", __LINE__ - 2);
-                exit(EXIT_FAILURE);
-            }
-            snprintf(input_path, len_input_path, "input/%s.in", input);
+// Order the pairs not launched yet
+void sort_work_queue() {
+    if (num_pairs > queue_head) {
+        qsort(work_queue + queue_head, num_pairs - queue_head, sizeof(work_item_t), compare_work_items);
+    }
+}
 
-            int child_fd = open(input_path, O_RDONLY);
-            free(input_path);
-            if (child_fd == -1) {
-                fprintf(stderr, "Error occured at line %d: open failed", __LINE__ - 3);
-                exit(EXIT_FAILURE);
-            }
-            if (dup2(child_fd, STDIN_FILENO) == -1) {
-                fprintf(stderr, "Error occured at line %d: dup2 failed\n", __LINE__ - 1);
-                exit(EXIT_FAILURE);
-            }
-            if (close(child_fd) == -1) {
-                fprintf(stderr, "Error occured at line %d: close failed\n", __LINE__ - 1);
-                exit(EXIT_FAILURE);
-            }
-            execl(executable_path, executable_name, NULL);
 
-        #elif PIPE
+// Flatten every (executable, parameter) pair that still has to be graded into work_queue, longest
+// expected job first
+void build_work_queue() {
+    history_reserve(history, num_executables);
 
-            // TODO: Pass read end of pipe to child process
-            if (close(pipefd[1]) == -1) {
-                fprintf(stderr, "Error occured at line %d: close failed", __LINE__ - 1);
-                exit(EXIT_FAILURE);
-            }
-            if (dup2(pipefd[0], STDIN_FILENO) == -1) {
-                fprintf(stderr, "Error occured at line %d: dup2 failed", __LINE__ - 1);
-                exit(EXIT_FAILURE);
-            }
-            char string_of_pipefd[MAX_INT_CHARS + 1];
-            snprintf(string_of_pipefd, sizeof(string_of_pipefd), "%d", pipefd[0]);
-            execl(executable_path, executable_name, string_of_pipefd, NULL);
-        #endif
-
-        // If exec fails
-        perror("Failed to execute program");
-        exit(1);
-    } else if (pid > 0) {  // Parent process
-        #ifdef PIPE
-            // TODO: Send input to child process via pipe
-            if (close(pipefd[0]) == -1) {
-                fprintf(stderr, "Error occured at line %d: close failed", __LINE__ - 1);
-                exit(EXIT_FAILURE);
-            }
-            if (write(pipefd[1], input, strlen(input)) == -1) {
-                fprintf(stderr, "Error occured at line %d: write failed", __LINE__ - 1);
-                exit(EXIT_FAILURE);
-            }
-            if (close(pipefd[1]) == -1) {
-                fprintf(stderr, "Error occured at line %d: close failed", __LINE__ - 1);
-                exit(EXIT_FAILURE);
-            }
-        #endif
+    // Executables that have never been run are assumed to take the mean of the known ones
+    long known_total = 0;
+    int known = 0;
+    for (int i = 0; i < num_executables; i++) {
+        history_idx[i] = history_lookup(history, results[i].exe_path);
+        if (history->entries[history_idx[i]].runs > 0) {
+            known_total += history->entries[history_idx[i]].avg_ms;
+            known++;
+        }
+    }
+    fallback_ms = known > 0 ? known_total / known : 0;
 
-        pids[batch_idx] = pid;
-    } else {  // Fork failed
-        perror("Failed to fork");
-        exit(1);
+    for (int i = 0; i < num_executables; i++) {
+        queue_executable(i);
     }
+    sort_work_queue();
 }
 
 
-// Wait for the batch to finish and check results
-void monitor_and_evaluate_solutions(int tested, char *param, int param_idx) {
-    // Keep track of finished processes for alarm handler
-    child_status = malloc(curr_batch_size * sizeof(int));
-    if (child_status == NULL) {
-        fprintf(stderr, "Error occured at line %d: malloc failed\n", __LINE__ - 2);
+void print_usage(char *program) {
+    printf("Usage: %s [--forkserver] [--cgroup <dir>] [--binary <file> [--no-text]] [--no-cache] [--watch] [--recursive] <testdir> <p1> <p2> ... <pn>\n", program);
+    printf("       %s export <binary results file> [<results.txt>]\n", program);
+    printf("       %s query <results.txt> <executable>\n", program);
+}
+
+
+// "autograder export <file> [<output>]": write a binary results file out as results.txt
+int export_command(int argc, char *argv[]) {
+    if (argc < 3 || argc > 4) {
+        print_usage(argv[0]);
+        return 1;
+    }
+    results_file_t *file = open_results_file(argv[2]);
+    if (file == NULL) {
+        return 1;
+    }
+    int failed = export_results_text(file, argc == 4 ? argv[3] : "results.txt");
+    close_results_file(file);
+    return failed == -1 ? 1 : 0;
+}
+
+
+// "autograder query <results.txt> <executable>": print one executable's row and score, read through
+// the results file's index rather than the whole file
+int query_command(int argc, char *argv[]) {
+    if (argc != 4) {
+        print_usage(argv[0]);
+        return 1;
+    }
+    // Accept a path to the executable as well as its name (which has a '/' for --recursive results)
+    char *exe_name = argv[3];
+    char *row = find_results_row(argv[2], exe_name);
+    if (row == NULL && strrchr(argv[3], '/') != NULL) {
+        exe_name = get_exe_name(argv[3]);
+        row = find_results_row(argv[2], exe_name);
+    }
+    if (row == NULL) {
+        fprintf(stderr, "%s: no results for %s\n", argv[2], exe_name);
+        return 1;
+    }
+    printf("%s\n", row);
+    printf("%s: %5.3f\n", exe_name, get_score(row));
+    free(row);
+    return 0;
+}
+
+
+// Watch a directory visited by a scan, remembering its path so event names can be made into paths.
+// Watches are per inode, so adding one again only updates the path (it may have been renamed).
+void watch_directory(const char *dir_path) {
+    // IN_CREATE is only of interest for new subdirectories, which have to be scanned (and watched)
+    uint32_t mask = IN_CLOSE_WRITE | IN_MOVED_TO | IN_ATTRIB | IN_DELETE | IN_MOVED_FROM | (recursive ? IN_CREATE : 0);
+    int wd = inotify_add_watch(watch_fd, dir_path, mask);
+    if (wd == -1) {
+        if (errno != ENOENT) {
+            perror("inotify_add_watch");
+            exit(EXIT_FAILURE);
+        }
+        return;
+    }
+
+    if (wd >= watch_dirs_capacity) {
+        int capacity = watch_dirs_capacity > 0 ? watch_dirs_capacity : 16;
+        while (capacity <= wd) {
+            capacity *= 2;
+        }
+        watch_dirs = realloc(watch_dirs, capacity * sizeof(char *));
+        if (watch_dirs == NULL) {
+            fprintf(stderr, "Error occured at line %d: realloc failed\n", __LINE__ - 2);
+            exit(EXIT_FAILURE);
+        }
+        memset(watch_dirs + watch_dirs_capacity, 0, (capacity - watch_dirs_capacity) * sizeof(char *));
+        watch_dirs_capacity = capacity;
+    }
+    free(watch_dirs[wd]);
+    watch_dirs[wd] = strdup(dir_path);
+    if (watch_dirs[wd] == NULL) {
+        fprintf(stderr, "Error occured at line %d: strdup failed\n", __LINE__ - 2);
         exit(EXIT_FAILURE);
     }
-    for (int j = 0; j < curr_batch_size; j++) {
-        child_status[j] = 1;
+}
+
+
+// Add a malloc'd path to changed_paths, which takes ownership of it
+void add_changed_path(char *path) {
+    if (num_changed == changed_capacity) {
+        changed_capacity = changed_capacity > 0 ? changed_capacity * 2 : 16;
+        changed_paths = realloc(changed_paths, changed_capacity * sizeof(char *));
+        if (changed_paths == NULL) {
+            fprintf(stderr, "Error occured at line %d: realloc failed\n", __LINE__ - 2);
+            exit(EXIT_FAILURE);
+        }
     }
+    changed_paths[num_changed++] = path;
+}
 
-    // MAIN EVALUATION LOOP: Wait until each process has finished or timed out
-    for (int j = 0; j < curr_batch_size; j++) {
-        int status;
-        errno = 0;
-        // TODO: What if waitpid is interrupted by a signal?
-        pid_t pid;
-        do {
-            pid = waitpid(pids[j], &status, 0);
-            if (pid == -1 && errno != EINTR) {
-                perror("waitpid");
-                exit(EXIT_FAILURE);
-            }
-        } while (pid == -1 && errno == EINTR);
-
-        // TODO: Determine if the child process finished normally, segfaulted, or timed out
-        int exited = WIFEXITED(status);
-        int signaled = WIFSIGNALED(status);
-        int final_status;
-        if (signaled) {
-            if (WTERMSIG(status) == SIGSEGV) {
-                final_status = SEGFAULT;
-            } else {
-                final_status = STUCK_OR_INFINITE;
-            }
-        } else if (exited) {
-            char *executable_name = get_exe_name(results[tested - curr_batch_size + j].exe_path);
-            int length_output_path = strlen("output/") + strlen(executable_name) + strlen(param) + 2;  // +2 for the null terminator and the dot
-            char *output_path = malloc(length_output_path);    // +2 for the null terminator and the dot
-            if (output_path == NULL) {
-                fprintf(stderr, "Error occured at line %d: malloc failed\n", __LINE__ - 2);
-                exit(EXIT_FAILURE);
-            }
-            snprintf(output_path, length_output_path, "output/%s.%s", executable_name, param);
 
-            int fd;
-            if ((fd = open(output_path, O_RDONLY)) == -1) {
-                free(output_path);
-                fprintf(stderr, "Error occured at line %d: open failed\n", __LINE__ - 3);
-                exit(EXIT_FAILURE);
-            }
-            free(output_path);
+// Collect the pending inotify events and restart the settle timer if any of them matters. Once the
+// timer has fired without another change, the changes are settled.
+void read_watch_events() {
+    char buffer[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    int changed = 0;
+    ssize_t len;
+    while ((len = read(watch_fd, buffer, sizeof(buffer))) > 0) {
+        for (char *ptr = buffer; ptr < buffer + len; ) {
+            const struct inotify_event *event = (const struct inotify_event *) ptr;
+            ptr += sizeof(struct inotify_event) + event->len;
 
-            int bytes_read;
-            char output[MAX_INT_CHARS + 1];  // +1 for the null terminator
-            if ((bytes_read = read(fd, output, MAX_INT_CHARS)) == -1) {
-                perror("Read Failed");
-                exit(EXIT_FAILURE);
+            // A queue overflow may have hidden anything, so the whole tree is scanned again
+            if (event->mask & IN_Q_OVERFLOW) {
+                rescan_needed = 1;
+                changed = 1;
+                continue;
             }
-            if (close(fd) == -1) {
-                perror("close failed");
-                exit(EXIT_FAILURE);
+            // Hidden files are never graded
+            if (event->len == 0 || event->name[0] == '.' || event->wd >= watch_dirs_capacity || watch_dirs[event->wd] == NULL) {
+                continue;
             }
-            output[bytes_read] = '\0';
-            if (atoi(output) == 0) {
-                final_status = CORRECT;
-            } else if (atoi(output) == 1) {
-                final_status = INCORRECT;
-            } else {
-                perror("Invalid output");
-                exit(EXIT_FAILURE);
+            if (event->mask & IN_ISDIR) {
+                // What a subdirectory that came or went holds is only known from a scan
+                if (recursive) {
+                    rescan_needed = 1;
+                    changed = 1;
+                }
+            } else if (!(event->mask & IN_CREATE)) {
+                int path_len = strlen(watch_dirs[event->wd]) + strlen(event->name) + 2;
+                char *path = malloc(path_len);
+                if (path == NULL) {
+                    fprintf(stderr, "Error occured at line %d: malloc failed\n", __LINE__ - 2);
+                    exit(EXIT_FAILURE);
+                }
+                snprintf(path, path_len, "%s/%s", watch_dirs[event->wd], event->name);
+                add_changed_path(path);
+                changed = 1;
             }
         }
+    }
+    if (len == -1 && errno != EAGAIN && errno != EINTR) {
+        perror("read");
+        exit(EXIT_FAILURE);
+    }
+
+    // Setting the timer again also discards an expiry that has not been read yet
+    uint64_t expirations;
+    int expired = read(settle_fd, &expirations, sizeof(expirations)) == sizeof(expirations);
+    if (changed) {
+        struct itimerspec settle = { { 0, 0 }, { WATCH_SETTLE_MS / 1000, (WATCH_SETTLE_MS % 1000) * 1000000L } };
+        if (timerfd_settime(settle_fd, 0, &settle, NULL) == -1) {
+            perror("timerfd_settime");
+            exit(EXIT_FAILURE);
+        }
+    } else if (expired) {
+        changes_settled = 1;
+    }
+}
 
-        // TODO: Also, update the results struct with the status of the child process
-        results[tested - curr_batch_size + j].status[param_idx] = final_status;
 
-        // NOTE: Make sure you are using the output/<executable>.<input> file to determine the status
-        //       of the child process, NOT the exit status like in Project 1.
+// Stop handing executable i's pairs to its fork server. The pairs it is still running are dropped
+// as they finish, and the server is stopped once nothing is running (see run_work_queue()).
+void retire_server(int i) {
+    server_failed[i] = 0;
+    if (servers[i] == NULL) {
+        return;
+    }
+    if (num_retired == retired_capacity) {
+        retired_capacity = retired_capacity > 0 ? retired_capacity * 2 : 4;
+        retired_servers = realloc(retired_servers, retired_capacity * sizeof(forkserver_t *));
+        if (retired_servers == NULL) {
+            fprintf(stderr, "Error occured at line %d: realloc failed\n", __LINE__ - 2);
+            exit(EXIT_FAILURE);
+        }
+    }
+    retired_servers[num_retired++] = servers[i];
+    servers[i] = NULL;
+}
 
-        // Adding tested parameter to results struct
-        results[tested - curr_batch_size + j].params_tested[param_idx] = atoi(param);
 
-        // Mark the process as finished
-        child_status[j] = -1;
+// Clear executable i's row and queue all of its pairs again: its contents changed. Returns the
+// number of pairs the verdict cache answered.
+int regrade_executable(int i) {
+    exe_generation[i]++;
+    retire_server(i);
+    memset(results[i].status, 0, total_params);
+    int hits = apply_verdict_cache(i);
+    queue_executable(i);
+    return hits;
+}
+
+
+// Executable i went away: its queued and running pairs are dropped and its row left out of the reports
+void remove_executable(int i) {
+    exe_live[i] = 0;
+    exe_generation[i]++;
+    retire_server(i);
+}
+
+
+// Append rows for new executables. The results arena is built again with the old rows copied over
+// in place, so every index stays valid.
+void add_executables(char **paths, int count) {
+    int old_count = num_executables;
+    char **all_paths = malloc((old_count + count) * sizeof(char *));
+    if (all_paths == NULL) {
+        fprintf(stderr, "Error occured at line %d: malloc failed\n", __LINE__ - 2);
+        exit(EXIT_FAILURE);
     }
+    for (int i = 0; i < old_count; i++) {
+        all_paths[i] = results[i].exe_path;
+    }
+    memcpy(all_paths + old_count, paths, count * sizeof(char *));
 
-    free(child_status);
+    autograder_results_t *grown = create_results(all_paths, old_count + count, params, total_params, sandbox != NULL);
+    for (int i = 0; i < old_count; i++) {
+        memcpy(grown[i].status, results[i].status, total_params);
+        if (sandbox != NULL) {
+            memcpy(grown[i].cpu_usec, results[i].cpu_usec, total_params * sizeof(long));
+            memcpy(grown[i].memory_peak, results[i].memory_peak, total_params * sizeof(long));
+        }
+    }
+    free_results(results);
+    free(all_paths);
+    results = grown;
+    num_executables = old_count + count;
+
+    reserve_executables(num_executables);
+    for (int i = old_count; i < num_executables; i++) {
+        init_executable(i);
+    }
+
+    // Growing the history table invalidates the indices into it
+    history_reserve(history, count);
+    for (int i = 0; i < num_executables; i++) {
+        history_idx[i] = history_lookup(history, results[i].exe_path);
+    }
 }
 
 
+int compare_paths(const void *a, const void *b) {
+    return strcmp(*(char * const *) a, *(char * const *) b);
+}
 
-int main(int argc, char *argv[]) {
-    if (argc < 3) {
-        printf("Usage: %s <testdir> <p1> <p2> ... <pn>\n", argv[0]);
+
+int compare_rows_by_path(const void *a, const void *b) {
+    return strcmp(results[*(const int *) a].exe_path, results[*(const int *) b].exe_path);
+}
+
+
+// Row of path, looked up in rows (every row index, sorted by path). -1 if it has none.
+int find_executable(const int *rows, const char *path) {
+    int low = 0;
+    int high = num_executables - 1;
+    while (low <= high) {
+        int mid = low + (high - low) / 2;
+        int cmp = strcmp(results[rows[mid]].exe_path, path);
+        if (cmp == 0) {
+            return rows[mid];
+        }
+        if (cmp < 0) {
+            low = mid + 1;
+        } else {
+            high = mid - 1;
+        }
+    }
+    return -1;
+}
+
+
+// Whether executable i's file is no longer the one digest_submission() last looked at
+int file_changed(int i) {
+    struct stat st;
+    if (stat(results[i].exe_path, &st) == -1) {
         return 1;
     }
+    struct stat *last = &exe_stat[i];
+    return st.st_dev != last->st_dev || st.st_ino != last->st_ino || st.st_size != last->st_size
+        || st.st_mtim.tv_sec != last->st_mtim.tv_sec || st.st_mtim.tv_nsec != last->st_mtim.tv_nsec
+        || st.st_ctim.tv_sec != last->st_ctim.tv_sec || st.st_ctim.tv_nsec != last->st_ctim.tv_nsec;
+}
 
-    char *testdir = argv[1];
-    total_params = argc - 2;
 
-    // TODO (Change 0): Implement get_batch_size() function
-    int batch_size = get_batch_size();
+// Feed the settled changes into the work queue. New submissions get a row, changed ones have their
+// row cleared and queued again, and removed ones drop out of the reports. Only these rows are
+// digested and graded; every other row keeps its verdicts.
+void apply_changes() {
+    changes_settled = 0;
 
-    char **executable_paths = get_student_executables(testdir, &num_executables);
+    // A rescan offers every submission it finds, and whatever it does not find is gone
+    int rescanned = rescan_needed;
+    if (rescan_needed) {
+        rescan_needed = 0;
+        int num_found;
+        char **found = scan_executables(testdir, recursive, watch_directory, &num_found);
+        for (int k = 0; k < num_found; k++) {
+            add_changed_path(found[k]);
+        }
+        free(found);
+    }
+    if (num_changed > 0) {
+        qsort(changed_paths, num_changed, sizeof(char *), compare_paths);
+    }
 
-    // Construct summary struct
-    results = malloc(num_executables * sizeof(autograder_results_t));
-    if (results == NULL) {
+    int *rows = malloc(num_executables * sizeof(int));
+    int *seen = calloc(num_executables, sizeof(int));
+    if ((rows == NULL || seen == NULL) && num_executables > 0) {
+        fprintf(stderr, "Error occured at line %d: malloc failed\n", __LINE__ - 3);
+        exit(EXIT_FAILURE);
+    }
+    char **added = malloc(num_changed * sizeof(char *));
+    if (added == NULL && num_changed > 0) {
         fprintf(stderr, "Error occured at line %d: malloc failed\n", __LINE__ - 2);
         exit(EXIT_FAILURE);
     }
     for (int i = 0; i < num_executables; i++) {
-        results[i].exe_path = executable_paths[i];
-        results[i].params_tested = malloc((total_params) * sizeof(int));
-        if (results[i].params_tested == NULL) {
-            fprintf(stderr, "Error occured at line %d: malloc failed\n", __LINE__ - 2);
-            exit(EXIT_FAILURE);
+        rows[i] = i;
+    }
+    qsort(rows, num_executables, sizeof(int), compare_rows_by_path);
+
+    int num_added = 0;        // paths without a row yet
+    int num_returned = 0;     // removed rows whose executable is back
+    int num_regraded = 0;
+    int num_removed = 0;
+    int hits = 0;
+    for (int k = 0; k < num_changed; k++) {
+        char *path = changed_paths[k];
+        if (k > 0 && strcmp(path, changed_paths[k - 1]) == 0) {
+            continue;
         }
-        results[i].status = malloc((total_params) * sizeof(int));
-        if (results[i].status == NULL) {
-            fprintf(stderr, "Error occured at line %d: malloc failed\n", __LINE__ - 2);
-            exit(EXIT_FAILURE);
+        int i = find_executable(rows, path);
+        if (i != -1) {
+            seen[i] = 1;
+        }
+
+        if (!is_submission(path)) {
+            if (i != -1 && exe_live[i]) {
+                remove_executable(i);
+                num_removed++;
+            }
+        } else if (i == -1) {
+            added[num_added++] = path;
+        } else if (!exe_live[i]) {
+            // Back after being removed: its verdicts still hold if the contents are the same,
+            // but the pairs dropped on removal have to run
+            exe_live[i] = 1;
+            if (digest_submission(i)) {
+                hits += regrade_executable(i);
+            } else {
+                queue_executable(i);
+            }
+            num_returned++;
+        } else if (file_changed(i) && digest_submission(i)) {
+            hits += regrade_executable(i);
+            num_regraded++;
+        }
+    }
+    if (rescanned) {
+        for (int i = 0; i < num_executables; i++) {
+            if (exe_live[i] && !seen[i]) {
+                remove_executable(i);
+                num_removed++;
+            }
         }
     }
 
-    #ifdef REDIR
-        // TODO: Create the input/<input>.in files and write the parameters to them
-        create_input_files(argv + 2, total_params);  // Implement this function (src/utils.c)
-    #endif
+    if (num_added > 0) {
+        int first = num_executables;
+        add_executables(added, num_added);
+        for (int i = first; i < num_executables; i++) {
+            digest_submission(i);
+            hits += apply_verdict_cache(i);
+            queue_executable(i);
+        }
+    }
+    sort_work_queue();
 
-    // MAIN LOOP: For each parameter, run all executables in batch size chunks
-    for (int i = 2; i < argc; i++) {
-        int remaining = num_executables;
-        int tested = 0;
-
-        // Test the parameter on each executable
-        while (remaining > 0) {
-            // Determine current batch size - min(remaining, batch_size)
-            curr_batch_size = remaining < batch_size ? remaining : batch_size;
-            pids = malloc(curr_batch_size * sizeof(pid_t));
-            if (pids == NULL) {
-                fprintf(stderr, "Error occured at line %d: malloc failed\n", __LINE__ - 2);
-                exit(EXIT_FAILURE);
-            }
+    int num_new = num_added + num_returned;
+    if (num_new + num_regraded + num_removed > 0) {
+        printf("%d new, %d changed, %d removed\n", num_new, num_regraded, num_removed);
+        reports_stale = 1;
+    }
+    if (hits > 0) {
+        printf("%d of %d pairs taken from %s\n", hits, (num_new + num_regraded) * total_params, VERDICT_CACHE_FILE);
+    }
 
-            // TODO: Execute the programs in batch size chunks
-            for (int j = 0; j < curr_batch_size; j++) {
-                execute_solution(executable_paths[tested], argv[i], j);
-                tested++;
-            }
+    for (int k = 0; k < num_changed; k++) {
+        free(changed_paths[k]);
+    }
+    num_changed = 0;
+    free(rows);
+    free(seen);
+    free(added);
+}
 
-            // TODO (Change 3): Setup timer to determine if child process is stuck
-            start_timer(TIMEOUT_SECS, timeout_handler);  // Implement this function (src/utils.c)
 
-            // TODO: Wait for the batch to finish and check results
-            monitor_and_evaluate_solutions(tested, argv[i], i - 2);
+// Drop the queued pairs of executables that changed or went away since they were queued
+void skip_stale_pairs() {
+    while (queue_head < num_pairs && work_queue[queue_head].generation != exe_generation[work_queue[queue_head].exe_idx]) {
+        finish_pair(work_queue[queue_head].exe_idx);
+        queue_head++;
+    }
+}
+
 
-            // TODO: Cancel the timer if all child processes have finished
-            if (child_status == NULL) {
-                cancel_timer();  // Implement this function (src/utils.c)
+// MAIN LOOP: Keep as many pairs running as the controller allows until the whole work queue has been
+// tested. Watched changes that settle meanwhile are fed into the queue as they come.
+void run_work_queue() {
+    while (queue_head < num_pairs || running > 0) {
+        // Launch the next pairs into idle slots, up to the current limit
+        concurrency_update(concurrency);
+        for (int j = 0; j < batch_size && running < concurrency_limit(concurrency); j++) {
+            if (child_status[j] != -1) {
+                continue;
+            }
+            skip_stale_pairs();
+            if (queue_head == num_pairs) {
+                break;
             }
+            work_item_t *item = &work_queue[queue_head];
+            slot_item[j] = queue_head;
+            execute_solution(results[item->exe_idx].exe_path, item->exe_idx, item->param_idx, j);
+            queue_head++;
+            running++;
+        }
+        if (running == 0) {
+            continue;
+        }
 
-            // TODO Unlink all output files in current batch (output/<executable>.<input>)
-            remove_output_files(results, tested, curr_batch_size, argv[i]);  // Implement this function (src/utils.c)
+        // Wait for the next child to finish and check its result
+        if (monitor_and_evaluate_solutions() == -1) {
+            read_watch_events();
+            if (changes_settled) {
+                apply_changes();
+            }
+            continue;
+        }
+        running--;
+    }
 
+    // Nothing forked from a retired server is running any more
+    for (int i = 0; i < num_retired; i++) {
+        stop_forkserver(retired_servers[i]);
+    }
+    num_retired = 0;
+}
 
-            // Adjust the remaining count after the batch has finished
-            remaining -= curr_batch_size;
 
-            free(pids);
+// Write results.txt (or the binary results file), usage.txt and scores.txt for every executable
+// that is still there, and save the runtime history and the verdict cache
+void write_reports() {
+    autograder_results_t *live = malloc(num_executables * sizeof(autograder_results_t));
+    if (live == NULL && num_executables > 0) {
+        fprintf(stderr, "Error occured at line %d: malloc failed\n", __LINE__ - 2);
+        exit(EXIT_FAILURE);
+    }
+    int num_live = 0;
+    for (int i = 0; i < num_executables; i++) {
+        if (exe_live[i]) {
+            live[num_live++] = results[i];
         }
     }
 
-    #ifdef REDIR
-        // TODO: Unlink all input files for REDIR case (<input>.in)
-        remove_input_files(argv + 2, total_params);  // Implement this function (src/utils.c)
-    #endif
+    sort_results(live, num_live);
+    if (binary_path != NULL) {
+        if (write_results_binary(live, num_live, total_params, binary_path) == -1) {
+            exit(EXIT_FAILURE);
+        }
 
-    write_results_to_file(results, num_executables, total_params);
+        // results.txt is an export of what was just written
+        if (write_text) {
+            results_file_t *file = open_results_file(binary_path);
+            if (file == NULL || export_results_text(file, "results.txt") == -1) {
+                exit(EXIT_FAILURE);
+            }
+            close_results_file(file);
+        }
+    } else {
+        write_results_to_file(live, num_live, total_params);
+    }
+    if (sandbox != NULL) {
+        write_usage_to_file(live, num_live, total_params, "usage.txt");
+    }
 
     // You can use this to debug your scores function
     // get_score("results.txt", results[0].exe_path);
 
     // Print each score to scores.txt
-    write_scores_to_file(results, num_executables, "results.txt");
+    write_scores_to_file(live, num_live, total_params, "scores.txt");
 
-    // Free the results struct and its fields
-    for (int i = 0; i < num_executables; i++) {
-        free(results[i].exe_path);
-        free(results[i].params_tested);
-        free(results[i].status);
+    save_runtime_history(history);
+    save_verdict_cache(verdict_cache);
+    free(live);
+    reports_stale = 0;
+}
+
+
+// Grade every (executable, parameter) pair in testdir that the verdict cache cannot answer, then write
+// results.txt, scores.txt and the other reports for all of them. In watch mode everything is kept
+// for the changes that follow (see watch_submissions()).
+void grade_submissions() {
+    char **executable_paths = scan_executables(testdir, recursive, watch ? watch_directory : NULL, &num_executables);
+
+    // Enough slots for the controller to oversubscribe every usable CPU
+    int max_slots = get_effective_cpus() * CONCURRENCY_MAX_PER_CPU;
+
+    // Set up before the verdict cache is consulted: a sandbox in use has every pair measured, but
+    // one that could not be created (no cgroup v2 after all) leaves the cache to do its job
+    if (cgroup_root != NULL) {
+        sandbox = create_sandbox(cgroup_root, max_slots);
     }
 
-    free(results);
+    // Construct summary struct - one arena, which also takes its own copy of the paths
+    results = create_results(executable_paths, num_executables, params, total_params, sandbox != NULL);
+    for (int i = 0; i < num_executables; i++) {
+        free(executable_paths[i]);
+    }
     free(executable_paths);
 
+    // Fill in the pairs whose verdict is cached
+    reserve_executables(num_executables);
+    int hits = 0;
+    for (int i = 0; i < num_executables; i++) {
+        init_executable(i);
+        digest_submission(i);
+        hits += apply_verdict_cache(i);
+    }
+    if (hits > 0) {
+        printf("%d of %d pairs taken from %s\n", hits, num_executables * total_params, VERDICT_CACHE_FILE);
+    }
+
+    // Every pair of every parameter goes through one queue, so no parameter ends with a barrier
+    history = load_runtime_history(HISTORY_FILE);
+    build_work_queue();
+
+    // No more slots than there are pairs, unless more can arrive while watching
+    batch_size = max_slots;
+    if (batch_size > num_pairs && !watch) {
+        batch_size = num_pairs;
+    }
+    if (batch_size < 1) {
+        batch_size = 1;
+    }
+
+    // Pool slots - a new pair is launched as soon as any running child is reaped
+    child_status = malloc(batch_size * sizeof(int));
+    slot_item = malloc(batch_size * sizeof(int));
+    slot_start = malloc(batch_size * sizeof(long));
+    slot_plan = malloc(batch_size * sizeof(spawn_plan_t));
+    if (child_status == NULL || slot_item == NULL || slot_start == NULL || slot_plan == NULL) {
+        fprintf(stderr, "Error occured at line %d: malloc failed\n", __LINE__ - 1);
+        exit(EXIT_FAILURE);
+    }
+    for (int j = 0; j < batch_size; j++) {
+        child_status[j] = -1;
+    }
+    reaper = create_reaper(batch_size);
+    concurrency = create_concurrency(batch_size);
+    if (watch) {
+        // Changes are picked up while waiting for children too
+        reaper_wake_on(reaper, watch_fd);
+        reaper_wake_on(reaper, settle_fd);
+    }
+
+    if (sandbox != NULL && use_forkserver) {
+        // Forked children would share their server's cgroup, so each pair is spawned into its own instead
+        fprintf(stderr, "--forkserver is ignored in --cgroup mode\n");
+        use_forkserver = 0;
+    }
+
+    run_work_queue();
+    write_reports();
+    if (watch) {
+        return;
+    }
+
+    free_reaper(reaper);
+    free_concurrency(concurrency);
+    if (sandbox != NULL) {
+        free_sandbox(sandbox);
+    }
+    free(servers);
+    free(server_failed);
+    free(pairs_left);
+    free(retired_servers);
+    free_runtime_history(history);
+    free(history_idx);
+    free(work_queue);
+    free(exe_digest);
+    free(exe_digested);
+    free(exe_live);
+    free(exe_generation);
+    free(exe_stat);
+
+    free(child_status);
+    free(slot_item);
+    free(slot_start);
+    free(slot_plan);
+
+    // The results struct and all of its fields are one allocation
+    free_results(results);
+}
+
+
+// --watch: after the first pass, feed every batch of changes to testdir into the work queue once it
+// has settled, and rewrite the reports whenever the queue has drained
+void watch_submissions() {
+    printf("Watching %s for new submissions\n", testdir);
+    fflush(stdout);
+
+    for (;;) {
+        // Let a burst of copies land before grading anything
+        while (!changes_settled) {
+            struct pollfd pfds[2] = { { watch_fd, POLLIN, 0 }, { settle_fd, POLLIN, 0 } };
+            if (poll(pfds, 2, -1) == -1 && errno != EINTR) {
+                perror("poll");
+                exit(EXIT_FAILURE);
+            }
+            read_watch_events();
+        }
+
+        apply_changes();
+        run_work_queue();
+        if (reports_stale) {
+            write_reports();
+        }
+        fflush(stdout);
+    }
+}
+
+
+int main(int argc, char *argv[]) {
+    if (argc > 1 && strcmp(argv[1], "export") == 0) {
+        return export_command(argc, argv);
+    }
+    if (argc > 1 && strcmp(argv[1], "query") == 0) {
+        return query_command(argc, argv);
+    }
+
+    static struct option long_options[] = {
+        {"forkserver", no_argument, NULL, 'f'},
+        {"cgroup", required_argument, NULL, 'c'},
+        {"binary", required_argument, NULL, 'b'},
+        {"no-text", no_argument, NULL, 'n'},
+        {"no-cache", no_argument, NULL, 'C'},
+        {"watch", no_argument, NULL, 'w'},
+        {"recursive", no_argument, NULL, 'r'},
+        {NULL, 0, NULL, 0}
+    };
+    int opt;
+    // "+": stop at the first non-option, so negative parameters are not taken for options
+    while ((opt = getopt_long(argc, argv, "+fc:b:", long_options, NULL)) != -1) {
+        switch (opt) {
+            case 'f':
+                use_forkserver = 1;
+                break;
+            case 'c':
+                cgroup_root = optarg;
+                break;
+            case 'b':
+                binary_path = optarg;
+                break;
+            case 'n':
+                write_text = 0;
+                break;
+            case 'C':
+                use_cache = 0;
+                break;
+            case 'w':
+                watch = 1;
+                break;
+            case 'r':
+                recursive = 1;
+                break;
+            default:
+                print_usage(argv[0]);
+                return 1;
+        }
+    }
+    if (argc - optind < 2 || (!write_text && binary_path == NULL)) {
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    testdir = argv[optind];
+    total_params = argc - optind - 1;
+    params = argv + optind + 1;
+
+    #ifdef REDIR
+        // TODO: Write each parameter once into a sealed memfd that every child reads its stdin from
+        input_fds = create_input_memfds(params, total_params);
+    #endif
+
+    verdict_cache = load_verdict_cache(VERDICT_CACHE_FILE);
+    if (watch) {
+        // Watching starts before the first scan, so nothing that lands during the first pass is missed
+        watch_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (watch_fd == -1) {
+            perror("inotify_init1");
+            exit(EXIT_FAILURE);
+        }
+        settle_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        if (settle_fd == -1) {
+            perror("timerfd_create");
+            exit(EXIT_FAILURE);
+        }
+    }
+    grade_submissions();
+    if (watch) {
+        // What changes from now on is looked up in the verdict cache like in a new run
+        use_cache = 1;
+        watch_submissions();
+    }
+
+    free_verdict_cache(verdict_cache);
+
+    #ifdef REDIR
+        // TODO: Close the input memfds for REDIR case
+        close_input_memfds(input_fds, total_params);
+    #endif
+
     return 0;
 }
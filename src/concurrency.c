@@ -0,0 +1,212 @@
+#define _GNU_SOURCE  // For sched_getaffinity() and CPU_COUNT()
+#include "utils.h"
+#include "concurrency.h"
+
+#include <sched.h>
+
+
+// Read the first line of path into buffer. Returns -1 if the file cannot be read.
+static int read_line(const char *path, char *buffer, int size) {
+    FILE *file = fopen(path, "r");
+    if (file == NULL) {
+        return -1;
+    }
+    char *line = fgets(buffer, size, file);
+    fclose(file);
+    return line == NULL ? -1 : 0;
+}
+
+
+// CPUs allowed by one cgroup directory's quota, or INT_MAX if it sets none
+static int cgroup_quota_cpus(const char *dir, int v2) {
+    char path[PATH_MAX];
+    char buffer[128];
+    long quota;
+    long period;
+
+    if (v2) {
+        snprintf(path, sizeof(path), "%s/cpu.max", dir);
+        if (read_line(path, buffer, sizeof(buffer)) == -1 || strncmp(buffer, "max", 3) == 0 ||
+            sscanf(buffer, "%ld %ld", &quota, &period) != 2) {
+            return INT_MAX;
+        }
+    } else {
+        snprintf(path, sizeof(path), "%s/cpu.cfs_quota_us", dir);
+        if (read_line(path, buffer, sizeof(buffer)) == -1 || (quota = atol(buffer)) <= 0) {
+            return INT_MAX;
+        }
+        snprintf(path, sizeof(path), "%s/cpu.cfs_period_us", dir);
+        if (read_line(path, buffer, sizeof(buffer)) == -1) {
+            return INT_MAX;
+        }
+        period = atol(buffer);
+    }
+    if (quota <= 0 || period <= 0) {
+        return INT_MAX;
+    }
+
+    // A fractional quota still allows one child to run
+    int cpus = (quota + period - 1) / period;
+    return cpus > 0 ? cpus : 1;
+}
+
+
+// Smallest quota on the path from our cgroup up to the root of the hierarchy mounted at mount
+static int hierarchy_quota_cpus(const char *mount, const char *cgroup_path, int v2) {
+    char dir[PATH_MAX];
+    snprintf(dir, sizeof(dir), "%s%s", mount, cgroup_path);
+    int len = strlen(dir);
+    while (len > 0 && dir[len - 1] == '/') {
+        dir[--len] = '\0';
+    }
+
+    int cpus = INT_MAX;
+    while (1) {
+        int quota_cpus = cgroup_quota_cpus(dir, v2);
+        if (quota_cpus < cpus) {
+            cpus = quota_cpus;
+        }
+        char *slash = strrchr(dir, '/');
+        if (slash == NULL || (int) (slash - dir) < (int) strlen(mount)) {
+            break;
+        }
+        *slash = '\0';
+    }
+    return cpus;
+}
+
+
+int get_effective_cpus() {
+    int cpus = 0;
+    cpu_set_t set;
+    if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+        cpus = CPU_COUNT(&set);
+    }
+    if (cpus <= 0) {
+        long online = sysconf(_SC_NPROCESSORS_ONLN);
+        cpus = online > 0 ? online : 1;
+    }
+
+    // Lines of /proc/self/cgroup are "<id>:<controllers>:<path>"; "0::<path>" is the v2 hierarchy
+    FILE *file = fopen("/proc/self/cgroup", "r");
+    if (file == NULL) {
+        return cpus;
+    }
+    char line[PATH_MAX + 64];
+    while (fgets(line, sizeof(line), file) != NULL) {
+        line[strcspn(line, "\n")] = '\0';
+        char *controllers = strchr(line, ':');
+        char *path = controllers != NULL ? strchr(controllers + 1, ':') : NULL;
+        if (path == NULL) {
+            continue;
+        }
+        *path++ = '\0';
+        controllers++;
+
+        int quota_cpus = INT_MAX;
+        if (controllers[0] == '\0') {
+            quota_cpus = hierarchy_quota_cpus("/sys/fs/cgroup", path, 1);
+        } else if (strstr(controllers, "cpu") != NULL && strstr(controllers, "cpuset") != controllers) {
+            char mount[PATH_MAX];
+            snprintf(mount, sizeof(mount), "/sys/fs/cgroup/%s", controllers);
+            quota_cpus = hierarchy_quota_cpus(mount, path, 0);
+        }
+        if (quota_cpus < cpus) {
+            cpus = quota_cpus;
+        }
+    }
+    fclose(file);
+
+    return cpus;
+}
+
+
+// "some ... total=<us>" from a /proc/pressure file, -1 if PSI is not available
+static long read_stall_us(const char *path) {
+    char buffer[256];
+    if (read_line(path, buffer, sizeof(buffer)) == -1) {
+        return -1;
+    }
+    char *total = strstr(buffer, "total=");
+    return total != NULL ? atol(total + strlen("total=")) : -1;
+}
+
+
+concurrency_t *create_concurrency(int max_children) {
+    concurrency_t *concurrency = malloc(sizeof(concurrency_t));
+    if (concurrency == NULL) {
+        fprintf(stderr, "Error occured at line %d: malloc failed\n", __LINE__ - 2);
+        exit(EXIT_FAILURE);
+    }
+    concurrency->effective_cpus = get_effective_cpus();
+    concurrency->min_limit = 1;
+    concurrency->max_limit = max_children > 0 ? max_children : 1;
+    concurrency->limit = concurrency->effective_cpus;
+    if (concurrency->limit > concurrency->max_limit) {
+        concurrency->limit = concurrency->max_limit;
+    }
+
+    // Until children have been seen, assume they are CPU-bound
+    concurrency->utilisation = 1.0;
+    concurrency->last_update_ms = get_time_ms();
+    concurrency->cpu_stall_us = read_stall_us("/proc/pressure/cpu");
+    concurrency->memory_stall_us = read_stall_us("/proc/pressure/memory");
+    return concurrency;
+}
+
+
+int concurrency_limit(concurrency_t *concurrency) {
+    return concurrency->limit;
+}
+
+
+void concurrency_record(concurrency_t *concurrency, long cpu_usec, long wall_ms) {
+    if (cpu_usec < 0 || wall_ms <= 0) {
+        return;
+    }
+    double utilisation = cpu_usec / (wall_ms * 1000.0);
+    if (utilisation > 1.0) {
+        utilisation = 1.0;
+    }
+    concurrency->utilisation += (utilisation - concurrency->utilisation) / CONCURRENCY_UTIL_WEIGHT;
+}
+
+
+void concurrency_update(concurrency_t *concurrency) {
+    long now = get_time_ms();
+    long elapsed_ms = now - concurrency->last_update_ms;
+    if (elapsed_ms < CONCURRENCY_INTERVAL_MS) {
+        return;
+    }
+
+    long cpu_stall_us = read_stall_us("/proc/pressure/cpu");
+    long memory_stall_us = read_stall_us("/proc/pressure/memory");
+    double cpu_pressure = 0;
+    double memory_pressure = 0;
+    if (cpu_stall_us >= 0 && concurrency->cpu_stall_us >= 0) {
+        cpu_pressure = (cpu_stall_us - concurrency->cpu_stall_us) / (elapsed_ms * 1000.0);
+    }
+    if (memory_stall_us >= 0 && concurrency->memory_stall_us >= 0) {
+        memory_pressure = (memory_stall_us - concurrency->memory_stall_us) / (elapsed_ms * 1000.0);
+    }
+    concurrency->cpu_stall_us = cpu_stall_us;
+    concurrency->memory_stall_us = memory_stall_us;
+    concurrency->last_update_ms = now;
+
+    if (cpu_pressure > CONCURRENCY_CPU_PRESSURE || memory_pressure > CONCURRENCY_MEMORY_PRESSURE) {
+        // Multiplicative decrease: running children keep going, fewer new ones are started
+        concurrency->limit /= 2;
+        if (concurrency->limit < concurrency->min_limit) {
+            concurrency->limit = concurrency->min_limit;
+        }
+    } else if (concurrency->limit < concurrency->max_limit &&
+               (concurrency->limit + 1) * concurrency->utilisation <= concurrency->effective_cpus) {
+        // Additive increase while one more child of the kind seen so far still fits on the CPUs
+        concurrency->limit++;
+    }
+}
+
+
+void free_concurrency(concurrency_t *concurrency) {
+    free(concurrency);
+}
@@ -0,0 +1,437 @@
+#include "utils.h"
+#include "launcher.h"
+#include "verdict_cache.h"
+#include "netproto.h"
+
+#include <getopt.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+
+// A pair an agent has not reported back by then is given to another agent (it may have hung)
+#define COORDINATOR_LEASE_MS (2 * TIMEOUT_MS + 10000)
+#define COORDINATOR_TICK_MS 1000       // how often leases are checked
+#define COORDINATOR_MAX_ASSIGN 64      // most pairs handed out per request
+#define COORDINATOR_MAX_AGENTS 1024
+
+// State of one (executable, parameter) pair; pair id = exe_idx * total_params + param_idx
+enum { PAIR_PENDING, PAIR_ASSIGNED, PAIR_DONE };
+
+typedef struct {
+    uint8_t state;
+    int agent;                // agent holding the pair while PAIR_ASSIGNED
+    long lease_ms;            // when the pair is taken back from that agent
+} dist_pair_t;
+
+// A connected agent
+typedef struct {
+    int fd;                   // -1 for unused entries
+    int waiting;              // 1 if it is idle and its request is held until there is work again
+    int free_slots;           // slots it asked to fill with the held request
+} agent_conn_t;
+
+// Executable i's content digest, sorted by digest for NET_FETCH lookups
+typedef struct {
+    content_digest_t digest;
+    int exe_idx;
+} exe_digest_t;
+
+// Stores the results of the coordinator (see utils.h for details)
+autograder_results_t *results;
+int num_executables;
+int total_params;
+input_mode_t input_mode = BUILD_INPUT_MODE;
+
+content_digest_t *exe_digest;
+exe_digest_t *digest_index;
+
+dist_pair_t *pairs;
+int num_pairs;
+int num_done;
+
+// Pairs waiting for an agent. A pair is pushed when it starts out and whenever it is taken back.
+int *pending;
+int num_pending;
+
+agent_conn_t agents[COORDINATOR_MAX_AGENTS];
+int epoll_fd;
+
+
+int compare_exe_digests(const void *a, const void *b) {
+    const exe_digest_t *digest_a = a;
+    const exe_digest_t *digest_b = b;
+    return memcmp(&digest_a->digest, &digest_b->digest, sizeof(content_digest_t));
+}
+
+
+// Return a pair some agent held to the pending stack
+void take_back(int pair_id) {
+    pairs[pair_id].state = PAIR_PENDING;
+    pairs[pair_id].agent = -1;
+    pending[num_pending++] = pair_id;
+}
+
+
+// Whether a pair is waiting for an agent. Pairs that were reported late by the agent they were taken
+// back from are dropped from the top of the stack on the way.
+int has_pending() {
+    while (num_pending > 0 && pairs[pending[num_pending - 1]].state != PAIR_PENDING) {
+        num_pending--;
+    }
+    return num_pending > 0;
+}
+
+
+// Forget a dead or misbehaving agent and hand its pairs to the others
+void drop_agent(int agent) {
+    int requeued = 0;
+    for (int i = 0; i < num_pairs; i++) {
+        if (pairs[i].state == PAIR_ASSIGNED && pairs[i].agent == agent) {
+            take_back(i);
+            requeued++;
+        }
+    }
+    close(agents[agent].fd);   // Also removes it from the epoll set
+    agents[agent].fd = -1;
+    agents[agent].waiting = 0;
+    printf("Agent %d disconnected, %d pairs requeued\n", agent, requeued);
+}
+
+
+// Send a message whose payload is the u32 value (or that has no payload, for value < 0)
+int send_u32(int agent, uint32_t type, int value) {
+    char buffer[4];
+    struct iovec iov = { buffer, sizeof(buffer) };
+    net_put_u32(buffer, value);
+    return net_send(agents[agent].fd, type, &iov, value < 0 ? 0 : 1);
+}
+
+
+// Hand up to max_pairs pending pairs to agent in one NET_ASSIGN. Returns the number sent, -1 on failure.
+int assign_pairs(int agent, int max_pairs) {
+    if (max_pairs > COORDINATOR_MAX_ASSIGN) {
+        max_pairs = COORDINATOR_MAX_ASSIGN;
+    }
+    char *buffer = malloc(4 + (size_t) max_pairs * NET_PAIR_SIZE(NAME_MAX));
+    if (buffer == NULL) {
+        fprintf(stderr, "Error occured at line %d: malloc failed\n", __LINE__ - 2);
+        exit(EXIT_FAILURE);
+    }
+
+    int count = 0;
+    size_t length = 4;
+    long now = get_time_ms();
+    while (count < max_pairs && num_pending > 0) {
+        int pair_id = pending[--num_pending];
+        if (pairs[pair_id].state != PAIR_PENDING) {
+            continue;   // Reported late by the agent it was taken back from
+        }
+        int exe_idx = pair_id / total_params;
+        net_pair_t pair;
+        pair.pair_id = pair_id;
+        pair.param = results[exe_idx].params_tested[pair_id % total_params];
+        pair.digest = exe_digest[exe_idx];
+        snprintf(pair.name, sizeof(pair.name), "%s", get_exe_name(results[exe_idx].exe_path));
+        length += net_put_pair(buffer + length, &pair);
+
+        pairs[pair_id].state = PAIR_ASSIGNED;
+        pairs[pair_id].agent = agent;
+        pairs[pair_id].lease_ms = now + COORDINATOR_LEASE_MS;
+        count++;
+    }
+    net_put_u32(buffer, count);
+
+    struct iovec iov = { buffer, length };
+    int failed = net_send(agents[agent].fd, NET_ASSIGN, &iov, 1);
+    free(buffer);
+    return failed == -1 ? -1 : count;
+}
+
+
+// Send the binary with digest to agent
+int send_binary(int agent, const content_digest_t *digest) {
+    exe_digest_t key = { *digest, 0 };
+    exe_digest_t *found = bsearch(&key, digest_index, num_executables, sizeof(exe_digest_t), compare_exe_digests);
+    if (found == NULL) {
+        return -1;
+    }
+
+    int fd = open(results[found->exe_idx].exe_path, O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (fd == -1 || fstat(fd, &st) == -1) {
+        perror("Failed to open executable");
+        if (fd != -1) {
+            close(fd);
+        }
+        return -1;
+    }
+    void *data = st.st_size > 0 ? mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0) : NULL;
+    close(fd);
+    if (data == MAP_FAILED) {
+        perror("mmap");
+        return -1;
+    }
+
+    struct iovec iov[2] = { { (void *) digest->bytes, SHA256_DIGEST_SIZE }, { data, st.st_size } };
+    int failed = net_send(agents[agent].fd, NET_BINARY, iov, 2);
+    if (data != NULL) {
+        munmap(data, st.st_size);
+    }
+    return failed;
+}
+
+
+// Handle one message from agent. Returns -1 if the agent has to be dropped.
+int handle_message(int agent) {
+    uint32_t type, length;
+    char *payload;
+    if (net_recv(agents[agent].fd, &type, &payload, &length) == -1) {
+        return -1;
+    }
+    const char *cursor = payload;
+    const char *end = payload + length;
+    int failed = 0;
+
+    switch (type) {
+        case NET_HELLO: {
+            uint32_t version;
+            if (net_get_u32(&cursor, end, &version) == -1 || version != NET_PROTOCOL_VERSION) {
+                fprintf(stderr, "Agent %d speaks another protocol version\n", agent);
+                failed = 1;
+                break;
+            }
+            failed = send_u32(agent, NET_WELCOME, input_mode) == -1;
+            break;
+        }
+        case NET_REQUEST: {
+            uint32_t free_slots, idle;
+            if (net_get_u32(&cursor, end, &free_slots) == -1 || net_get_u32(&cursor, end, &idle) == -1) {
+                failed = 1;
+                break;
+            }
+            if (num_done == num_pairs) {
+                failed = send_u32(agent, NET_BYE, -1) == -1;
+            } else if (!has_pending() && idle) {
+                // Nothing to do right now, but an agent that dies may leave pairs behind
+                agents[agent].waiting = 1;
+                agents[agent].free_slots = free_slots;
+            } else {
+                failed = assign_pairs(agent, free_slots) == -1;
+            }
+            break;
+        }
+        case NET_FETCH: {
+            content_digest_t digest;
+            failed = net_get_digest(&cursor, end, &digest) == -1 || send_binary(agent, &digest) == -1;
+            break;
+        }
+        case NET_VERDICT: {
+            uint32_t pair_id, status;
+            if (net_get_u32(&cursor, end, &pair_id) == -1 || net_get_u32(&cursor, end, &status) == -1
+                    || pair_id >= (uint32_t) num_pairs || status < CORRECT || status > INFINITE_LOOP) {
+                failed = 1;
+                break;
+            }
+            // The first verdict of a pair counts, even one that arrives after its lease ran out
+            if (pairs[pair_id].state != PAIR_DONE) {
+                pairs[pair_id].state = PAIR_DONE;
+                results[pair_id / total_params].status[pair_id % total_params] = status;
+                num_done++;
+            }
+            break;
+        }
+        default:
+            failed = 1;
+    }
+    free(payload);
+    return failed ? -1 : 0;
+}
+
+
+// Give pending pairs to the agents whose requests are held
+void serve_waiting_agents() {
+    for (int i = 0; i < COORDINATOR_MAX_AGENTS && has_pending(); i++) {
+        if (agents[i].fd != -1 && agents[i].waiting) {
+            int sent = assign_pairs(i, agents[i].free_slots);
+            if (sent == -1) {
+                drop_agent(i);
+            } else if (sent > 0) {
+                agents[i].waiting = 0;
+            }
+        }
+    }
+}
+
+
+// Take back the pairs whose lease ran out
+void expire_leases() {
+    long now = get_time_ms();
+    for (int i = 0; i < num_pairs; i++) {
+        if (pairs[i].state == PAIR_ASSIGNED && pairs[i].lease_ms <= now) {
+            printf("Pair %d not reported back by agent %d in time, requeued\n", i, pairs[i].agent);
+            take_back(i);
+        }
+    }
+}
+
+
+void accept_agent(int listen_fd) {
+    int fd = net_accept(listen_fd);
+    if (fd == -1) {
+        perror("accept");
+        return;
+    }
+    int agent = 0;
+    while (agent < COORDINATOR_MAX_AGENTS && agents[agent].fd != -1) {
+        agent++;
+    }
+    if (agent == COORDINATOR_MAX_AGENTS) {
+        fprintf(stderr, "Too many agents\n");
+        close(fd);
+        return;
+    }
+    struct epoll_event event = { .events = EPOLLIN, .data.u32 = agent };
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event) == -1) {
+        perror("epoll_ctl");
+        close(fd);
+        return;
+    }
+    agents[agent].fd = fd;
+    agents[agent].waiting = 0;
+    printf("Agent %d connected\n", agent);
+}
+
+
+void print_usage(char *program) {
+    printf("Usage: %s [--mode exec|redir|pipe] <port> <testdir> <p1> <p2> ... <pn>\n", program);
+}
+
+
+int main(int argc, char *argv[]) {
+    static struct option long_options[] = {
+        {"mode", required_argument, NULL, 'm'},
+        {NULL, 0, NULL, 0}
+    };
+    int opt;
+    // "+": stop at the first non-option, so negative parameters are not taken for options
+    while ((opt = getopt_long(argc, argv, "+m:", long_options, NULL)) != -1) {
+        if (opt == 'm' && strcmp(optarg, "exec") == 0) {
+            input_mode = INPUT_EXEC;
+        } else if (opt == 'm' && strcmp(optarg, "redir") == 0) {
+            input_mode = INPUT_REDIR;
+        } else if (opt == 'm' && strcmp(optarg, "pipe") == 0) {
+            input_mode = INPUT_PIPE;
+        } else {
+            print_usage(argv[0]);
+            return 1;
+        }
+    }
+    if (argc - optind < 3) {
+        print_usage(argv[0]);
+        return 1;
+    }
+    char *port = argv[optind];
+    char *testdir = argv[optind + 1];
+    char **params = argv + optind + 2;
+    total_params = argc - optind - 2;
+
+    char **executable_paths = get_student_executables(testdir, &num_executables);
+    results = create_results(executable_paths, num_executables, params, total_params, 0);
+    for (int i = 0; i < num_executables; i++) {
+        free(executable_paths[i]);
+    }
+    free(executable_paths);
+
+    // Agents fetch binaries by content digest, so each one is shipped to an agent at most once
+    exe_digest = malloc(num_executables * sizeof(content_digest_t));
+    digest_index = malloc(num_executables * sizeof(exe_digest_t));
+    num_pairs = num_executables * total_params;
+    pairs = malloc(num_pairs * sizeof(dist_pair_t));
+    pending = malloc(num_pairs * sizeof(int));
+    if ((exe_digest == NULL || digest_index == NULL || pairs == NULL || pending == NULL) && num_pairs > 0) {
+        fprintf(stderr, "Error occured at line %d: malloc failed\n", __LINE__ - 4);
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < num_executables; i++) {
+        if (digest_executable(results[i].exe_path, &exe_digest[i]) == -1) {
+            perror(results[i].exe_path);
+            exit(EXIT_FAILURE);
+        }
+        digest_index[i].digest = exe_digest[i];
+        digest_index[i].exe_idx = i;
+    }
+    qsort(digest_index, num_executables, sizeof(exe_digest_t), compare_exe_digests);
+
+    // Parameter-major order, like the other autograders (the stack is popped from the end)
+    num_pending = 0;
+    for (int j = total_params - 1; j >= 0; j--) {
+        for (int i = num_executables - 1; i >= 0; i--) {
+            pending[num_pending++] = i * total_params + j;
+        }
+    }
+    for (int i = 0; i < num_pairs; i++) {
+        pairs[i].state = PAIR_PENDING;
+        pairs[i].agent = -1;
+    }
+    num_done = 0;
+
+    for (int i = 0; i < COORDINATOR_MAX_AGENTS; i++) {
+        agents[i].fd = -1;
+    }
+    int listen_fd = net_listen(port);
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    struct epoll_event event = { .events = EPOLLIN, .data.u32 = COORDINATOR_MAX_AGENTS };
+    if (epoll_fd == -1 || epoll_ctl(epoll_fd, EPOLL_CTL_ADD, listen_fd, &event) == -1) {
+        perror("epoll");
+        exit(EXIT_FAILURE);
+    }
+    printf("Coordinating %d pairs on port %s\n", num_pairs, port);
+    fflush(stdout);
+
+    long next_tick = get_time_ms() + COORDINATOR_TICK_MS;
+    while (num_done < num_pairs) {
+        struct epoll_event events[64];
+        long timeout = next_tick - get_time_ms();
+        int ready = epoll_wait(epoll_fd, events, 64, timeout > 0 ? timeout : 0);
+        if (ready == -1 && errno != EINTR) {
+            perror("epoll_wait");
+            exit(EXIT_FAILURE);
+        }
+        for (int i = 0; i < ready; i++) {
+            int agent = events[i].data.u32;
+            if (agent == COORDINATOR_MAX_AGENTS) {
+                accept_agent(listen_fd);
+            } else if (agents[agent].fd != -1 && handle_message(agent) == -1) {
+                drop_agent(agent);
+            }
+        }
+        if (get_time_ms() >= next_tick) {
+            expire_leases();
+            next_tick = get_time_ms() + COORDINATOR_TICK_MS;
+        }
+        serve_waiting_agents();
+        fflush(stdout);
+    }
+
+    // Every pair is in: release the agents
+    for (int i = 0; i < COORDINATOR_MAX_AGENTS; i++) {
+        if (agents[i].fd != -1) {
+            send_u32(i, NET_BYE, -1);
+            close(agents[i].fd);
+        }
+    }
+    close(epoll_fd);
+    close(listen_fd);
+
+    sort_results(results, num_executables);
+    write_results_to_file(results, num_executables, total_params);
+
+    // Print each score to scores.txt
+    write_scores_to_file(results, num_executables, total_params, "scores.txt");
+
+    free(pairs);
+    free(pending);
+    free(exe_digest);
+    free(digest_index);
+    free_results(results);
+    return 0;
+}
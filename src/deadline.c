@@ -0,0 +1,146 @@
+#include "utils.h"
+#include "deadline.h"
+
+#include <sys/timerfd.h>
+
+static void swap_entries(deadline_heap_t *deadlines, int a, int b) {
+    deadline_entry_t temp = deadlines->heap[a];
+    deadlines->heap[a] = deadlines->heap[b];
+    deadlines->heap[b] = temp;
+    deadlines->pos[deadlines->heap[a].slot] = a;
+    deadlines->pos[deadlines->heap[b].slot] = b;
+}
+
+
+static void sift_up(deadline_heap_t *deadlines, int idx) {
+    while (idx > 0) {
+        int parent = (idx - 1) / 2;
+        if (deadlines->heap[parent].deadline_ms <= deadlines->heap[idx].deadline_ms) {
+            break;
+        }
+        swap_entries(deadlines, parent, idx);
+        idx = parent;
+    }
+}
+
+
+static void sift_down(deadline_heap_t *deadlines, int idx) {
+    while (1) {
+        int smallest = idx;
+        int left = 2 * idx + 1;
+        int right = left + 1;
+        if (left < deadlines->size && deadlines->heap[left].deadline_ms < deadlines->heap[smallest].deadline_ms) {
+            smallest = left;
+        }
+        if (right < deadlines->size && deadlines->heap[right].deadline_ms < deadlines->heap[smallest].deadline_ms) {
+            smallest = right;
+        }
+        if (smallest == idx) {
+            break;
+        }
+        swap_entries(deadlines, idx, smallest);
+        idx = smallest;
+    }
+}
+
+
+deadline_heap_t *create_deadline_heap(int num_slots) {
+    deadline_heap_t *deadlines = malloc(sizeof(deadline_heap_t));
+    if (deadlines == NULL) {
+        fprintf(stderr, "Error occured at line %d: malloc failed\n", __LINE__ - 2);
+        exit(EXIT_FAILURE);
+    }
+    deadlines->heap = malloc(num_slots * sizeof(deadline_entry_t));
+    deadlines->pos = malloc(num_slots * sizeof(int));
+    if (deadlines->heap == NULL || deadlines->pos == NULL) {
+        fprintf(stderr, "Error occured at line %d: malloc failed\n", __LINE__ - 2);
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < num_slots; i++) {
+        deadlines->pos[i] = -1;
+    }
+    deadlines->size = 0;
+    deadlines->num_slots = num_slots;
+
+    deadlines->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+    if (deadlines->timer_fd == -1) {
+        perror("timerfd_create");
+        exit(EXIT_FAILURE);
+    }
+    return deadlines;
+}
+
+
+void deadline_add(deadline_heap_t *deadlines, int slot, long timeout_ms) {
+    deadline_remove(deadlines, slot);
+
+    int idx = deadlines->size++;
+    deadlines->heap[idx].deadline_ms = get_time_ms() + timeout_ms;
+    deadlines->heap[idx].slot = slot;
+    deadlines->pos[slot] = idx;
+    sift_up(deadlines, idx);
+}
+
+
+void deadline_remove(deadline_heap_t *deadlines, int slot) {
+    int idx = deadlines->pos[slot];
+    if (idx == -1) {
+        return;
+    }
+
+    // Move the last entry into the hole and restore the heap property in whichever direction
+    int last = --deadlines->size;
+    if (idx != last) {
+        swap_entries(deadlines, idx, last);
+        sift_down(deadlines, idx);
+        sift_up(deadlines, idx);
+    }
+    deadlines->pos[slot] = -1;
+}
+
+
+int deadline_pop_expired(deadline_heap_t *deadlines, long now_ms) {
+    if (deadlines->size == 0 || deadlines->heap[0].deadline_ms > now_ms) {
+        return -1;
+    }
+    int slot = deadlines->heap[0].slot;
+    deadline_remove(deadlines, slot);
+    return slot;
+}
+
+
+void deadline_arm_timer(deadline_heap_t *deadlines) {
+    struct itimerspec spec;
+    memset(&spec, 0, sizeof(spec));  // Zero it_value disarms the timer
+
+    if (deadlines->size > 0) {
+        long deadline_ms = deadlines->heap[0].deadline_ms;
+        spec.it_value.tv_sec = deadline_ms / 1000;
+        spec.it_value.tv_nsec = (deadline_ms % 1000) * 1000000;
+        if (spec.it_value.tv_sec == 0 && spec.it_value.tv_nsec == 0) {
+            spec.it_value.tv_nsec = 1;  // An absolute time of zero would disarm instead of firing
+        }
+    }
+
+    if (timerfd_settime(deadlines->timer_fd, TFD_TIMER_ABSTIME, &spec, NULL) == -1) {
+        perror("timerfd_settime");
+        exit(EXIT_FAILURE);
+    }
+}
+
+
+void deadline_drain_timer(deadline_heap_t *deadlines) {
+    unsigned long long expirations;
+    if (read(deadlines->timer_fd, &expirations, sizeof(expirations)) == -1 && errno != EAGAIN) {
+        perror("read timerfd");
+        exit(EXIT_FAILURE);
+    }
+}
+
+
+void free_deadline_heap(deadline_heap_t *deadlines) {
+    close(deadlines->timer_fd);
+    free(deadlines->heap);
+    free(deadlines->pos);
+    free(deadlines);
+}
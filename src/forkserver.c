@@ -0,0 +1,217 @@
+#define _GNU_SOURCE  // For pipe2()
+#include "utils.h"
+#include "forkserver.h"
+
+#include <poll.h>
+#include <spawn.h>
+#include <sys/socket.h>
+
+extern char **environ;
+
+
+// Build the server's environment: ours plus LD_PRELOAD and the control fd variable
+static char **build_server_env(char *preload_entry, char *fd_entry) {
+    int count = 0;
+    while (environ[count] != NULL) {
+        count++;
+    }
+
+    char **env = malloc((count + 3) * sizeof(char *));
+    if (env == NULL) {
+        fprintf(stderr, "Error occured at line %d: malloc failed\n", __LINE__ - 2);
+        exit(EXIT_FAILURE);
+    }
+    int n = 0;
+    for (int i = 0; i < count; i++) {
+        if (strncmp(environ[i], "LD_PRELOAD=", 11) != 0 && strncmp(environ[i], FORKSRV_ENV "=", strlen(FORKSRV_ENV) + 1) != 0) {
+            env[n++] = environ[i];
+        }
+    }
+    env[n++] = preload_entry;
+    env[n++] = fd_entry;
+    env[n] = NULL;
+    return env;
+}
+
+
+forkserver_t *start_forkserver(char *exe_path, const sigset_t *child_mask) {
+    char shim_path[PATH_MAX];
+    const char *shim = getenv(FORKSRV_SHIM_ENV);
+    if (realpath(shim != NULL ? shim : FORKSRV_SHIM_PATH, shim_path) == NULL) {
+        fprintf(stderr, "Fork server shim %s not found\n", shim != NULL ? shim : FORKSRV_SHIM_PATH);
+        return NULL;
+    }
+
+    int sv[2];
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sv) == -1) {
+        perror("socketpair");
+        exit(EXIT_FAILURE);
+    }
+
+    char preload_entry[PATH_MAX + 16];
+    char fd_entry[64];
+    snprintf(preload_entry, sizeof(preload_entry), "LD_PRELOAD=%s", shim_path);
+    snprintf(fd_entry, sizeof(fd_entry), "%s=%d", FORKSRV_ENV, FORKSRV_FD);
+    char **env = build_server_env(preload_entry, fd_entry);
+
+    posix_spawn_file_actions_t actions;
+    posix_spawnattr_t attr;
+    int err;
+    if ((err = posix_spawn_file_actions_init(&actions)) != 0 || (err = posix_spawnattr_init(&attr)) != 0) {
+        fprintf(stderr, "Error occured at line %d: posix_spawn init failed: %s\n", __LINE__ - 1, strerror(err));
+        exit(EXIT_FAILURE);
+    }
+    // The server's own stdout is never read: every forked child gets a pipe of its own
+    err = posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, "/dev/null", O_WRONLY, 0);
+    if (err == 0) {
+        err = posix_spawn_file_actions_adddup2(&actions, sv[1], FORKSRV_FD);
+    }
+    if (err == 0 && child_mask != NULL) {
+        err = posix_spawnattr_setsigmask(&attr, child_mask);
+        if (err == 0) {
+            err = posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGMASK);
+        }
+    }
+    if (err != 0) {
+        fprintf(stderr, "Error occured at line %d: posix_spawn setup failed: %s\n", __LINE__ - 1, strerror(err));
+        exit(EXIT_FAILURE);
+    }
+
+    char *argv[2] = { get_exe_name(exe_path), NULL };
+    pid_t pid;
+    err = posix_spawn(&pid, exe_path, &actions, &attr, argv, env);
+    posix_spawn_file_actions_destroy(&actions);
+    posix_spawnattr_destroy(&attr);
+    free(env);
+    close(sv[1]);
+    if (err != 0) {
+        // spawn_solution() will fail the same way and record the pair's verdict
+        close(sv[0]);
+        return NULL;
+    }
+
+    forkserver_t *server = malloc(sizeof(forkserver_t));
+    if (server == NULL) {
+        fprintf(stderr, "Error occured at line %d: malloc failed\n", __LINE__ - 2);
+        exit(EXIT_FAILURE);
+    }
+    server->pid = pid;
+    server->ctl_fd = sv[0];
+
+    // Wait for the shim to report that the program reached main()
+    struct pollfd pfd = { .fd = server->ctl_fd, .events = POLLIN };
+    char ready = 0;
+    int polled;
+    do {
+        polled = poll(&pfd, 1, FORKSRV_HANDSHAKE_MS);
+    } while (polled == -1 && errno == EINTR);
+    if (polled != 1 || read(server->ctl_fd, &ready, 1) != 1 || ready != FORKSRV_READY) {
+        // Statically linked, or it died or printed before main(): no server for this executable
+        kill(server->pid, SIGKILL);
+        stop_forkserver(server);
+        return NULL;
+    }
+    return server;
+}
+
+
+pid_t forkserver_spawn(forkserver_t *server, spawn_plan_t *plan, int *status_fd) {
+    int statusfd[2];
+    int outfd[2];
+    int infd = -1;
+
+    if (pipe2(statusfd, O_CLOEXEC) == -1 || pipe2(outfd, O_CLOEXEC) == -1) {
+        fprintf(stderr, "Error occured at line %d: pipe failed\n", __LINE__ - 1);
+        exit(EXIT_FAILURE);
+    }
+    if (fcntl(outfd[0], F_SETFL, O_NONBLOCK) == -1) {
+        fprintf(stderr, "Error occured at line %d: fcntl failed\n", __LINE__ - 1);
+        exit(EXIT_FAILURE);
+    }
+
+    forksrv_request_t request;
+    memset(&request, 0, sizeof(request));
+    request.argc = plan->argv[1] != NULL ? 2 : 1;
+    if (plan->argv[1] != NULL) {
+        strncpy(request.arg, plan->argv[1], FORKSRV_ARG_MAX - 1);
+    }
+
+    if (plan->mode == INPUT_REDIR) {
+        // A fresh open of the memfd, so each child reads from offset 0
+        infd = open(plan->input_path, O_RDONLY | O_CLOEXEC);
+        if (infd == -1) {
+            perror("open");
+            exit(EXIT_FAILURE);
+        }
+    } else if (plan->mode == INPUT_PIPE) {
+        int pipefd[2];
+        if (pipe2(pipefd, O_CLOEXEC) == -1) {
+            fprintf(stderr, "Error occured at line %d: pipe failed\n", __LINE__ - 1);
+            exit(EXIT_FAILURE);
+        }
+        if (write(pipefd[1], plan->param, strlen(plan->param)) == -1) {
+            fprintf(stderr, "Error occured at line %d: write failed\n", __LINE__ - 1);
+            exit(EXIT_FAILURE);
+        }
+        close(pipefd[1]);
+        infd = pipefd[0];
+    }
+
+    int fds[3] = { statusfd[1], outfd[1], infd };
+    int num_fds = infd != -1 ? 3 : 2;
+    char control[CMSG_SPACE(3 * sizeof(int))];
+    memset(control, 0, sizeof(control));
+    struct iovec iov = { .iov_base = &request, .iov_len = sizeof(request) };
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = CMSG_SPACE(num_fds * sizeof(int));
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(num_fds * sizeof(int));
+    memcpy(CMSG_DATA(cmsg), fds, num_fds * sizeof(int));
+
+    pid_t pid = -1;
+    ssize_t sent;
+    do {
+        sent = sendmsg(server->ctl_fd, &msg, MSG_NOSIGNAL);
+    } while (sent == -1 && errno == EINTR);
+    ssize_t received = -1;
+    if (sent == sizeof(request)) {
+        do {
+            received = read(server->ctl_fd, &pid, sizeof(pid));
+        } while (received == -1 && errno == EINTR);
+    }
+
+    for (int i = 0; i < num_fds; i++) {
+        close(fds[i]);
+    }
+    if (received != sizeof(pid) || pid <= 0) {
+        // The server is gone (a student's constructor or main() can exit it) or could not fork
+        close(statusfd[0]);
+        close(outfd[0]);
+        return -1;
+    }
+
+    plan->output_fd = outfd[0];
+    *status_fd = statusfd[0];
+    return pid;
+}
+
+
+void stop_forkserver(forkserver_t *server) {
+    close(server->ctl_fd);
+    // The server is our child, but a signalfd-mode reaper may already have collected it
+    pid_t pid;
+    do {
+        pid = waitpid(server->pid, NULL, 0);
+    } while (pid == -1 && errno == EINTR);
+    if (pid == -1 && errno != ECHILD) {
+        perror("waitpid");
+        exit(EXIT_FAILURE);
+    }
+    free(server);
+}
@@ -0,0 +1,214 @@
+#define _GNU_SOURCE  // For RTLD_NEXT
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <dlfcn.h>
+#include <sys/socket.h>
+#include <sys/signalfd.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+
+#include "forkserver.h"
+#include "reaper.h"
+
+// LD_PRELOAD shim turning a student executable into a fork server. It wraps __libc_start_main(),
+// so the dynamic loader, libc and the program's constructors have all run by the time the
+// server loop starts; each request then forks and calls the real main() with the requested argv.
+
+typedef int (*main_fn_t)(int, char **, char **);
+typedef int (*libc_start_main_fn_t)(main_fn_t, int, char **, void (*)(void), void (*)(void), void (*)(void), void *);
+
+static main_fn_t real_main;
+
+// A forked child and the pipe its wait status and CPU time go to
+typedef struct {
+    pid_t pid;
+    int status_fd;
+} running_child_t;
+
+static running_child_t *running;
+static int num_running;
+static int capacity_running;
+
+
+static void track_child(pid_t pid, int status_fd) {
+    if (num_running == capacity_running) {
+        capacity_running = capacity_running == 0 ? 16 : capacity_running * 2;
+        running = realloc(running, capacity_running * sizeof(running_child_t));
+        if (running == NULL) {
+            _exit(EXIT_FAILURE);
+        }
+    }
+    running[num_running].pid = pid;
+    running[num_running].status_fd = status_fd;
+    num_running++;
+}
+
+
+// Report the wait status and CPU time of every child that has exited
+static void reap_children() {
+    int status;
+    struct rusage usage;
+    pid_t pid;
+    while ((pid = wait4(-1, &status, WNOHANG, &usage)) > 0) {
+        for (int i = 0; i < num_running; i++) {
+            if (running[i].pid == pid) {
+                reaper_status_t report;
+                report.status = status;
+                report.cpu_usec = (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000000L +
+                                  usage.ru_utime.tv_usec + usage.ru_stime.tv_usec;
+                if (write(running[i].status_fd, &report, sizeof(report)) == -1) {
+                    // The autograder stopped listening; nothing left to do with the status
+                }
+                close(running[i].status_fd);
+                running[i] = running[--num_running];
+                break;
+            }
+        }
+    }
+}
+
+
+// Receive one request and its fds. Returns 0 on EOF (the autograder is done with us).
+static int receive_request(int ctl_fd, forksrv_request_t *request, int *fds, int *num_fds) {
+    char control[CMSG_SPACE(3 * sizeof(int))];
+    struct iovec iov = { .iov_base = request, .iov_len = sizeof(*request) };
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    ssize_t received;
+    do {
+        received = recvmsg(ctl_fd, &msg, MSG_CMSG_CLOEXEC);
+    } while (received == -1 && errno == EINTR);
+    if (received <= 0) {
+        return 0;
+    }
+
+    *num_fds = 0;
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    if (cmsg != NULL && cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+        *num_fds = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        memcpy(fds, CMSG_DATA(cmsg), *num_fds * sizeof(int));
+    }
+    return 1;
+}
+
+
+static int serve(int argc, char **argv, char **envp) {
+    int ctl_fd = atoi(getenv(FORKSRV_ENV));
+
+    // The forked children must not see the shim or the control socket
+    unsetenv("LD_PRELOAD");
+    unsetenv(FORKSRV_ENV);
+
+    sigset_t chld_mask;
+    sigset_t old_mask;
+    sigemptyset(&chld_mask);
+    sigaddset(&chld_mask, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &chld_mask, &old_mask);
+    int signal_fd = signalfd(-1, &chld_mask, SFD_CLOEXEC | SFD_NONBLOCK);
+    if (signal_fd == -1) {
+        _exit(EXIT_FAILURE);
+    }
+
+    char ready = FORKSRV_READY;
+    if (write(ctl_fd, &ready, 1) != 1) {
+        _exit(EXIT_FAILURE);
+    }
+
+    int accepting = 1;
+    while (accepting || num_running > 0) {
+        struct pollfd pfds[2] = {
+            { .fd = signal_fd, .events = POLLIN },
+            { .fd = ctl_fd, .events = POLLIN }
+        };
+        if (poll(pfds, accepting ? 2 : 1, -1) == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            _exit(EXIT_FAILURE);
+        }
+
+        if (pfds[0].revents & POLLIN) {
+            struct signalfd_siginfo info;
+            while (read(signal_fd, &info, sizeof(info)) == sizeof(info)) {
+                // Drained; reap_children() collects every exited child
+            }
+            reap_children();
+        }
+
+        if (accepting && (pfds[1].revents & (POLLIN | POLLHUP))) {
+            forksrv_request_t request;
+            int fds[3];
+            int num_fds;
+            if (!receive_request(ctl_fd, &request, fds, &num_fds)) {
+                accepting = 0;
+                close(ctl_fd);
+                continue;
+            }
+            if (num_fds < 2) {
+                for (int i = 0; i < num_fds; i++) {
+                    close(fds[i]);
+                }
+                pid_t failed = -1;
+                write(ctl_fd, &failed, sizeof(failed));
+                continue;
+            }
+
+            pid_t pid = fork();
+            if (pid == 0) {
+                // Child: become the student program for this request
+                close(ctl_fd);
+                close(signal_fd);
+                sigprocmask(SIG_SETMASK, &old_mask, NULL);
+                if (dup2(fds[1], STDOUT_FILENO) == -1 || (num_fds > 2 && dup2(fds[2], STDIN_FILENO) == -1)) {
+                    _exit(EXIT_FAILURE);
+                }
+                for (int i = 0; i < num_fds; i++) {
+                    close(fds[i]);
+                }
+
+                request.arg[FORKSRV_ARG_MAX - 1] = '\0';
+                char *child_argv[3] = { argv[0], request.argc > 1 ? request.arg : NULL, NULL };
+                exit(real_main(request.argc > 1 ? 2 : 1, child_argv, envp));
+            }
+
+            // Server: keep the status pipe, the child has its own copies of the rest
+            for (int i = 1; i < num_fds; i++) {
+                close(fds[i]);
+            }
+            if (pid > 0) {
+                track_child(pid, fds[0]);
+            } else {
+                close(fds[0]);
+            }
+            write(ctl_fd, &pid, sizeof(pid));
+        }
+    }
+    (void) argc;
+    _exit(EXIT_SUCCESS);
+}
+
+
+int __libc_start_main(main_fn_t main, int argc, char **argv, void (*init)(void), void (*fini)(void),
+                      void (*rtld_fini)(void), void *stack_end) {
+    libc_start_main_fn_t real_start = (libc_start_main_fn_t) dlsym(RTLD_NEXT, "__libc_start_main");
+    if (real_start == NULL) {
+        _exit(EXIT_FAILURE);
+    }
+
+    // Only act as a server when launched by the autograder's fork-server mode
+    if (getenv(FORKSRV_ENV) == NULL) {
+        return real_start(main, argc, argv, init, fini, rtld_fini, stack_end);
+    }
+    real_main = main;
+    return real_start(serve, argc, argv, init, fini, rtld_fini, stack_end);
+}
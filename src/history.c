@@ -0,0 +1,184 @@
+#include "utils.h"
+#include "history.h"
+
+#define HISTORY_INITIAL_CAPACITY 64
+#define HISTORY_EWMA_WEIGHT 4     // New samples count for 1/HISTORY_EWMA_WEIGHT of the average
+
+
+// FNV-1a hash of a string
+static unsigned long hash_path(const char *path) {
+    unsigned long hash = 1469598103934665603UL;
+    for (; *path != '\0'; path++) {
+        hash ^= (unsigned char) *path;
+        hash *= 1099511628211UL;
+    }
+    return hash;
+}
+
+
+// Find the bucket holding exe_path, or the empty bucket where it would be inserted
+static int find_bucket(runtime_history_t *history, const char *exe_path) {
+    int mask = history->capacity - 1;
+    int idx = hash_path(exe_path) & mask;
+    while (history->entries[idx].exe_path != NULL && strcmp(history->entries[idx].exe_path, exe_path) != 0) {
+        idx = (idx + 1) & mask;
+    }
+    return idx;
+}
+
+
+static void grow_table(runtime_history_t *history, int capacity) {
+    history_entry_t *old_entries = history->entries;
+    int old_capacity = history->capacity;
+
+    history->entries = calloc(capacity, sizeof(history_entry_t));
+    if (history->entries == NULL) {
+        fprintf(stderr, "Error occured at line %d: calloc failed\n", __LINE__ - 2);
+        exit(EXIT_FAILURE);
+    }
+    history->capacity = capacity;
+
+    for (int i = 0; i < old_capacity; i++) {
+        if (old_entries[i].exe_path != NULL) {
+            history->entries[find_bucket(history, old_entries[i].exe_path)] = old_entries[i];
+        }
+    }
+    free(old_entries);
+}
+
+
+void history_reserve(runtime_history_t *history, int n) {
+    // Keep the load factor at or below 1/2
+    int capacity = history->capacity;
+    while ((history->count + n) * 2 > capacity) {
+        capacity *= 2;
+    }
+    if (capacity != history->capacity) {
+        grow_table(history, capacity);
+    }
+}
+
+
+int history_lookup(runtime_history_t *history, const char *exe_path) {
+    history_reserve(history, 1);
+
+    int idx = find_bucket(history, exe_path);
+    if (history->entries[idx].exe_path == NULL) {
+        history->entries[idx].exe_path = strdup(exe_path);
+        if (history->entries[idx].exe_path == NULL) {
+            fprintf(stderr, "Error occured at line %d: strdup failed\n", __LINE__ - 2);
+            exit(EXIT_FAILURE);
+        }
+        history->entries[idx].avg_ms = 0;
+        history->entries[idx].runs = 0;
+        history->count++;
+    }
+    return idx;
+}
+
+
+long history_expected_ms(runtime_history_t *history, const char *exe_path, long fallback_ms) {
+    history_entry_t *entry = &history->entries[find_bucket(history, exe_path)];
+    if (entry->exe_path == NULL || entry->runs == 0) {
+        return fallback_ms;
+    }
+    return entry->avg_ms;
+}
+
+
+void history_record(runtime_history_t *history, int idx, long elapsed_ms) {
+    history_entry_t *entry = &history->entries[idx];
+    if (entry->runs == 0) {
+        entry->avg_ms = elapsed_ms;
+    } else {
+        entry->avg_ms += (elapsed_ms - entry->avg_ms) / HISTORY_EWMA_WEIGHT;
+    }
+    entry->runs++;
+}
+
+
+runtime_history_t *load_runtime_history(const char *path) {
+    runtime_history_t *history = malloc(sizeof(runtime_history_t));
+    if (history == NULL) {
+        fprintf(stderr, "Error occured at line %d: malloc failed\n", __LINE__ - 2);
+        exit(EXIT_FAILURE);
+    }
+    history->path = strdup(path);
+    history->entries = calloc(HISTORY_INITIAL_CAPACITY, sizeof(history_entry_t));
+    if (history->path == NULL || history->entries == NULL) {
+        fprintf(stderr, "Error occured at line %d: allocation failed\n", __LINE__ - 1);
+        exit(EXIT_FAILURE);
+    }
+    history->capacity = HISTORY_INITIAL_CAPACITY;
+    history->count = 0;
+
+    FILE *file = fopen(path, "r");
+    if (file == NULL) {
+        if (errno != ENOENT) {
+            perror("Failed to open runtime history");
+        }
+        return history;
+    }
+
+    // Each line has the format "<avg_ms> <runs> <exe_path>"
+    char *line = NULL;
+    size_t len = 0;
+    ssize_t nread;
+    while ((nread = getline(&line, &len, file)) != -1) {
+        long avg_ms;
+        int runs;
+        int offset;
+        if (nread > 0 && line[nread - 1] == '\n') {
+            line[nread - 1] = '\0';
+        }
+        if (sscanf(line, "%ld %d %n", &avg_ms, &runs, &offset) != 2 || line[offset] == '\0') {
+            continue;  // Skip malformed lines rather than throwing the whole history away
+        }
+        int idx = history_lookup(history, line + offset);
+        history->entries[idx].avg_ms = avg_ms;
+        history->entries[idx].runs = runs;
+    }
+    free(line);
+    fclose(file);
+
+    return history;
+}
+
+
+void save_runtime_history(runtime_history_t *history) {
+    int len_tmp_path = strlen(history->path) + strlen(".tmp") + 1;  // +1 for the null terminator
+    char *tmp_path = malloc(len_tmp_path);
+    if (tmp_path == NULL) {
+        fprintf(stderr, "Error occured at line %d: malloc failed\n", __LINE__ - 2);
+        exit(EXIT_FAILURE);
+    }
+    snprintf(tmp_path, len_tmp_path, "%s.tmp", history->path);
+
+    FILE *file = fopen(tmp_path, "w");
+    if (file == NULL) {
+        perror("Failed to save runtime history");
+        free(tmp_path);
+        return;
+    }
+    for (int i = 0; i < history->capacity; i++) {
+        history_entry_t *entry = &history->entries[i];
+        if (entry->exe_path != NULL && entry->runs > 0) {
+            fprintf(file, "%ld %d %s\n", entry->avg_ms, entry->runs, entry->exe_path);
+        }
+    }
+    if (fclose(file) == EOF || rename(tmp_path, history->path) == -1) {
+        perror("Failed to save runtime history");
+        unlink(tmp_path);
+    }
+    free(tmp_path);
+}
+
+
+void free_runtime_history(runtime_history_t *history) {
+    for (int i = 0; i < history->capacity; i++) {
+        free(history->entries[i].exe_path);
+    }
+    free(history->entries);
+    free(history->path);
+    free(history);
+}
@@ -0,0 +1,220 @@
+#define _GNU_SOURCE  // For pipe2()
+#include "utils.h"
+#include "launcher.h"
+
+#include <spawn.h>
+#include <sys/syscall.h>
+#include <linux/sched.h>
+
+extern char **environ;
+
+// In PIPE mode the read end of the pipe becomes the child's stdin, so that is the fd it is told to read
+static char pipe_fd_arg[] = "0";
+
+
+void init_spawn_plan(spawn_plan_t *plan, char *exe_path, char *param, input_mode_t mode, int input_fd) {
+    char *executable_name = get_exe_name(exe_path);
+
+    plan->mode = mode;
+    plan->exe_path = exe_path;
+    plan->param = param;
+
+    plan->argv[0] = executable_name;
+    switch (mode) {
+        case INPUT_EXEC:
+            plan->argv[1] = param;
+            break;
+        case INPUT_REDIR:
+            plan->argv[1] = NULL;
+            break;
+        case INPUT_PIPE:
+            plan->argv[1] = pipe_fd_arg;
+            break;
+    }
+    plan->argv[2] = NULL;
+
+    plan->output_fd = -1;
+    plan->input_path[0] = '\0';
+    if (mode == INPUT_REDIR) {
+        // Opening the memfd through /proc (rather than dup2()ing it) gives the child its own offset
+        snprintf(plan->input_path, PATH_MAX, "/proc/self/fd/%d", input_fd);
+    }
+}
+
+
+pid_t spawn_solution(spawn_plan_t *plan, const sigset_t *child_mask) {
+    posix_spawn_file_actions_t actions;
+    posix_spawnattr_t attr;
+    int pipefd[2];
+    int outfd[2];
+    int err;
+
+    if ((err = posix_spawn_file_actions_init(&actions)) != 0 || (err = posix_spawnattr_init(&attr)) != 0) {
+        fprintf(stderr, "Error occured at line %d: posix_spawn init failed: %s\n", __LINE__ - 1, strerror(err));
+        exit(EXIT_FAILURE);
+    }
+
+    // Redirect STDOUT to a pipe the parent drains. The read end is non-blocking so draining never stalls.
+    if (pipe2(outfd, O_CLOEXEC) == -1) {
+        fprintf(stderr, "Error occured at line %d: pipe failed\n", __LINE__ - 1);
+        exit(EXIT_FAILURE);
+    }
+    if (fcntl(outfd[0], F_SETFL, O_NONBLOCK) == -1) {
+        fprintf(stderr, "Error occured at line %d: fcntl failed\n", __LINE__ - 1);
+        exit(EXIT_FAILURE);
+    }
+    err = posix_spawn_file_actions_adddup2(&actions, outfd[1], STDOUT_FILENO);
+
+    if (err == 0 && plan->mode == INPUT_REDIR) {
+        // The memfd is close-on-exec, but still open while the file actions run in the child
+        err = posix_spawn_file_actions_addopen(&actions, STDIN_FILENO, plan->input_path, O_RDONLY, 0);
+    } else if (err == 0 && plan->mode == INPUT_PIPE) {
+        // Both ends are close-on-exec; dup2() onto stdin clears the flag for the read end only
+        if (pipe2(pipefd, O_CLOEXEC) == -1) {
+            fprintf(stderr, "Error occured at line %d: pipe failed\n", __LINE__ - 1);
+            exit(EXIT_FAILURE);
+        }
+
+        // Send input to child process via pipe before it exists, so the write can never hit a closed pipe
+        if (write(pipefd[1], plan->param, strlen(plan->param)) == -1) {
+            fprintf(stderr, "Error occured at line %d: write failed\n", __LINE__ - 1);
+            exit(EXIT_FAILURE);
+        }
+        if (close(pipefd[1]) == -1) {
+            fprintf(stderr, "Error occured at line %d: close failed\n", __LINE__ - 1);
+            exit(EXIT_FAILURE);
+        }
+        err = posix_spawn_file_actions_adddup2(&actions, pipefd[0], STDIN_FILENO);
+    }
+
+    if (err == 0 && child_mask != NULL) {
+        err = posix_spawnattr_setsigmask(&attr, child_mask);
+        if (err == 0) {
+            err = posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGMASK);
+        }
+    }
+    if (err != 0) {
+        fprintf(stderr, "Error occured at line %d: posix_spawn setup failed: %s\n", __LINE__ - 1, strerror(err));
+        exit(EXIT_FAILURE);
+    }
+
+    pid_t pid;
+    err = posix_spawn(&pid, plan->exe_path, &actions, &attr, plan->argv, environ);
+    posix_spawn_file_actions_destroy(&actions);
+    posix_spawnattr_destroy(&attr);
+
+    if (plan->mode == INPUT_PIPE && close(pipefd[0]) == -1) {
+        fprintf(stderr, "Error occured at line %d: close failed\n", __LINE__ - 1);
+        exit(EXIT_FAILURE);
+    }
+    if (close(outfd[1]) == -1) {
+        fprintf(stderr, "Error occured at line %d: close failed\n", __LINE__ - 1);
+        exit(EXIT_FAILURE);
+    }
+
+    // If exec fails, only this pair fails (e.g. a "#!" script whose interpreter does not exist)
+    if (err != 0) {
+        fprintf(stderr, "Failed to execute program %s: %s\n", plan->exe_path, strerror(err));
+        close(outfd[0]);
+        return -1;
+    }
+    plan->output_fd = outfd[0];
+
+    return pid;
+}
+
+
+pid_t spawn_solution_in_cgroup(spawn_plan_t *plan, const sigset_t *child_mask, int cgroup_fd) {
+    int pipefd[2];
+    int outfd[2];
+    int errfd[2];
+
+    // The child reports a failed exec() by writing its errno here; a successful one closes it unwritten
+    if (pipe2(outfd, O_CLOEXEC) == -1 || pipe2(errfd, O_CLOEXEC) == -1) {
+        fprintf(stderr, "Error occured at line %d: pipe failed\n", __LINE__ - 1);
+        exit(EXIT_FAILURE);
+    }
+    if (fcntl(outfd[0], F_SETFL, O_NONBLOCK) == -1) {
+        fprintf(stderr, "Error occured at line %d: fcntl failed\n", __LINE__ - 1);
+        exit(EXIT_FAILURE);
+    }
+    if (plan->mode == INPUT_PIPE) {
+        if (pipe2(pipefd, O_CLOEXEC) == -1) {
+            fprintf(stderr, "Error occured at line %d: pipe failed\n", __LINE__ - 1);
+            exit(EXIT_FAILURE);
+        }
+        if (write(pipefd[1], plan->param, strlen(plan->param)) == -1) {
+            fprintf(stderr, "Error occured at line %d: write failed\n", __LINE__ - 1);
+            exit(EXIT_FAILURE);
+        }
+        if (close(pipefd[1]) == -1) {
+            fprintf(stderr, "Error occured at line %d: close failed\n", __LINE__ - 1);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    // clone3() puts the child in its cgroup atomically, before it can run (or fork) anything.
+    // posix_spawn() has no way to do that in this glibc, so the child does its own redirections.
+    struct clone_args args;
+    memset(&args, 0, sizeof(args));
+    args.flags = CLONE_INTO_CGROUP;
+    args.exit_signal = SIGCHLD;
+    args.cgroup = cgroup_fd;
+
+    pid_t pid = syscall(SYS_clone3, &args, sizeof(args));
+    if (pid == -1) {
+        perror("clone3");
+        exit(EXIT_FAILURE);
+    }
+    if (pid == 0) {
+        if (dup2(outfd[1], STDOUT_FILENO) == -1) {
+            _exit(EXIT_FAILURE);
+        }
+        if (plan->mode == INPUT_REDIR) {
+            int input_fd = open(plan->input_path, O_RDONLY);
+            if (input_fd == -1 || dup2(input_fd, STDIN_FILENO) == -1) {
+                _exit(EXIT_FAILURE);
+            }
+            close(input_fd);
+        } else if (plan->mode == INPUT_PIPE && dup2(pipefd[0], STDIN_FILENO) == -1) {
+            _exit(EXIT_FAILURE);
+        }
+        if (child_mask != NULL) {
+            sigprocmask(SIG_SETMASK, child_mask, NULL);
+        }
+        execve(plan->exe_path, plan->argv, environ);
+
+        // If exec fails
+        int exec_errno = errno;
+        if (write(errfd[1], &exec_errno, sizeof(exec_errno)) == -1) {
+            _exit(EXIT_FAILURE);
+        }
+        _exit(EXIT_FAILURE);
+    }
+
+    if (plan->mode == INPUT_PIPE && close(pipefd[0]) == -1) {
+        fprintf(stderr, "Error occured at line %d: close failed\n", __LINE__ - 1);
+        exit(EXIT_FAILURE);
+    }
+    if (close(outfd[1]) == -1 || close(errfd[1]) == -1) {
+        fprintf(stderr, "Error occured at line %d: close failed\n", __LINE__ - 1);
+        exit(EXIT_FAILURE);
+    }
+
+    // Blocks only until the child has exec()ed or given up
+    int exec_errno;
+    ssize_t bytes_read;
+    do {
+        bytes_read = read(errfd[0], &exec_errno, sizeof(exec_errno));
+    } while (bytes_read == -1 && errno == EINTR);
+    close(errfd[0]);
+    if (bytes_read == sizeof(exec_errno)) {
+        fprintf(stderr, "Failed to execute program %s: %s\n", plan->exe_path, strerror(exec_errno));
+        waitpid(pid, NULL, 0);
+        close(outfd[0]);
+        return -1;
+    }
+    plan->output_fd = outfd[0];
+
+    return pid;
+}
@@ -1,44 +1,110 @@
 #include "utils.h"
+#include "concurrency.h"
+#include "history.h"
+#include "shmring.h"
+#include "placement.h"
 
-pid_t *workers;          // Workers determined by batch size
+#include <getopt.h>
+
+pid_t *workers;          // Workers determined by batch size (-1 once reaped)
 int *worker_done;        // 1 for done, 0 for still running
 
 // Stores the results of the autograder (see utils.h for details)
 autograder_results_t *results;
 
+// Rings and work queue shared with the workers (see shmring.h)
+shm_channels_t *channels;
+
+// Per-executable runtime history (shared with autograder.c) and each executable's index into it
+runtime_history_t *history;
+int *history_idx;
+
+// With --pin, the CPUs of each worker (see plan_worker_placement()), NULL otherwise
+cpu_placement_t *placement;
+
 int num_executables;      // Number of executables in test directory
 int total_params;         // Total number of parameters to test - (argc - 2)
 int num_workers;          // Number of workers to spawn
 
 
-void launch_worker(int msqid, int pairs_per_worker, int worker_id) {
-    
+// 1 if worker i has exited. The worker is left for waitpid() to reap.
+int worker_exited(int i) {
+    siginfo_t info;
+    info.si_pid = 0;
+    if (waitid(P_PID, workers[i], &info, WEXITED | WNOHANG | WNOWAIT) == -1) {
+        perror("Failed to wait for child process");
+        exit(1);
+    }
+    return info.si_pid != 0;
+}
+
+
+// Send a record to worker_id, waiting for room in its dispatch ring
+void send_to_worker(int worker_id, uint32_t type, const void *payload, uint32_t length) {
+    shm_channel_t *channel = &channels->channels[worker_id - 1];
+    while (shm_ring_try_send(&channel->dispatch, &channel->waiter, type, payload, length) == -1) {
+        uint32_t seq = shm_prepare_wait(&channels->waiter);
+        if (shm_ring_try_send(&channel->dispatch, &channel->waiter, type, payload, length) == 0) {
+            shm_cancel_wait(&channels->waiter);
+            return;
+        }
+        shm_wait(&channels->waiter, seq, SHM_WAIT_MS);
+
+        // A worker that is gone will never make room
+        if (worker_exited(worker_id - 1)) {
+            fprintf(stderr, "Worker %d exited before it started testing\n", worker_id);
+            exit(EXIT_FAILURE);
+        }
+    }
+}
+
+
+// Sleep until a worker sends something (or SHM_WAIT_MS passes)
+void wait_for_records() {
+    uint32_t seq = shm_prepare_wait(&channels->waiter);
+    for (int i = 0; i < num_workers; i++) {
+        uint32_t type, length;
+        if (shm_ring_peek(&channels->channels[i].results, &type, &length) != NULL) {
+            shm_cancel_wait(&channels->waiter);
+            return;
+        }
+    }
+    shm_wait(&channels->waiter, seq, SHM_WAIT_MS);
+}
+
+
+void launch_worker(int channels_fd, int worker_id) {
+
     pid_t pid = fork();
 
     // Child process
     if (pid == 0) {
 
-        // TODO: exec() the worker program and pass it the message queue id and worker id.
-        //       Use ./worker as the path to the worker program.
-        execl("./worker", "./worker", msqid, worker_id, NULL);
+        // exec() the worker program and pass it the fd of the shared rings and its worker id.
+        // A pinned worker keeps its CPUs across exec() and pins its slots within them.
+        char fd_string[MAX_INT_CHARS + 1];
+        char id_string[MAX_INT_CHARS + 1];
+        snprintf(fd_string, sizeof(fd_string), "%d", channels_fd);
+        snprintf(id_string, sizeof(id_string), "%d", worker_id);
+        if (placement != NULL) {
+            cpu_placement_t *cpus = &placement[worker_id - 1];
+            if (set_cpu_affinity(0, cpus->cpus, cpus->num_cpus) == -1) {
+                perror("Failed to pin worker");
+                exit(1);
+            }
+            execl("./worker", "./worker", fd_string, id_string, "--pin", NULL);
+        } else {
+            execl("./worker", "./worker", fd_string, id_string, NULL);
+        }
         perror("Failed to spawn worker");
         exit(1);
-    } 
+    }
     // Parent process
     else if (pid > 0) {
-        // TODO: Send the total number of pairs to worker via message queue (mtype = worker_id)
-        msgbuf_t message;
-        message.mtype = worker_id;
-        strncpy(message.mtext, pairs_per_worker, sizeof(message.mtext) - 1);
-
-        if (msgsnd(msqid, &message, sizeof(message), 0) == -1) {
-            perror("Failed to send # of pairs to worker");
-            exit(EXIT_FAILURE);
-        }
         // Store the worker's pid for monitoring
         workers[worker_id - 1] = pid;
     }
-    // Fork failed 
+    // Fork failed
     else {
         perror("Failed to fork worker");
         exit(1);
@@ -46,20 +112,82 @@ void launch_worker(int msqid, int pairs_per_worker, int worker_id) {
 }
 
 
-// TODO: Receive ACK from all workers using message queue (mtype = BROADCAST_MTYPE)
-void receive_ack_from_workers(int msqid, int num_workers) {
-    
+// Receive ACK from all workers: each sends it once it has attached to the shared region
+void receive_ack_from_workers(int num_workers) {
+    int *acked = calloc(num_workers, sizeof(int));
+    if (acked == NULL) {
+        fprintf(stderr, "Error occured at line %d: calloc failed\n", __LINE__ - 2);
+        exit(EXIT_FAILURE);
+    }
+
+    int received = 0;
+    while (received < num_workers) {
+        int progress = 0;
+        for (int i = 0; i < num_workers; i++) {
+            if (acked[i]) {
+                continue;
+            }
+            uint32_t type, length;
+            if (shm_ring_peek(&channels->channels[i].results, &type, &length) != NULL) {
+                if (type != MQ_ACK) {
+                    fprintf(stderr, "Expected ACK from worker %d, got record type %u\n", i + 1, type);
+                    exit(EXIT_FAILURE);
+                }
+                shm_ring_consume(&channels->channels[i].results, &channels->channels[i].waiter);
+                acked[i] = 1;
+                received++;
+                progress = 1;
+            } else if (worker_exited(i)) {
+                fprintf(stderr, "Worker %d exited before acknowledging\n", i + 1);
+                exit(EXIT_FAILURE);
+            }
+        }
+        if (!progress && received < num_workers) {
+            wait_for_records();
+        }
+    }
+    free(acked);
+}
+
+
+// Send SYNACK to all workers so they start testing
+void send_synack_to_workers(int num_workers) {
+    for (int i = 0; i < num_workers; i++) {
+        send_to_worker(i + 1, MQ_SYNACK, NULL, 0);
+    }
 }
 
 
-// TODO: Send SYNACK to all workers using message queue (mtype = BROADCAST_MTYPE)
-void send_synack_to_workers(int msqid, int num_workers) {
-    
+// Store a batch of results (an MQ_RESULTS record from worker i). Returns the number of results.
+int store_results(int i, const char *payload, uint32_t length) {
+    mq_results_header_t header;
+    if (length < sizeof(header)) {
+        fprintf(stderr, "Truncated results from worker %d\n", i + 1);
+        exit(EXIT_FAILURE);
+    }
+    memcpy(&header, payload, sizeof(header));
+    if (header.version != MQ_RESULTS_VERSION || header.record_size != sizeof(mq_result_t)
+            || length != sizeof(header) + (uint64_t) header.count * sizeof(mq_result_t)) {
+        fprintf(stderr, "Worker %d sends results version %u (%u-byte records), expected version %d (%zu-byte records)\n",
+                i + 1, header.version, header.record_size, MQ_RESULTS_VERSION, sizeof(mq_result_t));
+        exit(EXIT_FAILURE);
+    }
+
+    const mq_result_t *records = (const mq_result_t *) (payload + sizeof(header));
+    for (uint32_t k = 0; k < header.count; k++) {
+        if (records[k].exe_id >= (uint32_t) num_executables || records[k].param_idx >= total_params) {
+            fprintf(stderr, "Result for an unknown pair from worker %d\n", i + 1);
+            exit(EXIT_FAILURE);
+        }
+        results[records[k].exe_id].status[records[k].param_idx] = records[k].status;
+        history_record(history, history_idx[records[k].exe_id], records[k].duration_ms);
+    }
+    return header.count;
 }
 
 
-// Wait for all workers to finish and collect their results from message queue
-void wait_for_workers(int msqid, int pairs_to_test, char **argv_params) {
+// Wait for all workers to finish and collect their results from the shared rings
+void wait_for_workers(int pairs_to_test) {
     int received = 0;
     worker_done = malloc(num_workers * sizeof(int));
     for (int i = 0; i < num_workers; i++) {
@@ -67,34 +195,49 @@ void wait_for_workers(int msqid, int pairs_to_test, char **argv_params) {
     }
 
     while (received < pairs_to_test) {
+        int progress = 0;
         for (int i = 0; i < num_workers; i++) {
             if (worker_done[i] == 1) {
                 continue;
             }
 
-            // Check if worker has finished
+            // Check if worker has finished: everything it sent is in its ring by then
             pid_t retpid = waitpid(workers[i], NULL, WNOHANG);
-            
-            int msgflg;
-            if (retpid > 0)
-                // Worker has finished and still has messages to receive
-                msgflg = 0;
-            else if (retpid == 0)
-                // Worker is still running -> receive intermediate results
-                msgflg = IPC_NOWAIT;
-            else {
-                // Error
+            if (retpid > 0) {
+                workers[i] = -1;
+            } else if (retpid == -1) {
                 perror("Failed to wait for child process");
                 exit(1);
             }
 
-            // TODO: Receive results from worker and store them in the results struct.
-            //       If message is "DONE", set worker_done[i] to 1 and break out of loop.
-            //       Messages will have the format ("%s %d %d", executable_path, parameter, status)
-            //       so consider using sscanf() to parse the message.
-            while (1) {
-                
+            // Receive results from worker and store them in the results struct.
+            // Stop at DONE: the worker has sent everything.
+            shm_ring_t *ring = &channels->channels[i].results;
+            uint32_t type, length;
+            const char *payload;
+            while ((payload = shm_ring_peek(ring, &type, &length)) != NULL) {
+                if (type == MQ_DONE) {
+                    worker_done[i] = 1;
+                } else if (type == MQ_RESULTS) {
+                    received += store_results(i, payload, length);
+                } else {
+                    fprintf(stderr, "Unexpected record type %u from worker %d\n", type, i + 1);
+                    exit(EXIT_FAILURE);
+                }
+                shm_ring_consume(ring, &channels->channels[i].waiter);
+                progress = 1;
+                if (worker_done[i] == 1) {
+                    break;
+                }
             }
+
+            if (retpid > 0 && worker_done[i] == 0) {
+                fprintf(stderr, "Worker %d exited before finishing its pairs\n", i + 1);
+                exit(EXIT_FAILURE);
+            }
+        }
+        if (!progress && received < pairs_to_test) {
+            wait_for_records();
         }
     }
 
@@ -102,79 +245,150 @@ void wait_for_workers(int msqid, int pairs_to_test, char **argv_params) {
 }
 
 
+void print_usage(const char *program) {
+    printf("Usage: %s [--pin] [--session] <testdir> <p1> <p2> ... <pn>\n", program);
+}
+
+
 int main(int argc, char *argv[]) {
-    if (argc < 3) {
-        printf("Usage: %s <testdir> <p1> <p2> ... <pn>\n", argv[0]);
+    static struct option long_options[] = {
+        {"pin", no_argument, NULL, 'p'},
+        {"session", no_argument, NULL, 's'},
+        {NULL, 0, NULL, 0}
+    };
+    int pin = 0;
+    int session = 0;
+    int opt;
+    // "+": stop at the first non-option, so negative parameters are not taken for options
+    while ((opt = getopt_long(argc, argv, "+", long_options, NULL)) != -1) {
+        switch (opt) {
+            case 'p':
+                pin = 1;
+                break;
+            case 's':
+                session = 1;
+                break;
+            default:
+                print_usage(argv[0]);
+                return 1;
+        }
+    }
+    if (argc - optind < 2) {
+        print_usage(argv[0]);
         return 1;
     }
 
-    char *testdir = argv[1];
-    total_params = argc - 2;
+    char *testdir = argv[optind];
+    total_params = argc - optind - 1;
+    char **params = argv + optind + 1;
 
     char **executable_paths = get_student_executables(testdir, &num_executables);
 
-    // Construct summary struct
-    results = malloc(num_executables * sizeof(autograder_results_t));
+    // Construct summary struct - one arena, which also takes its own copy of the paths
+    results = create_results(executable_paths, num_executables, params, total_params, 0);
     for (int i = 0; i < num_executables; i++) {
-        results[i].exe_path = executable_paths[i];
-        results[i].params_tested = malloc((total_params) * sizeof(int));
-        results[i].status = malloc((total_params) * sizeof(int));
+        free(executable_paths[i]);
     }
+    free(executable_paths);
 
-    num_workers = get_batch_size();
-    // Check if some workers won't be used -> don't spawn them
-    if (num_workers > num_executables * total_params) {
-        num_workers = num_executables * total_params;
+    // Results name their parameter by a 16-bit index (see mq_result_t)
+    if (total_params > UINT16_MAX + 1) {
+        fprintf(stderr, "At most %d parameters are supported\n", UINT16_MAX + 1);
+        return 1;
     }
-    workers = malloc(num_workers * sizeof(pid_t));
-
-    // Create a unique key for message queue
-    key_t key = IPC_PRIVATE;
 
-    // TODO: Create a message queue
-    int msqid;
-
-    if(msgget(key, 0666 | IPC_CREAT) == -1) {
-        perror("Message queue setup failed");
+    // The runtime of every pair is folded into the history the autograder orders its work by
+    history = load_runtime_history(HISTORY_FILE);
+    history_reserve(history, num_executables);
+    history_idx = malloc((num_executables + 1) * sizeof(int));
+    if (history_idx == NULL) {
+        fprintf(stderr, "Error occured at line %d: malloc failed\n", __LINE__ - 2);
         exit(EXIT_FAILURE);
     }
+    for (int i = 0; i < num_executables; i++) {
+        history_idx[i] = history_lookup(history, results[i].exe_path);
+    }
+
+    // One worker per usable CPU; each worker's own controller then scales its children from there
+    num_workers = get_effective_cpus();
+    // Check if some workers won't be used -> don't spawn them. A session takes a whole executable.
+    int units_of_work = session ? num_executables : num_executables * total_params;
+    if (num_workers > units_of_work) {
+        num_workers = units_of_work;
+    }
+    workers = malloc(num_workers * sizeof(pid_t));
 
+    // Give each worker its own CPUs within one NUMA node, and log where everything runs
+    placement = NULL;
+    if (pin) {
+        placement = plan_worker_placement(num_workers);
+        if (placement == NULL) {
+            fprintf(stderr, "Cannot determine the CPUs to pin workers to, running unpinned\n");
+        }
+        for (int i = 0; placement != NULL && i < num_workers; i++) {
+            char cpu_list[256];
+            format_cpu_list(placement[i].cpus, placement[i].num_cpus, cpu_list, sizeof(cpu_list));
+            printf("Worker %d: NUMA node %d, CPUs %s\n", i + 1, placement[i].node, cpu_list);
+        }
+        // The workers write to the same stdout
+        fflush(stdout);
+    }
 
     int num_pairs_to_test = num_executables * total_params;
-    
-    // Spawn workers and send them the total number of (executable, parameter) pairs they will test
-    for (int i = 0; i < num_workers; i++) {
-        int leftover = num_pairs_to_test % num_workers - i > 0 ? 1 : 0;
-        int pairs_per_worker = num_pairs_to_test / num_workers + leftover;
 
-        // TODO: Spawn worker and send it the number of pairs it will test via message queue
-        launch_worker(msqid, pairs_per_worker, i + 1);
+    // Create the shared region: a dispatch and a results ring per worker, and the work queue
+    size_t paths_size = 0;
+    for (int j = 0; j < num_executables; j++) {
+        paths_size += strlen(results[j].exe_path) + 1;   // +1 for the null terminator
     }
-
-    // Send (executable, parameter) pairs to workers
-    int sent = 0;
+    int channels_fd;
+    channels = create_shm_channels(num_workers, num_pairs_to_test, paths_size, &channels_fd);
+
+    // Queue every (executable, parameter) pair before any worker starts. Nothing is assigned up
+    // front: each worker claims the next pair whenever it has a free slot (see shm_claim_pair()).
+    // With --session the pairs are queued by executable instead, and a worker claims all of an
+    // executable's pairs at once for one process to answer (see session.h).
+    // Each path is stored once and shared by all of its pairs.
+    uint32_t *path_offsets = malloc(num_executables * sizeof(uint32_t));
+    if (path_offsets == NULL) {
+        fprintf(stderr, "Error occured at line %d: malloc failed\n", __LINE__ - 2);
+        exit(EXIT_FAILURE);
+    }
+    char *paths = shm_paths(channels);
+    for (int j = 0; j < num_executables; j++) {
+        size_t path_len = strlen(results[j].exe_path) + 1;
+        memcpy(paths, results[j].exe_path, path_len);
+        path_offsets[j] = paths - (char *) channels;
+        paths += path_len;
+    }
+    shm_pair_t *queue = shm_pairs(channels);
     for (int i = 0; i < total_params; i++) {
         for (int j = 0; j < num_executables; j++) {
-            msgbuf_t msg;
-            long worker_id = sent % num_workers + 1;
-            
-            // TODO: Send (executable, parameter) pair to worker via message queue (mtype = worker_id)
-
-            sent++;
+            int queued = session ? j * total_params + i : i * num_executables + j;
+            queue[queued].param = results[j].params_tested[i];
+            queue[queued].path_offset = path_offsets[j];
+            queue[queued].exe_id = j;
+            queue[queued].param_idx = i;
         }
     }
+    channels->session_params = session ? total_params : 0;
+    free(path_offsets);
 
-    // TODO: Wait for ACK from workers to tell all workers to start testing (synchronization)
-    receive_ack_from_workers(msqid, num_workers);
-
-    // TODO: Send message to workers to allow them to start testing
-    send_synack_to_workers(msqid, num_workers);
+    // Spawn workers
+    for (int i = 0; i < num_workers; i++) {
+        launch_worker(channels_fd, i + 1);
+    }
+    // Every worker has its own copy of the fd by now
+    close(channels_fd);
 
-    // TODO: Wait for all workers to finish and collect their results from message queue
-    wait_for_workers(msqid, num_pairs_to_test, argv + 2);
+    // Wait for ACK from workers to tell all workers to start testing (synchronization)
+    receive_ack_from_workers(num_workers);
 
-    // TODO: Remove ALL output files (output/<executable>.<input>)
+    // Send message to workers to allow them to start testing
+    send_synack_to_workers(num_workers);
 
+    // Wait for all workers to finish and collect their results from the shared rings
+    wait_for_workers(num_pairs_to_test);
 
     write_results_to_file(results, num_executables, total_params);
 
@@ -182,26 +396,25 @@ int main(int argc, char *argv[]) {
     // get_score("results.txt", results[0].exe_path);
 
     // Print each score to scores.txt
-    write_scores_to_file(results, num_executables, "results.txt");
+    write_scores_to_file(results, num_executables, total_params, "scores.txt");
 
-    // TODO: Remove the message queue
-    if (msqid != -1) {
-        if (msgctl(msqid, IPC_RMID, NULL) == -1) {
-            perror("msgctl failed");
-            exit(EXIT_FAILURE);
+    // Reap the workers that were still exiting after their DONE
+    for (int i = 0; i < num_workers; i++) {
+        if (workers[i] != -1) {
+            waitpid(workers[i], NULL, 0);
         }
     }
-
-    // Free the results struct and its fields
-    for (int i = 0; i < num_executables; i++) {
-        free(results[i].exe_path);
-        free(results[i].params_tested);
-        free(results[i].status);
+    free_shm_channels(channels);
+    if (placement != NULL) {
+        free_worker_placement(placement, num_workers);
     }
 
-    free(results);
-    free(executable_paths);
+    // The results struct and all of its fields are one allocation
+    save_runtime_history(history);
+    free_runtime_history(history);
+    free(history_idx);
+    free_results(results);
     free(workers);
-    
+
     return 0;
-}
\ No newline at end of file
+}
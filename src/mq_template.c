@@ -2,47 +2,65 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <signal.h>
+#include <sys/socket.h>
 
 
 #include "utils.h"
+#include "session.h"
 
 
 void infinite_loop() {
     while(1){};    // Simulating a infinite loop
 }
 
+// Send the answer to the current parameter back to the worker
+void send_answer(int session_fd, const char *answer) {
+    if (send(session_fd, answer, strlen(answer), 0) == -1) {
+        perror("send failed");
+        exit(EXIT_FAILURE);
+    }
+}
+
 int main(int argc, char *argv[]) {
     if (argc < 2) {
-        printf("Usage: %s <msgid>\n", argv[0]);
+        printf("Usage: %s <session fd>\n", argv[0]);
         return 1;
     }
 
+    int session_fd = atoi(argv[1]);
     unsigned int seed = 0;
 
     for (int i = 0; argv[0][i] != '\0'; i++) {
-        seed += (unsigned char)argv[0][i]; 
+        seed += (unsigned char)argv[0][i];
     }
 
-    // TODO: Read input params from message queue until END message is received
-
+    // Read input params from the session until END message is received (see session.h)
     while (1) {
 
-        // Read from message queue
-
-
+        // Read from the session: every message is one parameter
+        char message[SESSION_MESSAGE_SIZE + 1];
+        ssize_t length = recv(session_fd, message, SESSION_MESSAGE_SIZE, 0);
+        if (length == -1) {
+            perror("recv failed");
+            exit(EXIT_FAILURE);
+        }
+        if (length == 0) {
+            break;  // The worker is gone
+        }
+        message[length] = '\0';
+        if (strcmp(message, SESSION_END) == 0) {
+            break;
+        }
 
-        int param = 0;  // TODO: Get this value from the message queue
+        int param = atoi(message);
 
-        seed += param;
-        srandom(seed);
+        // Seeded from this parameter alone, so a restarted process answers it the same way
+        srandom(seed + param);
 
         int mode = random() % 15 + 1;
         pid_t pid = getpid();
 
 
-        // Open output file (output/<executable>.<input>) for writing
-
-
         // Using weighted random to avoid every process getting stuck/infinite/crashed
         switch (mode) {
             case 1:
@@ -52,18 +70,16 @@ int main(int argc, char *argv[]) {
             case 5:
             case 6:
             case 7:
-                fprintf(stderr, "Program: %s, PID: %d, Mode: 1 - Exiting with status 0 (Correct answer)\n", argv[0], pid);
-                // TODO: Write the result to the output file
-
+                fprintf(stderr, "Program: %s, PID: %d, Mode: 1 - Answering 0 (Correct answer)\n", argv[0], pid);
+                send_answer(session_fd, "0");
                 break;
             case 8:
             case 9:
             case 10:
             case 11:
             case 12:
-                fprintf(stderr, "Program: %s, PID: %d, Mode: 2 - Exiting with status 1 (Incorrect answer)\n", argv[0], pid);
-                // TODO: Write the result to the output file
-
+                fprintf(stderr, "Program: %s, PID: %d, Mode: 2 - Answering 1 (Incorrect answer)\n", argv[0], pid);
+                send_answer(session_fd, "1");
                 break;
             case 13:
                 fprintf(stderr, "Program: %s, PID: %d, Mode: 3 - Triggering a segmentation fault\n", argv[0], pid);
@@ -0,0 +1,269 @@
+#define _GNU_SOURCE  // For accept4()
+#include "utils.h"
+#include "netproto.h"
+
+#include <endian.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+
+// Apply the options every connection gets: no Nagle delay for the small request/verdict messages,
+// keepalives so a vanished peer is eventually noticed, and a bound on blocking sends
+static void set_socket_options(int fd) {
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    setsockopt(fd, SOL_SOCKET, SO_KEEPALIVE, &one, sizeof(one));
+    struct timeval timeout = { .tv_sec = NET_SEND_TIMEOUT_SECS, .tv_usec = 0 };
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+}
+
+
+int net_send(int fd, uint32_t type, const struct iovec *iov, int count) {
+    size_t length = 0;
+    for (int i = 0; i < count; i++) {
+        length += iov[i].iov_len;
+    }
+    if (length > NET_MAX_PAYLOAD) {
+        fprintf(stderr, "Message of %zu bytes is too large to send\n", length);
+        return -1;
+    }
+
+    char header[sizeof(net_header_t)];
+    net_put_u32(header, type);
+    net_put_u32(header + 4, length);
+    struct iovec all[8];
+    if (count + 1 > (int) (sizeof(all) / sizeof(all[0]))) {
+        return -1;
+    }
+    all[0].iov_base = header;
+    all[0].iov_len = sizeof(header);
+    memcpy(all + 1, iov, count * sizeof(struct iovec));
+
+    struct msghdr msg = { 0 };
+    msg.msg_iov = all;
+    msg.msg_iovlen = count + 1;
+    while (msg.msg_iovlen > 0) {
+        ssize_t sent = sendmsg(fd, &msg, MSG_NOSIGNAL);
+        if (sent == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        while (msg.msg_iovlen > 0 && (size_t) sent >= msg.msg_iov->iov_len) {
+            sent -= msg.msg_iov->iov_len;
+            msg.msg_iov++;
+            msg.msg_iovlen--;
+        }
+        if (msg.msg_iovlen > 0) {
+            msg.msg_iov->iov_base = (char *) msg.msg_iov->iov_base + sent;
+            msg.msg_iov->iov_len -= sent;
+        }
+    }
+    return 0;
+}
+
+
+// Read exactly length bytes. Returns -1 on EOF or error.
+static int read_full(int fd, char *buffer, size_t length) {
+    while (length > 0) {
+        ssize_t nread = read(fd, buffer, length);
+        if (nread == -1 && errno == EINTR) {
+            continue;
+        }
+        if (nread <= 0) {
+            return -1;
+        }
+        buffer += nread;
+        length -= nread;
+    }
+    return 0;
+}
+
+
+int net_recv(int fd, uint32_t *type, char **payload, uint32_t *length) {
+    char header[sizeof(net_header_t)];
+    if (read_full(fd, header, sizeof(header)) == -1) {
+        return -1;
+    }
+    const char *cursor = header;
+    net_get_u32(&cursor, header + sizeof(header), type);
+    net_get_u32(&cursor, header + sizeof(header), length);
+    if (*length > NET_MAX_PAYLOAD) {
+        return -1;
+    }
+
+    *payload = NULL;
+    if (*length > 0) {
+        *payload = malloc(*length);
+        if (*payload == NULL) {
+            fprintf(stderr, "Error occured at line %d: malloc failed\n", __LINE__ - 2);
+            exit(EXIT_FAILURE);
+        }
+        if (read_full(fd, *payload, *length) == -1) {
+            free(*payload);
+            *payload = NULL;
+            return -1;
+        }
+    }
+    return 0;
+}
+
+
+void net_put_u32(char *out, uint32_t value) {
+    value = htobe32(value);
+    memcpy(out, &value, sizeof(value));
+}
+
+
+void net_put_u64(char *out, uint64_t value) {
+    value = htobe64(value);
+    memcpy(out, &value, sizeof(value));
+}
+
+
+int net_get_u32(const char **cursor, const char *end, uint32_t *value) {
+    if (end - *cursor < 4) {
+        return -1;
+    }
+    memcpy(value, *cursor, sizeof(*value));
+    *value = be32toh(*value);
+    *cursor += 4;
+    return 0;
+}
+
+
+int net_get_u64(const char **cursor, const char *end, uint64_t *value) {
+    if (end - *cursor < 8) {
+        return -1;
+    }
+    memcpy(value, *cursor, sizeof(*value));
+    *value = be64toh(*value);
+    *cursor += 8;
+    return 0;
+}
+
+
+int net_get_digest(const char **cursor, const char *end, content_digest_t *digest) {
+    if (end - *cursor < SHA256_DIGEST_SIZE) {
+        return -1;
+    }
+    memcpy(digest->bytes, *cursor, SHA256_DIGEST_SIZE);
+    *cursor += SHA256_DIGEST_SIZE;
+    return 0;
+}
+
+
+size_t net_put_pair(char *out, const net_pair_t *pair) {
+    size_t name_len = strlen(pair->name);
+    net_put_u32(out, pair->pair_id);
+    net_put_u32(out + 4, (uint32_t) pair->param);
+    memcpy(out + 8, pair->digest.bytes, SHA256_DIGEST_SIZE);
+    out[8 + SHA256_DIGEST_SIZE] = name_len >> 8;
+    out[9 + SHA256_DIGEST_SIZE] = name_len & 0xff;
+    memcpy(out + 10 + SHA256_DIGEST_SIZE, pair->name, name_len);
+    return NET_PAIR_SIZE(name_len);
+}
+
+
+int net_get_pair(const char **cursor, const char *end, net_pair_t *pair) {
+    uint32_t param;
+    if (net_get_u32(cursor, end, &pair->pair_id) == -1 || net_get_u32(cursor, end, &param) == -1
+            || net_get_digest(cursor, end, &pair->digest) == -1 || end - *cursor < 2) {
+        return -1;
+    }
+    pair->param = (int32_t) param;
+    size_t name_len = ((unsigned char) (*cursor)[0] << 8) | (unsigned char) (*cursor)[1];
+    *cursor += 2;
+    if (name_len == 0 || name_len > NAME_MAX || (size_t) (end - *cursor) < name_len) {
+        return -1;
+    }
+    memcpy(pair->name, *cursor, name_len);
+    pair->name[name_len] = '\0';
+    *cursor += name_len;
+
+    // The name becomes a file name in the agent's cache
+    if (strchr(pair->name, '/') != NULL || pair->name[0] == '.') {
+        return -1;
+    }
+    return 0;
+}
+
+
+int net_listen(const char *port) {
+    struct addrinfo hints = { 0 };
+    hints.ai_family = AF_INET6;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE;
+    struct addrinfo *info;
+    int err = getaddrinfo(NULL, port, &hints, &info);
+    if (err != 0) {
+        hints.ai_family = AF_INET;   // No IPv6 on this host
+        err = getaddrinfo(NULL, port, &hints, &info);
+    }
+    if (err != 0) {
+        fprintf(stderr, "getaddrinfo: %s\n", gai_strerror(err));
+        exit(EXIT_FAILURE);
+    }
+
+    int fd = socket(info->ai_family, info->ai_socktype | SOCK_CLOEXEC, 0);
+    if (fd == -1) {
+        perror("socket");
+        exit(EXIT_FAILURE);
+    }
+    int one = 1;
+    int zero = 0;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    if (info->ai_family == AF_INET6) {
+        setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, &zero, sizeof(zero));  // IPv4 agents too
+    }
+    if (bind(fd, info->ai_addr, info->ai_addrlen) == -1 || listen(fd, SOMAXCONN) == -1) {
+        perror("Failed to listen");
+        exit(EXIT_FAILURE);
+    }
+    freeaddrinfo(info);
+    return fd;
+}
+
+
+int net_accept(int listen_fd) {
+    int fd = accept4(listen_fd, NULL, NULL, SOCK_CLOEXEC);
+    if (fd == -1) {
+        return -1;
+    }
+    set_socket_options(fd);
+    struct timeval timeout = { .tv_sec = NET_RECV_TIMEOUT_SECS, .tv_usec = 0 };
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    return fd;
+}
+
+
+int net_connect(const char *host, const char *port) {
+    struct addrinfo hints = { 0 };
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    struct addrinfo *info;
+    int err = getaddrinfo(host, port, &hints, &info);
+    if (err != 0) {
+        fprintf(stderr, "getaddrinfo: %s\n", gai_strerror(err));
+        return -1;
+    }
+
+    int fd = -1;
+    for (struct addrinfo *ai = info; ai != NULL && fd == -1; ai = ai->ai_next) {
+        fd = socket(ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC, 0);
+        if (fd != -1 && connect(fd, ai->ai_addr, ai->ai_addrlen) == -1) {
+            close(fd);
+            fd = -1;
+        }
+    }
+    freeaddrinfo(info);
+    if (fd == -1) {
+        perror("Failed to connect");
+        return -1;
+    }
+    set_socket_options(fd);
+    return fd;
+}
@@ -0,0 +1,254 @@
+#define _GNU_SOURCE  // For sched_setaffinity() and the CPU_* macros
+#include "utils.h"
+#include "placement.h"
+
+#include <sched.h>
+
+// A NUMA node and the allowed CPUs in it
+typedef struct {
+    int node;
+    int num_cpus;
+    int *cpus;
+    int num_workers;      // workers placed on the node so far
+} numa_node_t;
+
+
+int get_allowed_cpus(int **cpus) {
+    cpu_set_t set;
+    if (sched_getaffinity(0, sizeof(set), &set) == -1) {
+        return -1;
+    }
+    *cpus = malloc(CPU_COUNT(&set) * sizeof(int) + 1);
+    if (*cpus == NULL) {
+        fprintf(stderr, "Error occured at line %d: malloc failed\n", __LINE__ - 2);
+        exit(EXIT_FAILURE);
+    }
+    int count = 0;
+    for (int cpu = 0; cpu < PLACEMENT_MAX_CPUS; cpu++) {
+        if (CPU_ISSET(cpu, &set)) {
+            (*cpus)[count++] = cpu;
+        }
+    }
+    return count;
+}
+
+
+// Parse a cpulist ("0-3,8,10-11") into in_list[cpu] = 1. Returns -1 if it is malformed.
+static int parse_cpu_list(const char *list, char *in_list) {
+    while (*list != '\0' && *list != '\n') {
+        char *end;
+        long first = strtol(list, &end, 10);
+        long last = first;
+        if (end == list) {
+            return -1;
+        }
+        if (*end == '-') {
+            list = end + 1;
+            last = strtol(list, &end, 10);
+            if (end == list) {
+                return -1;
+            }
+        }
+        for (long cpu = first; cpu <= last && cpu < PLACEMENT_MAX_CPUS; cpu++) {
+            if (cpu >= 0) {
+                in_list[cpu] = 1;
+            }
+        }
+        list = *end == ',' ? end + 1 : end;
+    }
+    return 0;
+}
+
+
+static int compare_nodes(const void *a, const void *b) {
+    return ((const numa_node_t *) a)->node - ((const numa_node_t *) b)->node;
+}
+
+
+// The NUMA nodes that have allowed CPUs, in node order. Without NUMA information all allowed CPUs
+// form node 0. Returns the number of nodes.
+static int read_numa_nodes(const int *allowed, int num_allowed, numa_node_t **nodes) {
+    char *is_allowed = calloc(PLACEMENT_MAX_CPUS, 1);
+    char *in_node = malloc(PLACEMENT_MAX_CPUS);
+    int capacity = 8;
+    *nodes = malloc(capacity * sizeof(numa_node_t));
+    if (is_allowed == NULL || in_node == NULL || *nodes == NULL) {
+        fprintf(stderr, "Error occured at line %d: allocation failed\n", __LINE__ - 4);
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < num_allowed; i++) {
+        is_allowed[allowed[i]] = 1;
+    }
+
+    int num_nodes = 0;
+    DIR *dir = opendir(PLACEMENT_NODE_DIR);
+    struct dirent *entry;
+    while (dir != NULL && (entry = readdir(dir)) != NULL) {
+        int node;
+        char path[PATH_MAX];
+        char list[4096];
+        if (sscanf(entry->d_name, "node%d", &node) != 1) {
+            continue;
+        }
+        snprintf(path, sizeof(path), "%s/%s/cpulist", PLACEMENT_NODE_DIR, entry->d_name);
+        FILE *file = fopen(path, "r");
+        if (file == NULL) {
+            continue;
+        }
+        char *line = fgets(list, sizeof(list), file);
+        fclose(file);
+        memset(in_node, 0, PLACEMENT_MAX_CPUS);
+        if (line == NULL || parse_cpu_list(list, in_node) == -1) {
+            continue;
+        }
+
+        // Only the CPUs we may use count; a node without any is skipped
+        numa_node_t current = { node, 0, malloc(num_allowed * sizeof(int)), 0 };
+        if (current.cpus == NULL) {
+            fprintf(stderr, "Error occured at line %d: malloc failed\n", __LINE__ - 2);
+            exit(EXIT_FAILURE);
+        }
+        for (int i = 0; i < num_allowed; i++) {
+            if (in_node[allowed[i]]) {
+                current.cpus[current.num_cpus++] = allowed[i];
+                is_allowed[allowed[i]] = 0;
+            }
+        }
+        if (current.num_cpus == 0) {
+            free(current.cpus);
+            continue;
+        }
+        if (num_nodes == capacity) {
+            capacity *= 2;
+            *nodes = realloc(*nodes, capacity * sizeof(numa_node_t));
+            if (*nodes == NULL) {
+                fprintf(stderr, "Error occured at line %d: realloc failed\n", __LINE__ - 2);
+                exit(EXIT_FAILURE);
+            }
+        }
+        (*nodes)[num_nodes++] = current;
+    }
+    if (dir != NULL) {
+        closedir(dir);
+    }
+    qsort(*nodes, num_nodes, sizeof(numa_node_t), compare_nodes);
+
+    // Allowed CPUs no node lists form one more node of their own: node 0 without NUMA information,
+    // -1 (unknown) otherwise
+    numa_node_t rest = { num_nodes > 0 ? -1 : 0, 0, malloc(num_allowed * sizeof(int) + 1), 0 };
+    if (rest.cpus == NULL) {
+        fprintf(stderr, "Error occured at line %d: malloc failed\n", __LINE__ - 2);
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < num_allowed; i++) {
+        if (is_allowed[allowed[i]]) {
+            rest.cpus[rest.num_cpus++] = allowed[i];
+        }
+    }
+    if (rest.num_cpus > 0) {
+        if (num_nodes == capacity) {
+            *nodes = realloc(*nodes, (capacity + 1) * sizeof(numa_node_t));
+            if (*nodes == NULL) {
+                fprintf(stderr, "Error occured at line %d: realloc failed\n", __LINE__ - 2);
+                exit(EXIT_FAILURE);
+            }
+        }
+        (*nodes)[num_nodes++] = rest;
+    } else {
+        free(rest.cpus);
+    }
+
+    free(is_allowed);
+    free(in_node);
+    return num_nodes;
+}
+
+
+cpu_placement_t *plan_worker_placement(int num_workers) {
+    int *allowed;
+    int num_allowed = get_allowed_cpus(&allowed);
+    if (num_allowed == -1 || num_allowed < num_workers) {
+        if (num_allowed != -1) {
+            free(allowed);
+        }
+        return NULL;
+    }
+    numa_node_t *nodes;
+    int num_nodes = read_numa_nodes(allowed, num_allowed, &nodes);
+    free(allowed);
+
+    // Give each worker to the node with the most CPUs per worker (highest averages), so nodes get
+    // workers in proportion to their CPUs and none gets more workers than CPUs
+    for (int w = 0; w < num_workers; w++) {
+        int best = 0;
+        for (int n = 1; n < num_nodes; n++) {
+            if ((long) nodes[n].num_cpus * (nodes[best].num_workers + 1) > (long) nodes[best].num_cpus * (nodes[n].num_workers + 1)) {
+                best = n;
+            }
+        }
+        nodes[best].num_workers++;
+    }
+
+    // Then split every node's CPUs into contiguous runs, one per worker placed on it
+    cpu_placement_t *placement = malloc(num_workers * sizeof(cpu_placement_t));
+    if (placement == NULL) {
+        fprintf(stderr, "Error occured at line %d: malloc failed\n", __LINE__ - 2);
+        exit(EXIT_FAILURE);
+    }
+    int w = 0;
+    for (int n = 0; n < num_nodes; n++) {
+        int first = 0;
+        for (int k = 0; k < nodes[n].num_workers; k++, w++) {
+            int count = nodes[n].num_cpus / nodes[n].num_workers + (k < nodes[n].num_cpus % nodes[n].num_workers);
+            placement[w].node = nodes[n].node;
+            placement[w].num_cpus = count;
+            placement[w].cpus = malloc(count * sizeof(int));
+            if (placement[w].cpus == NULL) {
+                fprintf(stderr, "Error occured at line %d: malloc failed\n", __LINE__ - 2);
+                exit(EXIT_FAILURE);
+            }
+            memcpy(placement[w].cpus, nodes[n].cpus + first, count * sizeof(int));
+            first += count;
+        }
+        free(nodes[n].cpus);
+    }
+    free(nodes);
+    return placement;
+}
+
+
+void free_worker_placement(cpu_placement_t *placement, int num_workers) {
+    for (int i = 0; i < num_workers; i++) {
+        free(placement[i].cpus);
+    }
+    free(placement);
+}
+
+
+int set_cpu_affinity(pid_t pid, const int *cpus, int num_cpus) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (int i = 0; i < num_cpus; i++) {
+        CPU_SET(cpus[i], &set);
+    }
+    return sched_setaffinity(pid, sizeof(set), &set);
+}
+
+
+void format_cpu_list(const int *cpus, int num_cpus, char *buffer, size_t size) {
+    size_t used = 0;
+    buffer[0] = '\0';
+    for (int i = 0; i < num_cpus && used < size; ) {
+        // Extend the run while the CPUs are consecutive
+        int last = i;
+        while (last + 1 < num_cpus && cpus[last + 1] == cpus[last] + 1) {
+            last++;
+        }
+        if (last > i) {
+            used += snprintf(buffer + used, size - used, "%s%d-%d", i > 0 ? "," : "", cpus[i], cpus[last]);
+        } else {
+            used += snprintf(buffer + used, size - used, "%s%d", i > 0 ? "," : "", cpus[i]);
+        }
+        i = last + 1;
+    }
+}
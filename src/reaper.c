@@ -0,0 +1,432 @@
+#include "utils.h"
+#include "reaper.h"
+
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/syscall.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+
+// Kind of fd an epoll event belongs to (upper 32 bits of epoll_data.u64, the slot is in the lower ones)
+#define EVENT_TIMER 1
+#define EVENT_SIGNAL 2
+#define EVENT_PIDFD 3
+#define EVENT_OUTPUT 4
+#define EVENT_STATUS 5
+#define EVENT_WATCHDOG 6
+#define EVENT_WAKE 7
+
+#define EVENT_DATA(kind, slot) (((unsigned long) (kind) << 32) | (unsigned int) (slot))
+
+// Signal mask in effect before the reaper blocked SIGCHLD
+static sigset_t saved_mask;
+static int mask_saved = 0;
+
+
+static int pidfd_open(pid_t pid) {
+    #ifdef SYS_pidfd_open
+        return syscall(SYS_pidfd_open, pid, 0);
+    #else
+        errno = ENOSYS;
+        return -1;
+    #endif
+}
+
+
+static void epoll_add(reaper_t *reaper, int fd, unsigned long data) {
+    struct epoll_event event;
+    event.events = EPOLLIN;
+    event.data.u64 = data;
+    if (epoll_ctl(reaper->epoll_fd, EPOLL_CTL_ADD, fd, &event) == -1) {
+        perror("epoll_ctl");
+        exit(EXIT_FAILURE);
+    }
+}
+
+
+// Every in-flight child holds a pidfd, so allow as many fds as the hard limit permits
+static void raise_fd_limit() {
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max) {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
+}
+
+
+reaper_t *create_reaper(int num_slots) {
+    reaper_t *reaper = malloc(sizeof(reaper_t));
+    if (reaper == NULL) {
+        fprintf(stderr, "Error occured at line %d: malloc failed\n", __LINE__ - 2);
+        exit(EXIT_FAILURE);
+    }
+    reaper->num_slots = num_slots;
+    reaper->pids = malloc(num_slots * sizeof(pid_t));
+    reaper->pidfds = malloc(num_slots * sizeof(int));
+    reaper->status_fds = malloc(num_slots * sizeof(int));
+    reaper->reaped = malloc(num_slots * sizeof(reaped_child_t));
+    reaper->output_fds = malloc(num_slots * sizeof(int));
+    reaper->output = malloc(num_slots * sizeof(*reaper->output));
+    reaper->output_len = malloc(num_slots * sizeof(int));
+    reaper->cpu_usec = malloc(num_slots * sizeof(long));
+    reaper->failed = malloc(num_slots * sizeof(int));
+    if (reaper->pids == NULL || reaper->pidfds == NULL || reaper->status_fds == NULL || reaper->reaped == NULL ||
+        reaper->output_fds == NULL || reaper->output == NULL || reaper->output_len == NULL || reaper->cpu_usec == NULL ||
+        reaper->failed == NULL) {
+        fprintf(stderr, "Error occured at line %d: malloc failed\n", __LINE__ - 2);
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < num_slots; i++) {
+        reaper->pids[i] = -1;
+        reaper->pidfds[i] = -1;
+        reaper->status_fds[i] = -1;
+        reaper->output_fds[i] = -1;
+        reaper->output_len[i] = 0;
+        reaper->cpu_usec[i] = -1;
+        reaper->failed[i] = 0;
+        reaper->output[i][0] = '\0';
+    }
+    reaper->reaped_head = 0;
+    reaper->reaped_count = 0;
+
+    reaper->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (reaper->epoll_fd == -1) {
+        perror("epoll_create1");
+        exit(EXIT_FAILURE);
+    }
+
+    reaper->deadlines = create_deadline_heap(num_slots);
+    epoll_add(reaper, reaper->deadlines->timer_fd, EVENT_DATA(EVENT_TIMER, 0));
+
+    reaper->watchdog = create_watchdog(num_slots);
+    epoll_add(reaper, reaper->watchdog->timer_fd, EVENT_DATA(EVENT_WATCHDOG, 0));
+
+    // Probe for pidfd support with our own pid
+    int probe = pidfd_open(getpid());
+    if (probe != -1) {
+        close(probe);
+        reaper->use_pidfd = 1;
+        reaper->signal_fd = -1;
+        raise_fd_limit();
+        return reaper;
+    }
+
+    // Fallback: SIGCHLD must be blocked so that it is only delivered through the signalfd
+    reaper->use_pidfd = 0;
+    sigset_t mask;
+    if (sigemptyset(&mask) == -1 || sigaddset(&mask, SIGCHLD) == -1) {
+        perror("Failed to set up sig set");
+        exit(EXIT_FAILURE);
+    }
+    if (sigprocmask(SIG_BLOCK, &mask, &saved_mask) == -1) {
+        perror("sigprocmask");
+        exit(EXIT_FAILURE);
+    }
+    mask_saved = 1;
+    reaper->signal_fd = signalfd(-1, &mask, SFD_CLOEXEC | SFD_NONBLOCK);
+    if (reaper->signal_fd == -1) {
+        perror("signalfd");
+        exit(EXIT_FAILURE);
+    }
+    epoll_add(reaper, reaper->signal_fd, EVENT_DATA(EVENT_SIGNAL, 0));
+
+    return reaper;
+}
+
+
+void reaper_add(reaper_t *reaper, int slot, pid_t pid, int output_fd, int status_fd, long timeout_ms) {
+    reaper->pids[slot] = pid;
+    reaper->failed[slot] = 0;
+    deadline_add(reaper->deadlines, slot, timeout_ms);
+    watchdog_watch(reaper->watchdog, slot);
+
+    reaper->output_len[slot] = 0;
+    reaper->output[slot][0] = '\0';
+    reaper->output_fds[slot] = output_fd;
+    if (output_fd != -1) {
+        epoll_add(reaper, output_fd, EVENT_DATA(EVENT_OUTPUT, slot));
+    }
+
+    if (status_fd != -1) {
+        reaper->status_fds[slot] = status_fd;
+        epoll_add(reaper, status_fd, EVENT_DATA(EVENT_STATUS, slot));
+    } else if (reaper->use_pidfd) {
+        int pidfd = pidfd_open(pid);
+        if (pidfd == -1) {
+            perror("pidfd_open");
+            exit(EXIT_FAILURE);
+        }
+        reaper->pidfds[slot] = pidfd;
+        epoll_add(reaper, pidfd, EVENT_DATA(EVENT_PIDFD, slot));
+    }
+}
+
+
+// Read whatever the child in slot has written so far, keeping the first REAPER_OUTPUT_SIZE bytes
+static void drain_output(reaper_t *reaper, int slot) {
+    char buffer[BUFSIZ];
+    while (reaper->output_fds[slot] != -1) {
+        ssize_t bytes_read = read(reaper->output_fds[slot], buffer, sizeof(buffer));
+        if (bytes_read == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno != EAGAIN) {
+                perror("Read Failed");
+                exit(EXIT_FAILURE);
+            }
+            return;
+        }
+        if (bytes_read == 0) {
+            // EOF - closing the fd also drops it from the epoll set
+            close(reaper->output_fds[slot]);
+            reaper->output_fds[slot] = -1;
+            return;
+        }
+
+        int room = REAPER_OUTPUT_SIZE - reaper->output_len[slot];
+        int kept = bytes_read < room ? bytes_read : room;
+        memcpy(reaper->output[slot] + reaper->output_len[slot], buffer, kept);
+        reaper->output_len[slot] += kept;
+        reaper->output[slot][reaper->output_len[slot]] = '\0';
+    }
+}
+
+
+// Queue a reaped child and stop tracking its slot
+static void push_reaped(reaper_t *reaper, int slot, int status, long cpu_usec) {
+    int tail = (reaper->reaped_head + reaper->reaped_count) % reaper->num_slots;
+    reaper->reaped[tail].slot = slot;
+    reaper->reaped[tail].status = status;
+    reaper->reaped[tail].cpu_usec = cpu_usec;
+    reaper->reaped_count++;
+
+    deadline_remove(reaper->deadlines, slot);
+    watchdog_forget(reaper->watchdog, slot);
+
+    // Everything the child wrote before exiting is in the pipe by now. A grandchild may still hold
+    // the write end open, so take what is there and stop listening instead of waiting for EOF.
+    drain_output(reaper, slot);
+    if (reaper->output_fds[slot] != -1) {
+        close(reaper->output_fds[slot]);
+        reaper->output_fds[slot] = -1;
+    }
+
+    if (reaper->pidfds[slot] != -1) {
+        close(reaper->pidfds[slot]);  // Closing the fd also drops it from the epoll set
+        reaper->pidfds[slot] = -1;
+    }
+    if (reaper->status_fds[slot] != -1) {
+        close(reaper->status_fds[slot]);
+        reaper->status_fds[slot] = -1;
+    }
+    reaper->pids[slot] = -1;
+}
+
+
+// The parent of a child we cannot wait on reported its wait status
+static void read_status(reaper_t *reaper, int slot) {
+    reaper_status_t report;
+    ssize_t bytes_read;
+    do {
+        bytes_read = read(reaper->status_fds[slot], &report, sizeof(report));
+    } while (bytes_read == -1 && errno == EINTR);
+    if (bytes_read != sizeof(report)) {
+        // The parent went away without reporting; make sure the child is gone and treat it as killed
+        kill(reaper->pids[slot], SIGKILL);
+        report.status = SIGKILL;
+        report.cpu_usec = -1;
+    }
+    push_reaped(reaper, slot, report.status, report.cpu_usec);
+}
+
+
+// CPU time in a child's rusage
+static long rusage_usec(struct rusage *usage) {
+    return (usage->ru_utime.tv_sec + usage->ru_stime.tv_sec) * 1000000L + usage->ru_utime.tv_usec + usage->ru_stime.tv_usec;
+}
+
+
+static void reap_slot(reaper_t *reaper, int slot) {
+    int status;
+    struct rusage usage;
+    pid_t pid;
+    do {
+        pid = wait4(reaper->pids[slot], &status, WNOHANG, &usage);
+    } while (pid == -1 && errno == EINTR);
+    if (pid == -1) {
+        perror("waitpid");
+        exit(EXIT_FAILURE);
+    }
+    if (pid > 0) {
+        push_reaped(reaper, slot, status, rusage_usec(&usage));
+    }
+}
+
+
+// Fallback mode: one SIGCHLD may stand for several exits, so reap every tracked child that is ready.
+// Each is waited on by pid: waiting on any child would also collect processes the owner started
+// itself (a fork server, say) and leave it waiting on them forever.
+static void reap_all(reaper_t *reaper) {
+    struct signalfd_siginfo info;
+    while (read(reaper->signal_fd, &info, sizeof(info)) == sizeof(info)) {
+        // Drain pending notifications, the waitpid() calls below do the real work
+    }
+
+    for (int slot = 0; slot < reaper->num_slots; slot++) {
+        // Children whose parent reports their status are not ours to wait on
+        if (reaper->pids[slot] != -1 && reaper->status_fds[slot] == -1) {
+            reap_slot(reaper, slot);
+        }
+    }
+}
+
+
+// SIGKILL every child whose deadline has passed, letting the watchdog classify it first
+static void kill_expired(reaper_t *reaper) {
+    deadline_drain_timer(reaper->deadlines);
+
+    int slot;
+    long now = get_time_ms();
+    while ((slot = deadline_pop_expired(reaper->deadlines, now)) != -1) {
+        watchdog_expire(reaper->watchdog, slot, reaper->pids[slot]);
+
+        // The child may already be a zombie, which kill() treats as success
+        if (kill(reaper->pids[slot], SIGKILL) == -1 && errno != ESRCH) {
+            perror("Kill Failed");
+            exit(EXIT_FAILURE);
+        }
+    }
+}
+
+
+void reaper_add_failed(reaper_t *reaper, int slot, int verdict) {
+    reaper->failed[slot] = verdict;
+    reaper->output_len[slot] = 0;
+    reaper->output[slot][0] = '\0';
+    push_reaped(reaper, slot, 0, -1);
+}
+
+
+void reaper_wake_on(reaper_t *reaper, int fd) {
+    epoll_add(reaper, fd, EVENT_DATA(EVENT_WAKE, 0));
+}
+
+
+int reaper_wait(reaper_t *reaper, int *status) {
+    int woken = 0;
+    while (reaper->reaped_count == 0 && !woken) {
+        deadline_arm_timer(reaper->deadlines);
+
+        struct epoll_event events[REAPER_MAX_EVENTS];
+        int ready = epoll_wait(reaper->epoll_fd, events, REAPER_MAX_EVENTS, -1);
+        if (ready == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("epoll_wait");
+            exit(EXIT_FAILURE);
+        }
+
+        for (int i = 0; i < ready; i++) {
+            int kind = events[i].data.u64 >> 32;
+            int slot = events[i].data.u64 & 0xffffffffUL;
+            switch (kind) {
+                case EVENT_TIMER:
+                    kill_expired(reaper);
+                    break;
+                case EVENT_WATCHDOG:
+                    watchdog_sample(reaper->watchdog, reaper->pids);
+                    break;
+                case EVENT_SIGNAL:
+                    reap_all(reaper);
+                    break;
+                case EVENT_PIDFD:
+                    if (reaper->pidfds[slot] != -1) {
+                        reap_slot(reaper, slot);
+                    }
+                    break;
+                case EVENT_OUTPUT:
+                    drain_output(reaper, slot);
+                    break;
+                case EVENT_STATUS:
+                    if (reaper->status_fds[slot] != -1) {
+                        read_status(reaper, slot);
+                    }
+                    break;
+                case EVENT_WAKE:
+                    woken = 1;
+                    break;
+            }
+        }
+    }
+    if (reaper->reaped_count == 0) {
+        return -1;
+    }
+
+    reaped_child_t *child = &reaper->reaped[reaper->reaped_head];
+    reaper->reaped_head = (reaper->reaped_head + 1) % reaper->num_slots;
+    reaper->reaped_count--;
+    *status = child->status;
+    reaper->cpu_usec[child->slot] = child->cpu_usec;
+    return child->slot;
+}
+
+
+const sigset_t *reaper_child_sigmask() {
+    return mask_saved ? &saved_mask : NULL;
+}
+
+
+long reaper_cpu_usec(reaper_t *reaper, int slot) {
+    return reaper->cpu_usec[slot];
+}
+
+
+int reaper_verdict(reaper_t *reaper, int slot) {
+    if (reaper->failed[slot] != 0) {
+        return reaper->failed[slot];
+    }
+    return watchdog_verdict(reaper->watchdog, slot);
+}
+
+
+const char *reaper_output(reaper_t *reaper, int slot) {
+    return reaper->output[slot];
+}
+
+
+void free_reaper(reaper_t *reaper) {
+    for (int i = 0; i < reaper->num_slots; i++) {
+        if (reaper->pidfds[i] != -1) {
+            close(reaper->pidfds[i]);
+        }
+        if (reaper->status_fds[i] != -1) {
+            close(reaper->status_fds[i]);
+        }
+        if (reaper->output_fds[i] != -1) {
+            close(reaper->output_fds[i]);
+        }
+    }
+    if (reaper->signal_fd != -1) {
+        close(reaper->signal_fd);
+    }
+    if (mask_saved && sigprocmask(SIG_SETMASK, &saved_mask, NULL) == -1) {
+        perror("sigprocmask");
+        exit(EXIT_FAILURE);
+    }
+    mask_saved = 0;
+    close(reaper->epoll_fd);
+    free_deadline_heap(reaper->deadlines);
+    free_watchdog(reaper->watchdog);
+    free(reaper->pids);
+    free(reaper->pidfds);
+    free(reaper->status_fds);
+    free(reaper->reaped);
+    free(reaper->output_fds);
+    free(reaper->output);
+    free(reaper->output_len);
+    free(reaper->cpu_usec);
+    free(reaper->failed);
+    free(reaper);
+}
@@ -0,0 +1,201 @@
+#include "results_file.h"
+
+#include <sys/mman.h>
+
+#define ALIGN8(x) (((x) + 7) & ~(uint64_t) 7)
+
+
+// Write all of buffer, retrying short writes
+static int write_all(int fd, const void *buffer, size_t size) {
+    const char *data = buffer;
+    while (size > 0) {
+        ssize_t written = write(fd, data, size);
+        if (written == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        data += written;
+        size -= written;
+    }
+    return 0;
+}
+
+
+int write_results_binary(autograder_results_t *results, int num_executables, int total_params, const char *path) {
+    results_file_header_t header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, RESULTS_FILE_MAGIC, 4);
+    header.version = RESULTS_FILE_VERSION;
+    header.num_executables = num_executables;
+    header.num_params = total_params;
+
+    uint64_t strings_size = 0;
+    for (int i = 0; i < num_executables; i++) {
+        strings_size += strlen(get_result_name(results[i].exe_path)) + 1;
+    }
+    uint64_t status_size = (uint64_t) num_executables * total_params;
+    header.params_offset = ALIGN8(sizeof(header));
+    header.status_offset = ALIGN8(header.params_offset + total_params * sizeof(int32_t));
+    header.names_offset = ALIGN8(header.status_offset + status_size);
+    header.strings_offset = ALIGN8(header.names_offset + (num_executables + 1) * sizeof(uint32_t));
+    header.file_size = header.strings_offset + strings_size;
+
+    // Build the whole file in memory and write it in one go
+    char *buffer = calloc(1, header.file_size);
+    if (buffer == NULL) {
+        fprintf(stderr, "Error occured at line %d: calloc failed\n", __LINE__ - 2);
+        exit(EXIT_FAILURE);
+    }
+    memcpy(buffer, &header, sizeof(header));
+
+    int32_t *params = (int32_t *) (buffer + header.params_offset);
+    for (int j = 0; j < total_params; j++) {
+        params[j] = num_executables > 0 ? results[0].params_tested[j] : 0;
+    }
+
+    uint8_t *status = (uint8_t *) (buffer + header.status_offset);
+    uint32_t *name_offsets = (uint32_t *) (buffer + header.names_offset);
+    char *strings = buffer + header.strings_offset;
+    uint32_t offset = 0;
+    for (int i = 0; i < num_executables; i++) {
+        memcpy(status + (uint64_t) i * total_params, results[i].status, total_params);
+        char *name = get_result_name(results[i].exe_path);
+        int len = strlen(name) + 1;
+        name_offsets[i] = offset;
+        memcpy(strings + offset, name, len);
+        offset += len;
+    }
+    name_offsets[num_executables] = offset;
+
+    // Write to a temporary file and rename it, so readers never map a half-written file
+    char tmp_path[PATH_MAX];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+    int fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd == -1) {
+        perror("Failed to open file");
+        free(buffer);
+        return -1;
+    }
+    int failed = write_all(fd, buffer, header.file_size);
+    if (close(fd) == -1) {
+        failed = -1;
+    }
+    free(buffer);
+    if (failed == -1 || rename(tmp_path, path) == -1) {
+        perror("Failed to write results file");
+        unlink(tmp_path);
+        return -1;
+    }
+    return 0;
+}
+
+
+results_file_t *open_results_file(const char *path) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        perror(path);
+        return NULL;
+    }
+    struct stat st;
+    if (fstat(fd, &st) == -1) {
+        perror("fstat");
+        close(fd);
+        return NULL;
+    }
+    if ((size_t) st.st_size < sizeof(results_file_header_t)) {
+        fprintf(stderr, "%s: not a results file\n", path);
+        close(fd);
+        return NULL;
+    }
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        perror("mmap");
+        return NULL;
+    }
+
+    const results_file_header_t *header = map;
+    uint64_t status_size = (uint64_t) header->num_executables * header->num_params;
+    if (memcmp(header->magic, RESULTS_FILE_MAGIC, 4) != 0 || header->version != RESULTS_FILE_VERSION ||
+        header->file_size != (uint64_t) st.st_size ||
+        header->params_offset + header->num_params * sizeof(int32_t) > header->status_offset ||
+        header->status_offset + status_size > header->names_offset ||
+        header->names_offset + (header->num_executables + 1) * sizeof(uint32_t) > header->strings_offset ||
+        header->strings_offset > header->file_size) {
+        fprintf(stderr, "%s: not a results file (or an unsupported version)\n", path);
+        munmap(map, st.st_size);
+        return NULL;
+    }
+
+    results_file_t *file = malloc(sizeof(results_file_t));
+    if (file == NULL) {
+        fprintf(stderr, "Error occured at line %d: malloc failed\n", __LINE__ - 2);
+        exit(EXIT_FAILURE);
+    }
+    file->map = map;
+    file->size = st.st_size;
+    file->header = header;
+    file->params = (const int32_t *) ((const char *) map + header->params_offset);
+    file->status = (const uint8_t *) map + header->status_offset;
+    file->name_offsets = (const uint32_t *) ((const char *) map + header->names_offset);
+    file->strings = (const char *) map + header->strings_offset;
+
+    // The last name has to end inside the file, and every name has to end (with its null terminator)
+    // where the next one starts, so results_file_name() never reads past the string table
+    uint64_t strings_size = header->file_size - header->strings_offset;
+    if (file->name_offsets[header->num_executables] > strings_size) {
+        fprintf(stderr, "%s: truncated string table\n", path);
+        close_results_file(file);
+        return NULL;
+    }
+    for (uint32_t i = 0; i < header->num_executables; i++) {
+        uint32_t start = file->name_offsets[i];
+        uint32_t end = file->name_offsets[i + 1];
+        if (start >= end || file->strings[end - 1] != '\0') {
+            fprintf(stderr, "%s: malformed string table (name %u)\n", path, i);
+            close_results_file(file);
+            return NULL;
+        }
+    }
+    return file;
+}
+
+
+const char *results_file_name(results_file_t *file, int i) {
+    return file->strings + file->name_offsets[i];
+}
+
+
+const uint8_t *results_file_row(results_file_t *file, int i) {
+    return file->status + (uint64_t) i * file->header->num_params;
+}
+
+
+int export_results_text(results_file_t *file, const char *path) {
+    results_rows_t rows;
+    rows.num_rows = file->header->num_executables;
+    rows.num_params = file->header->num_params;
+    rows.params = file->params;
+    rows.status_rows = NULL;
+    rows.byte_rows = file->status;
+    rows.names = malloc(rows.num_rows * sizeof(char *));
+    if (rows.names == NULL && rows.num_rows > 0) {
+        fprintf(stderr, "Error occured at line %d: malloc failed\n", __LINE__ - 2);
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < rows.num_rows; i++) {
+        rows.names[i] = results_file_name(file, i);
+    }
+
+    int failed = write_results_rows(&rows, path);
+    free(rows.names);
+    return failed;
+}
+
+
+void close_results_file(results_file_t *file) {
+    munmap(file->map, file->size);
+    free(file);
+}
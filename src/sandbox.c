@@ -0,0 +1,237 @@
+#include "utils.h"
+#include "sandbox.h"
+
+#include <sys/vfs.h>
+#include <linux/magic.h>
+
+
+// Write value to the control file name in the cgroup directory dir_fd. Returns -1 (errno set) on failure.
+static int write_control(int dir_fd, const char *name, const char *value) {
+    int fd = openat(dir_fd, name, O_WRONLY | O_CLOEXEC);
+    if (fd == -1) {
+        return -1;
+    }
+    ssize_t written = write(fd, value, strlen(value));
+    int saved_errno = errno;
+    close(fd);
+    errno = saved_errno;
+    return written == -1 ? -1 : 0;
+}
+
+
+// Read the control file name in dir_fd into buffer. Returns -1 if it cannot be read.
+static int read_control(int dir_fd, const char *name, char *buffer, int size) {
+    int fd = openat(dir_fd, name, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        return -1;
+    }
+    ssize_t bytes_read = read(fd, buffer, size - 1);
+    close(fd);
+    if (bytes_read < 0) {
+        return -1;
+    }
+    buffer[bytes_read] = '\0';
+    return 0;
+}
+
+
+sandbox_t *create_sandbox(const char *delegated_root, int num_slots) {
+    struct statfs fs;
+    if (statfs(delegated_root, &fs) == -1 || fs.f_type != CGROUP2_SUPER_MAGIC) {
+        fprintf(stderr, "%s is not a cgroup v2 directory, running without the sandbox\n", delegated_root);
+        return NULL;
+    }
+
+    sandbox_t *sandbox = malloc(sizeof(sandbox_t));
+    if (sandbox == NULL) {
+        fprintf(stderr, "Error occured at line %d: malloc failed\n", __LINE__ - 2);
+        exit(EXIT_FAILURE);
+    }
+
+    snprintf(sandbox->run_path, PATH_MAX, "%s/autograder.%d", delegated_root, getpid());
+    if (mkdir(sandbox->run_path, 0755) == -1) {
+        fprintf(stderr, "Cannot create %s (%s), running without the sandbox\n", sandbox->run_path, strerror(errno));
+        free(sandbox);
+        return NULL;
+    }
+    sandbox->run_fd = open(sandbox->run_path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (sandbox->run_fd == -1) {
+        perror("open");
+        exit(EXIT_FAILURE);
+    }
+
+    // The controllers have to be enabled on every level down to the leaves. The delegated root may
+    // already have them (or not be ours to change), so only the run directory decides.
+    int root_fd = open(delegated_root, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (root_fd != -1) {
+        write_control(root_fd, "cgroup.subtree_control", SANDBOX_CONTROLLERS);
+        close(root_fd);
+    }
+    sandbox->has_limits = write_control(sandbox->run_fd, "cgroup.subtree_control", SANDBOX_CONTROLLERS) == 0;
+    if (!sandbox->has_limits) {
+        fprintf(stderr, "cpu/memory/pids controllers unavailable under %s (%s), pairs run without limits\n",
+                delegated_root, strerror(errno));
+    }
+
+    // Every non-root cgroup has cgroup.kill on kernels that support it, the run directory included
+    sandbox->has_kill = faccessat(sandbox->run_fd, "cgroup.kill", W_OK, 0) == 0;
+    if (!sandbox->has_kill) {
+        fprintf(stderr, "No cgroup.kill under %s, leftover processes are killed through cgroup.procs\n", delegated_root);
+    }
+
+    sandbox->num_slots = num_slots;
+    sandbox->leaf_fds = malloc(num_slots * sizeof(int));
+    sandbox->leaf_names = malloc(num_slots * sizeof(*sandbox->leaf_names));
+    if (sandbox->leaf_fds == NULL || sandbox->leaf_names == NULL) {
+        fprintf(stderr, "Error occured at line %d: malloc failed\n", __LINE__ - 2);
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < num_slots; i++) {
+        sandbox->leaf_fds[i] = -1;
+    }
+    sandbox->next_leaf = 0;
+    sandbox->stale = NULL;
+    sandbox->num_stale = 0;
+    sandbox->capacity_stale = 0;
+
+    return sandbox;
+}
+
+
+int sandbox_prepare(sandbox_t *sandbox, int slot) {
+    char *name = sandbox->leaf_names[slot];
+    snprintf(name, sizeof(sandbox->leaf_names[slot]), "pair%lu", sandbox->next_leaf++);
+    if (mkdirat(sandbox->run_fd, name, 0755) == -1) {
+        perror("mkdirat");
+        exit(EXIT_FAILURE);
+    }
+    int leaf_fd = openat(sandbox->run_fd, name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (leaf_fd == -1) {
+        perror("openat");
+        exit(EXIT_FAILURE);
+    }
+
+    if (sandbox->has_limits) {
+        if (write_control(leaf_fd, "cpu.max", SANDBOX_CPU_MAX) == -1 ||
+            write_control(leaf_fd, "memory.max", SANDBOX_MEMORY_MAX) == -1 ||
+            write_control(leaf_fd, "pids.max", SANDBOX_PIDS_MAX) == -1) {
+            perror("Failed to set cgroup limits");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    sandbox->leaf_fds[slot] = leaf_fd;
+    return leaf_fd;
+}
+
+
+// SIGKILL every process listed in the leaf's cgroup.procs, reading it again while it had any
+static void kill_procs(int leaf_fd) {
+    for (int round = 0; round < SANDBOX_KILL_ROUNDS; round++) {
+        int fd = openat(leaf_fd, "cgroup.procs", O_RDONLY | O_CLOEXEC);
+        FILE *procs = fd != -1 ? fdopen(fd, "r") : NULL;
+        if (procs == NULL) {
+            perror("Failed to read cgroup.procs");
+            if (fd != -1) {
+                close(fd);
+            }
+            return;
+        }
+        int found = 0;
+        int pid;
+        while (fscanf(procs, "%d", &pid) == 1) {
+            kill(pid, SIGKILL);
+            found = 1;
+        }
+        fclose(procs);
+        if (!found) {
+            return;
+        }
+    }
+}
+
+
+// Kill every process still in the leaf, grandchildren included
+static void kill_leaf(sandbox_t *sandbox, int leaf_fd) {
+    if (sandbox->has_kill) {
+        if (write_control(leaf_fd, "cgroup.kill", "1") == 0) {
+            return;
+        }
+        perror("Failed to write cgroup.kill");
+    }
+    kill_procs(leaf_fd);
+}
+
+
+void sandbox_release(sandbox_t *sandbox, int slot, long *cpu_usec, long *memory_peak) {
+    int leaf_fd = sandbox->leaf_fds[slot];
+    char buffer[1024];
+
+    kill_leaf(sandbox, leaf_fd);
+
+    *cpu_usec = -1;
+    if (read_control(leaf_fd, "cpu.stat", buffer, sizeof(buffer)) == 0) {
+        char *usage = strstr(buffer, "usage_usec ");
+        if (usage != NULL) {
+            *cpu_usec = atol(usage + strlen("usage_usec "));
+        }
+    }
+    *memory_peak = -1;
+    if (read_control(leaf_fd, "memory.peak", buffer, sizeof(buffer)) == 0) {
+        *memory_peak = atol(buffer);
+    }
+
+    close(leaf_fd);
+    sandbox->leaf_fds[slot] = -1;
+
+    // Killed processes leave the cgroup asynchronously; if some are still on their way out, try again at the end
+    if (unlinkat(sandbox->run_fd, sandbox->leaf_names[slot], AT_REMOVEDIR) == -1) {
+        if (errno != EBUSY) {
+            perror("Failed to remove cgroup");
+            return;
+        }
+        if (sandbox->num_stale == sandbox->capacity_stale) {
+            sandbox->capacity_stale = sandbox->capacity_stale == 0 ? 16 : sandbox->capacity_stale * 2;
+            sandbox->stale = realloc(sandbox->stale, sandbox->capacity_stale * sizeof(*sandbox->stale));
+            if (sandbox->stale == NULL) {
+                fprintf(stderr, "Error occured at line %d: realloc failed\n", __LINE__ - 2);
+                exit(EXIT_FAILURE);
+            }
+        }
+        strcpy(sandbox->stale[sandbox->num_stale++], sandbox->leaf_names[slot]);
+    }
+}
+
+
+// Remove a leaf, waiting for its killed processes to finish leaving it
+static void remove_leaf(sandbox_t *sandbox, const char *name) {
+    for (int i = 0; i < SANDBOX_RMDIR_RETRIES; i++) {
+        if (unlinkat(sandbox->run_fd, name, AT_REMOVEDIR) == 0 || errno != EBUSY) {
+            return;
+        }
+        usleep(10000);
+    }
+    fprintf(stderr, "Could not remove cgroup %s/%s\n", sandbox->run_path, name);
+}
+
+
+void free_sandbox(sandbox_t *sandbox) {
+    for (int i = 0; i < sandbox->num_slots; i++) {
+        if (sandbox->leaf_fds[i] != -1) {
+            kill_leaf(sandbox, sandbox->leaf_fds[i]);
+            close(sandbox->leaf_fds[i]);
+            remove_leaf(sandbox, sandbox->leaf_names[i]);
+        }
+    }
+    for (int i = 0; i < sandbox->num_stale; i++) {
+        remove_leaf(sandbox, sandbox->stale[i]);
+    }
+    close(sandbox->run_fd);
+    if (rmdir(sandbox->run_path) == -1) {
+        fprintf(stderr, "Could not remove cgroup %s: %s\n", sandbox->run_path, strerror(errno));
+    }
+    free(sandbox->leaf_fds);
+    free(sandbox->leaf_names);
+    free(sandbox->stale);
+    free(sandbox);
+}
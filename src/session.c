@@ -0,0 +1,446 @@
+#include "utils.h"
+#include "session.h"
+#include "launcher.h"
+
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+
+// Kind of fd an epoll event belongs to (upper 32 bits of epoll_data.u64, the slot is in the lower ones)
+#define EVENT_TIMER 1
+#define EVENT_WATCHDOG 2
+#define EVENT_PIDFD 3
+#define EVENT_SOCKET 4
+#define EVENT_OUTPUT 5
+#define EVENT_WAKE 6
+
+#define EVENT_DATA(kind, slot) (((unsigned long) (kind) << 32) | (unsigned int) (slot))
+
+
+static int pidfd_open(pid_t pid) {
+    #ifdef SYS_pidfd_open
+        return syscall(SYS_pidfd_open, pid, 0);
+    #else
+        errno = ENOSYS;
+        return -1;
+    #endif
+}
+
+
+static void epoll_add(session_pool_t *sessions, int fd, unsigned long data) {
+    struct epoll_event event;
+    event.events = EPOLLIN;
+    event.data.u64 = data;
+    if (epoll_ctl(sessions->epoll_fd, EPOLL_CTL_ADD, fd, &event) == -1) {
+        perror("epoll_ctl");
+        exit(EXIT_FAILURE);
+    }
+}
+
+
+session_pool_t *create_session_pool(int num_slots) {
+    session_pool_t *sessions = malloc(sizeof(session_pool_t));
+    if (sessions == NULL) {
+        fprintf(stderr, "Error occured at line %d: malloc failed\n", __LINE__ - 2);
+        exit(EXIT_FAILURE);
+    }
+    sessions->num_slots = num_slots;
+    sessions->exe_paths = malloc(num_slots * sizeof(char *));
+    sessions->pids = malloc(num_slots * sizeof(pid_t));
+    sessions->pidfds = malloc(num_slots * sizeof(int));
+    sessions->sockets = malloc(num_slots * sizeof(int));
+    sessions->output_fds = malloc(num_slots * sizeof(int));
+    sessions->pending = malloc(num_slots * sizeof(int));
+    sessions->sent_ms = malloc(num_slots * sizeof(long));
+    sessions->answers = malloc(num_slots * sizeof(session_answer_t));
+    if (sessions->exe_paths == NULL || sessions->pids == NULL || sessions->pidfds == NULL || sessions->sockets == NULL ||
+        sessions->output_fds == NULL || sessions->pending == NULL || sessions->sent_ms == NULL || sessions->answers == NULL) {
+        fprintf(stderr, "Error occured at line %d: malloc failed\n", __LINE__ - 2);
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < num_slots; i++) {
+        sessions->exe_paths[i] = NULL;
+        sessions->pids[i] = -1;
+        sessions->pidfds[i] = -1;
+        sessions->sockets[i] = -1;
+        sessions->output_fds[i] = -1;
+        sessions->pending[i] = 0;
+        sessions->sent_ms[i] = 0;
+    }
+    sessions->answers_head = 0;
+    sessions->answers_count = 0;
+
+    // A session process outlives many parameters, so it is only ever waited for through its pidfd
+    int probe = pidfd_open(getpid());
+    if (probe == -1) {
+        perror("Sessions need pidfd_open");
+        exit(EXIT_FAILURE);
+    }
+    close(probe);
+
+    sessions->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (sessions->epoll_fd == -1) {
+        perror("epoll_create1");
+        exit(EXIT_FAILURE);
+    }
+
+    sessions->deadlines = create_deadline_heap(num_slots);
+    epoll_add(sessions, sessions->deadlines->timer_fd, EVENT_DATA(EVENT_TIMER, 0));
+
+    sessions->watchdog = create_watchdog(num_slots);
+    epoll_add(sessions, sessions->watchdog->timer_fd, EVENT_DATA(EVENT_WATCHDOG, 0));
+
+    return sessions;
+}
+
+
+void session_open(session_pool_t *sessions, int slot, char *exe_path) {
+    sessions->exe_paths[slot] = exe_path;
+}
+
+
+int session_alive(session_pool_t *sessions, int slot) {
+    return sessions->pids[slot] != -1;
+}
+
+
+// Start the process of the session in slot with its end of a fresh socket as argv[1]. Returns -1
+// if the executable cannot be started.
+static int launch(session_pool_t *sessions, int slot) {
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, fds) == -1) {
+        fprintf(stderr, "Error occured at line %d: socketpair failed\n", __LINE__ - 1);
+        exit(EXIT_FAILURE);
+    }
+    // Only the student's end crosses exec(); it is closed here right after the spawn, so no other
+    // process inherits it. Ours is non-blocking so draining it never stalls.
+    if (fcntl(fds[1], F_SETFD, 0) == -1 || fcntl(fds[0], F_SETFL, O_NONBLOCK) == -1) {
+        fprintf(stderr, "Error occured at line %d: fcntl failed\n", __LINE__ - 1);
+        exit(EXIT_FAILURE);
+    }
+
+    // Launched like an EXEC-mode pair whose parameter is the socket
+    char fd_string[MAX_INT_CHARS + 1];
+    snprintf(fd_string, sizeof(fd_string), "%d", fds[1]);
+    spawn_plan_t plan;
+    init_spawn_plan(&plan, sessions->exe_paths[slot], fd_string, INPUT_EXEC, -1);
+    pid_t pid = spawn_solution(&plan, NULL);
+    if (close(fds[1]) == -1) {
+        fprintf(stderr, "Error occured at line %d: close failed\n", __LINE__ - 1);
+        exit(EXIT_FAILURE);
+    }
+    if (pid == -1) {
+        close(fds[0]);
+        return -1;
+    }
+
+    int pidfd = pidfd_open(pid);
+    if (pidfd == -1) {
+        perror("pidfd_open");
+        exit(EXIT_FAILURE);
+    }
+    sessions->pids[slot] = pid;
+    sessions->pidfds[slot] = pidfd;
+    sessions->sockets[slot] = fds[0];
+    sessions->output_fds[slot] = plan.output_fd;
+    epoll_add(sessions, pidfd, EVENT_DATA(EVENT_PIDFD, slot));
+    epoll_add(sessions, fds[0], EVENT_DATA(EVENT_SOCKET, slot));
+    epoll_add(sessions, plan.output_fd, EVENT_DATA(EVENT_OUTPUT, slot));
+    return 0;
+}
+
+
+// Send message to the process of slot. Returns -1 if it has closed its end of the socket.
+static int send_message(session_pool_t *sessions, int slot, const char *message) {
+    if (sessions->sockets[slot] == -1) {
+        return -1;
+    }
+    if (send(sessions->sockets[slot], message, strlen(message), MSG_DONTWAIT | MSG_NOSIGNAL) == -1) {
+        if (errno != EPIPE && errno != ECONNRESET) {
+            perror("send");
+            exit(EXIT_FAILURE);
+        }
+        return -1;
+    }
+    return 0;
+}
+
+
+// Forget the (reaped) process of slot; the session's next parameter starts a new one
+static void release_process(session_pool_t *sessions, int slot) {
+    if (sessions->sockets[slot] != -1) {
+        close(sessions->sockets[slot]);
+        sessions->sockets[slot] = -1;
+    }
+    if (sessions->output_fds[slot] != -1) {
+        close(sessions->output_fds[slot]);
+        sessions->output_fds[slot] = -1;
+    }
+    close(sessions->pidfds[slot]);   // Closing the fd also drops it from the epoll set
+    sessions->pidfds[slot] = -1;
+    sessions->pids[slot] = -1;
+}
+
+
+// Stop the process of slot: if it still listens, send it SESSION_END and give it SESSION_END_MS to
+// exit on its own. Then kill and reap it.
+static void end_process(session_pool_t *sessions, int slot) {
+    if (send_message(sessions, slot, SESSION_END) == 0) {
+        struct pollfd exited = { sessions->pidfds[slot], POLLIN, 0 };
+        while (poll(&exited, 1, SESSION_END_MS) == -1 && errno == EINTR) {
+        }
+    }
+    if (kill(sessions->pids[slot], SIGKILL) == -1 && errno != ESRCH) {
+        perror("Kill Failed");
+        exit(EXIT_FAILURE);
+    }
+    while (waitpid(sessions->pids[slot], NULL, 0) == -1) {
+        if (errno != EINTR) {
+            perror("waitpid");
+            exit(EXIT_FAILURE);
+        }
+    }
+    release_process(sessions, slot);
+}
+
+
+// Queue the verdict of the pending parameter in slot
+static void push_answer(session_pool_t *sessions, int slot, int status) {
+    int tail = (sessions->answers_head + sessions->answers_count) % sessions->num_slots;
+    sessions->answers[tail].slot = slot;
+    sessions->answers[tail].status = status;
+    sessions->answers[tail].duration_ms = get_time_ms() - sessions->sent_ms[slot];
+    sessions->answers_count++;
+
+    sessions->pending[slot] = 0;
+    deadline_remove(sessions->deadlines, slot);
+    watchdog_forget(sessions->watchdog, slot);
+}
+
+
+void session_ask(session_pool_t *sessions, int slot, int param, long timeout_ms) {
+    char message[SESSION_MESSAGE_SIZE];
+    snprintf(message, sizeof(message), "%d", param);
+
+    // Starting the process counts towards the parameter that needs it
+    sessions->sent_ms[slot] = get_time_ms();
+    int started = sessions->pids[slot] != -1 || launch(sessions, slot) == 0;
+
+    // A process that has closed its end of the socket can take no more parameters, so it is replaced.
+    // One that closes it again before hearing anything is left to its exit or the deadline.
+    if (started && send_message(sessions, slot, message) == -1) {
+        end_process(sessions, slot);
+        started = launch(sessions, slot) == 0;
+        if (started) {
+            send_message(sessions, slot, message);
+        }
+    }
+
+    // An executable that cannot be started answers nothing
+    if (!started) {
+        push_answer(sessions, slot, INCORRECT);
+        return;
+    }
+    sessions->pending[slot] = 1;
+    deadline_add(sessions->deadlines, slot, timeout_ms);
+    watchdog_rewatch(sessions->watchdog, slot, sessions->pids[slot]);
+}
+
+
+// Verdict for an answer: exactly "0" is correct, "1" and anything else (garbage, "00", "0 ") is not
+static int answer_verdict(const char *message) {
+    return strcmp(message, "0") == 0 ? CORRECT : INCORRECT;
+}
+
+
+// Read the answers the process in slot has sent. Anything it sends without being asked is dropped.
+static void read_answers(session_pool_t *sessions, int slot) {
+    char message[SESSION_MESSAGE_SIZE + 1];   // +1 for the null terminator
+    while (sessions->sockets[slot] != -1) {
+        ssize_t length = recv(sessions->sockets[slot], message, SESSION_MESSAGE_SIZE, MSG_DONTWAIT);
+        if (length == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN) {
+                return;
+            }
+            if (errno != ECONNRESET) {
+                perror("recv");
+                exit(EXIT_FAILURE);
+            }
+            length = 0;   // a reset is the same as closing its end
+        }
+        if (length == 0) {
+            // The process closed its end - closing ours also drops it from the epoll set
+            close(sessions->sockets[slot]);
+            sessions->sockets[slot] = -1;
+            return;
+        }
+        message[length] = '\0';
+        if (sessions->pending[slot]) {
+            push_answer(sessions, slot, answer_verdict(message));
+        }
+    }
+}
+
+
+// Throw away whatever the process in slot wrote to stdout, so it never blocks on a full pipe
+static void drain_output(session_pool_t *sessions, int slot) {
+    char buffer[BUFSIZ];
+    while (sessions->output_fds[slot] != -1) {
+        ssize_t bytes_read = read(sessions->output_fds[slot], buffer, sizeof(buffer));
+        if (bytes_read == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno != EAGAIN) {
+                perror("Read Failed");
+                exit(EXIT_FAILURE);
+            }
+            return;
+        }
+        if (bytes_read == 0) {
+            close(sessions->output_fds[slot]);
+            sessions->output_fds[slot] = -1;
+            return;
+        }
+    }
+}
+
+
+// The process of slot exited. An answer it sent just before still counts. Otherwise the pending
+// parameter is a crash or timeout if a signal ended the process, and INCORRECT if it exited on its
+// own without answering.
+static void reap_slot(session_pool_t *sessions, int slot) {
+    int status;
+    pid_t pid;
+    do {
+        pid = waitpid(sessions->pids[slot], &status, WNOHANG);
+    } while (pid == -1 && errno == EINTR);
+    if (pid == -1) {
+        perror("waitpid");
+        exit(EXIT_FAILURE);
+    }
+    if (pid == 0) {
+        return;
+    }
+
+    read_answers(sessions, slot);
+    drain_output(sessions, slot);
+    release_process(sessions, slot);
+    if (sessions->pending[slot]) {
+        // A process the watchdog killed would otherwise read as a timeout
+        int verdict = watchdog_verdict(sessions->watchdog, slot);
+        if (verdict == 0) {
+            verdict = WIFSIGNALED(status) ? get_verdict(status, "") : INCORRECT;
+        }
+        push_answer(sessions, slot, verdict);
+    }
+}
+
+
+// SIGKILL every process whose parameter is out of time, letting the watchdog classify it first
+static void kill_expired(session_pool_t *sessions) {
+    deadline_drain_timer(sessions->deadlines);
+
+    int slot;
+    long now = get_time_ms();
+    while ((slot = deadline_pop_expired(sessions->deadlines, now)) != -1) {
+        watchdog_expire(sessions->watchdog, slot, sessions->pids[slot]);
+
+        // The process may already be a zombie, which kill() treats as success
+        if (kill(sessions->pids[slot], SIGKILL) == -1 && errno != ESRCH) {
+            perror("Kill Failed");
+            exit(EXIT_FAILURE);
+        }
+    }
+}
+
+
+void session_wake_on(session_pool_t *sessions, int fd) {
+    epoll_add(sessions, fd, EVENT_DATA(EVENT_WAKE, 0));
+}
+
+
+int session_wait(session_pool_t *sessions, int *status, long *duration_ms) {
+    int woken = 0;
+    while (sessions->answers_count == 0 && !woken) {
+        deadline_arm_timer(sessions->deadlines);
+
+        struct epoll_event events[SESSION_MAX_EVENTS];
+        int ready = epoll_wait(sessions->epoll_fd, events, SESSION_MAX_EVENTS, -1);
+        if (ready == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("epoll_wait");
+            exit(EXIT_FAILURE);
+        }
+
+        for (int i = 0; i < ready; i++) {
+            int kind = events[i].data.u64 >> 32;
+            int slot = events[i].data.u64 & 0xffffffffUL;
+            switch (kind) {
+                case EVENT_TIMER:
+                    kill_expired(sessions);
+                    break;
+                case EVENT_WATCHDOG:
+                    watchdog_sample(sessions->watchdog, sessions->pids);
+                    break;
+                case EVENT_PIDFD:
+                    if (sessions->pidfds[slot] != -1) {
+                        reap_slot(sessions, slot);
+                    }
+                    break;
+                case EVENT_SOCKET:
+                    read_answers(sessions, slot);
+                    break;
+                case EVENT_OUTPUT:
+                    drain_output(sessions, slot);
+                    break;
+                case EVENT_WAKE:
+                    woken = 1;
+                    break;
+            }
+        }
+    }
+    if (sessions->answers_count == 0) {
+        return -1;
+    }
+
+    session_answer_t *answer = &sessions->answers[sessions->answers_head];
+    sessions->answers_head = (sessions->answers_head + 1) % sessions->num_slots;
+    sessions->answers_count--;
+    *status = answer->status;
+    *duration_ms = answer->duration_ms;
+    return answer->slot;
+}
+
+
+void session_close(session_pool_t *sessions, int slot) {
+    sessions->exe_paths[slot] = NULL;
+    if (sessions->pids[slot] != -1) {
+        end_process(sessions, slot);
+    }
+}
+
+
+void free_session_pool(session_pool_t *sessions) {
+    for (int i = 0; i < sessions->num_slots; i++) {
+        session_close(sessions, i);
+    }
+    close(sessions->epoll_fd);
+    free_deadline_heap(sessions->deadlines);
+    free_watchdog(sessions->watchdog);
+    free(sessions->exe_paths);
+    free(sessions->pids);
+    free(sessions->pidfds);
+    free(sessions->sockets);
+    free(sessions->output_fds);
+    free(sessions->pending);
+    free(sessions->sent_ms);
+    free(sessions->answers);
+    free(sessions);
+}
@@ -0,0 +1,185 @@
+#define _GNU_SOURCE  // For memfd_create()
+#include "utils.h"
+#include "shmring.h"
+
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#define SHM_RING_MASK (SHM_RING_SIZE - 1)
+
+
+// Bytes a record with length bytes of payload takes in the ring
+static uint32_t record_size(uint32_t length) {
+    return sizeof(shm_record_t) + ((length + SHM_RECORD_ALIGN - 1) & ~(uint32_t) (SHM_RECORD_ALIGN - 1));
+}
+
+
+static size_t channels_size(int num_workers) {
+    return sizeof(shm_channels_t) + num_workers * sizeof(shm_channel_t);
+}
+
+
+shm_channels_t *create_shm_channels(int num_workers, int num_pairs, size_t paths_size, int *fd) {
+    // Not close-on-exec: the workers find the region through this fd
+    *fd = memfd_create("mq_channels", 0);
+    if (*fd == -1) {
+        perror("memfd_create");
+        exit(EXIT_FAILURE);
+    }
+    size_t size = channels_size(num_workers) + num_pairs * sizeof(shm_pair_t) + paths_size;
+    if (ftruncate(*fd, size) == -1) {
+        perror("ftruncate");
+        exit(EXIT_FAILURE);
+    }
+    shm_channels_t *channels = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, *fd, 0);
+    if (channels == MAP_FAILED) {
+        perror("mmap");
+        exit(EXIT_FAILURE);
+    }
+
+    // ftruncate() zero-filled everything else: every ring starts empty and nobody sleeps
+    channels->magic = SHM_MAGIC;
+    channels->version = SHM_VERSION;
+    channels->num_workers = num_workers;
+    channels->num_pairs = num_pairs;
+    channels->size = size;
+    channels->pairs_offset = channels_size(num_workers);
+    return channels;
+}
+
+
+shm_channels_t *attach_shm_channels(int fd) {
+    struct stat st;
+    if (fstat(fd, &st) == -1) {
+        perror("fstat");
+        exit(EXIT_FAILURE);
+    }
+    shm_channels_t *channels = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (channels == MAP_FAILED) {
+        perror("mmap");
+        exit(EXIT_FAILURE);
+    }
+    // The mapping outlives the fd, and the fd must not leak into the children we launch
+    close(fd);
+
+    if ((size_t) st.st_size < sizeof(shm_channels_t) || channels->magic != SHM_MAGIC || channels->version != SHM_VERSION
+            || (uint64_t) st.st_size != channels->size
+            || channels->pairs_offset + (uint64_t) channels->num_pairs * sizeof(shm_pair_t) > channels->size) {
+        fprintf(stderr, "Shared channels do not match this build\n");
+        exit(EXIT_FAILURE);
+    }
+    return channels;
+}
+
+
+void free_shm_channels(shm_channels_t *channels) {
+    munmap(channels, channels->size);
+}
+
+
+shm_pair_t *shm_pairs(shm_channels_t *channels) {
+    return (shm_pair_t *) ((char *) channels + channels->pairs_offset);
+}
+
+
+char *shm_paths(shm_channels_t *channels) {
+    return (char *) (shm_pairs(channels) + channels->num_pairs);
+}
+
+
+int shm_claim_pair(shm_channels_t *channels) {
+    // The queue was written before any worker started, so claiming only needs to be atomic
+    uint32_t idx = __atomic_fetch_add(&channels->next_pair, 1, __ATOMIC_RELAXED);
+    return idx < channels->num_pairs ? (int) idx : -1;
+}
+
+
+int shm_claim_run(shm_channels_t *channels, uint32_t count) {
+    uint32_t idx = __atomic_fetch_add(&channels->next_pair, count, __ATOMIC_RELAXED);
+    return idx < channels->num_pairs ? (int) idx : -1;
+}
+
+
+int shm_ring_try_send(shm_ring_t *ring, shm_waiter_t *peer, uint32_t type, const void *payload, uint32_t length) {
+    uint32_t size = record_size(length);
+    uint32_t head = ring->head;   // only we store it
+    uint32_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+
+    // A record never wraps: if it does not fit before the end, a pad record fills the rest
+    uint32_t offset = head & SHM_RING_MASK;
+    uint32_t to_end = SHM_RING_SIZE - offset;
+    uint32_t pad = to_end < size ? to_end : 0;
+    if (SHM_RING_SIZE - (head - tail) < pad + size) {
+        return -1;
+    }
+    if (pad > 0) {
+        shm_record_t *filler = (shm_record_t *) (ring->data + offset);
+        filler->type = SHM_RECORD_PAD;
+        filler->length = pad - sizeof(shm_record_t);
+        head += pad;
+        offset = 0;
+    }
+
+    shm_record_t *record = (shm_record_t *) (ring->data + offset);
+    record->type = type;
+    record->length = length;
+    memcpy(record + 1, payload, length);
+    __atomic_store_n(&ring->head, head + size, __ATOMIC_RELEASE);
+    shm_wake(peer);
+    return 0;
+}
+
+
+const char *shm_ring_peek(shm_ring_t *ring, uint32_t *type, uint32_t *length) {
+    uint32_t tail = ring->tail;   // only we store it
+    uint32_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    while (tail != head) {
+        const shm_record_t *record = (const shm_record_t *) (ring->data + (tail & SHM_RING_MASK));
+        if (record->type != SHM_RECORD_PAD) {
+            *type = record->type;
+            *length = record->length;
+            return (const char *) (record + 1);
+        }
+        tail += record_size(record->length);
+        __atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+    }
+    return NULL;
+}
+
+
+void shm_ring_consume(shm_ring_t *ring, shm_waiter_t *peer) {
+    const shm_record_t *record = (const shm_record_t *) (ring->data + (ring->tail & SHM_RING_MASK));
+    __atomic_store_n(&ring->tail, ring->tail + record_size(record->length), __ATOMIC_RELEASE);
+    shm_wake(peer);
+}
+
+
+uint32_t shm_prepare_wait(shm_waiter_t *self) {
+    __atomic_store_n(&self->sleeping, 1, __ATOMIC_RELAXED);
+    // Pairs with the fence in shm_wake(): either the waker sees us sleeping, or our re-check sees its record
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    return __atomic_load_n(&self->seq, __ATOMIC_ACQUIRE);
+}
+
+
+void shm_cancel_wait(shm_waiter_t *self) {
+    __atomic_store_n(&self->sleeping, 0, __ATOMIC_RELAXED);
+}
+
+
+void shm_wait(shm_waiter_t *self, uint32_t seq, long timeout_ms) {
+    struct timespec timeout = { timeout_ms / 1000, (timeout_ms % 1000) * 1000000L };
+    // Returns at once if seq already moved on; EINTR and ETIMEDOUT just mean "check again"
+    syscall(SYS_futex, &self->seq, FUTEX_WAIT, seq, &timeout, NULL, 0);
+    shm_cancel_wait(self);
+}
+
+
+void shm_wake(shm_waiter_t *waiter) {
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&waiter->sleeping, __ATOMIC_RELAXED)) {
+        __atomic_fetch_add(&waiter->seq, 1, __ATOMIC_RELEASE);
+        syscall(SYS_futex, &waiter->seq, FUTEX_WAKE, 1, NULL, NULL, 0);
+    }
+}
@@ -0,0 +1,147 @@
+#include "utils.h"
+#include "launcher.h"
+
+// Microbenchmark: spawn latency of the launcher (posix_spawn with precomputed plans and a stdout
+// pipe) against the original fork() + malloc/snprintf/open/dup2/execl path into output/ files,
+// for many (executable, parameter) pairs.
+//
+// Usage: ./spawn_bench [num_pairs] [parent_mb] [executable]
+//   num_pairs   number of pairs spawned per method (default 10000)
+//   parent_mb   MB of touched heap in the parent, standing in for large results arrays (default 256)
+//   executable  program to run for every pair (default /bin/true)
+
+#define DEFAULT_PAIRS 10000
+#define DEFAULT_PARENT_MB 256
+
+
+// The launch path execute_solution() used before the launcher: everything is built in the child
+pid_t fork_solution(char *executable_path, char *input) {
+    pid_t pid = fork();
+    if (pid == 0) {
+        char *executable_name = get_exe_name(executable_path);
+        int len_output_path = strlen("output/") + strlen(executable_name) + strlen(input) + 2;  // +2 for the null terminator and the dot
+        char *output_path = malloc(len_output_path);
+        if (output_path == NULL) {
+            exit(EXIT_FAILURE);
+        }
+        snprintf(output_path, len_output_path, "output/%s.%s", executable_name, input);
+
+        int fd = open(output_path, O_CREAT | O_WRONLY | O_TRUNC, 0644);
+        if (fd == -1 || dup2(fd, STDOUT_FILENO) == -1 || close(fd) == -1) {
+            exit(EXIT_FAILURE);
+        }
+        free(output_path);
+
+        execl(executable_path, executable_name, input, NULL);
+        exit(1);
+    } else if (pid == -1) {
+        perror("Failed to fork");
+        exit(EXIT_FAILURE);
+    }
+    return pid;
+}
+
+
+void wait_child(pid_t pid) {
+    int status;
+    while (waitpid(pid, &status, 0) == -1) {
+        if (errno != EINTR) {
+            perror("waitpid");
+            exit(EXIT_FAILURE);
+        }
+    }
+}
+
+
+long get_time_us() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000L + ts.tv_nsec / 1000;
+}
+
+
+void report(const char *method, long spawn_us, long total_us, int num_pairs) {
+    printf("%-12s spawn latency %8.1f us/pair   wall %8.3f s   %8.0f pairs/s\n", method,
+           (double) spawn_us / num_pairs, total_us / 1e6, num_pairs / (total_us / 1e6));
+}
+
+
+int main(int argc, char *argv[]) {
+    int num_pairs = argc > 1 ? atoi(argv[1]) : DEFAULT_PAIRS;
+    long parent_mb = argc > 2 ? atol(argv[2]) : DEFAULT_PARENT_MB;
+    char *executable = argc > 3 ? argv[3] : "/bin/true";
+    if (num_pairs <= 0 || parent_mb < 0) {
+        printf("Usage: %s [num_pairs] [parent_mb] [executable]\n", argv[0]);
+        return 1;
+    }
+
+    // Touch every page so fork() has real page tables to copy
+    size_t parent_bytes = parent_mb * 1024 * 1024;
+    char *ballast = malloc(parent_bytes > 0 ? parent_bytes : 1);
+    if (ballast == NULL) {
+        perror("Failed to allocate parent memory");
+        return 1;
+    }
+    memset(ballast, 1, parent_bytes);
+
+    // The fork path writes output/<executable>.<param> files, so run in a scratch directory
+    char scratch[] = "/tmp/spawn_bench.XXXXXX";
+    if (mkdtemp(scratch) == NULL || chdir(scratch) == -1 || mkdir("output", 0755) == -1) {
+        perror("Failed to set up scratch directory");
+        return 1;
+    }
+
+    // Parameters as strings, like argv in the autograder
+    char (*params)[MAX_INT_CHARS + 1] = malloc(num_pairs * sizeof(*params));
+    if (params == NULL) {
+        perror("malloc");
+        return 1;
+    }
+    for (int i = 0; i < num_pairs; i++) {
+        snprintf(params[i], sizeof(params[i]), "%d", i);
+    }
+
+    printf("%d pairs, %ld MB parent heap, executable %s\n", num_pairs, parent_mb, executable);
+
+    long spawn_us = 0;
+    long start = get_time_us();
+    for (int i = 0; i < num_pairs; i++) {
+        long before = get_time_us();
+        pid_t pid = fork_solution(executable, params[i]);
+        spawn_us += get_time_us() - before;
+        wait_child(pid);
+    }
+    report("fork+execl", spawn_us, get_time_us() - start, num_pairs);
+
+    spawn_plan_t plan;
+    spawn_us = 0;
+    start = get_time_us();
+    for (int i = 0; i < num_pairs; i++) {
+        long before = get_time_us();
+        init_spawn_plan(&plan, executable, params[i], INPUT_EXEC, -1);
+        pid_t pid = spawn_solution(&plan, NULL);
+        if (pid == -1) {
+            exit(EXIT_FAILURE);
+        }
+        spawn_us += get_time_us() - before;
+        wait_child(pid);
+        close(plan.output_fd);
+    }
+    report("posix_spawn", spawn_us, get_time_us() - start, num_pairs);
+
+    // Clean up the scratch directory
+    char *exe_name = get_exe_name(executable);
+    for (int i = 0; i < num_pairs; i++) {
+        char output_path[PATH_MAX];
+        snprintf(output_path, sizeof(output_path), "output/%s.%s", exe_name, params[i]);
+        unlink(output_path);
+    }
+    rmdir("output");
+    if (chdir("/") == 0) {
+        rmdir(scratch);
+    }
+
+    free(params);
+    free(ballast);
+    return 0;
+}
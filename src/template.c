@@ -65,17 +65,17 @@ int main(int argc, char *argv[]) {
     
     switch (mode) {
         case 1:
-            // Using fprintf(stderr, ...) since STDOUT is redirected to a file
+            // Using fprintf(stderr, ...) since STDOUT is captured by the autograder
             fprintf(stderr, "Program: %s, PID: %d, Mode: 1 - Exiting with status 0 (Correct answer)\n", argv[0], pid);
-            // TODO: Write the result (0) to the output file (output/<executable>.<input>)
-            //       Do not open the file. Think about what function you can use to output
-            //       information given what you redirected in the autograder.c file.
+            // TODO: Write the result (0) to STDOUT, which the autograder reads the verdict from.
+            //       Think about what function you can use to output information given what
+            //       the autograder redirected STDOUT to.
 
             printf("0");
             break;
         case 2:
             fprintf(stderr, "Program: %s, PID: %d, Mode: 2 - Exiting with status 1 (Incorrect answer)\n", argv[0], pid);
-            // TODO: Write the result (1) to the output file (same as case 1 above)
+            // TODO: Write the result (1) to STDOUT (same as case 1 above)
             printf("1");
             break;
         case 3:
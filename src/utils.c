@@ -1,6 +1,17 @@
+#define _GNU_SOURCE  // For memfd_create() and file sealing
 #include "utils.h"
 
+#include <ctype.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+
 #define ALIGNMENT 9     // Number of characters to align the status messages
+#define SCAN_BUFFER_SIZE (256 << 10)    // getdents64() buffer: fewer round trips on network filesystems
+#define SCAN_INITIAL_CAPACITY 64
+
+// Directory last scanned by scan_executables(), see get_result_name()
+static const char *scan_root;
 
 const char* get_status_message(int status) {
     switch (status) {
@@ -8,6 +19,8 @@ const char* get_status_message(int status) {
         case INCORRECT: return "incorrect";
         case SEGFAULT: return "crash";
         case STUCK_OR_INFINITE: return "stuck/inf";
+        case STUCK: return "stuck";
+        case INFINITE_LOOP: return "infinite";
         default: return "unknown";
     }
 }
@@ -18,296 +31,803 @@ char *get_exe_name(char *path) {
 }
 
 
+char *get_result_name(char *path) {
+    size_t root_len = scan_root != NULL ? strlen(scan_root) : 0;
+    if (root_len > 0 && strncmp(path, scan_root, root_len) == 0 && path[root_len] == '/') {
+        path += root_len;
+        while (*path == '/') {
+            path++;
+        }
+        return path;
+    }
+    return get_exe_name(path);
+}
+
+
 char **get_student_executables(char *solution_dir, int *num_executables) {
-    DIR *dir;
-    struct dirent *entry;
-    struct stat st;
+    return scan_executables(solution_dir, 0, NULL, num_executables);
+}
 
-    // Open the directory
-    dir = opendir(solution_dir);
-    if (!dir) {
-        perror("Failed to open directory");
-        exit(EXIT_FAILURE);
-    }
 
-    // Count the number of executables
-    *num_executables = 0;
-    while ((entry = readdir(dir)) != NULL) {
-        // Ignore hidden files
-        char path[PATH_MAX];
-        snprintf(path, sizeof(path), "%s/%s", solution_dir, entry->d_name);
+// Growable array of executable paths
+typedef struct {
+    char **paths;
+    int count;
+    int capacity;
+} path_list_t;
 
-        if (stat(path, &st) == 0) {
-            if (S_ISREG(st.st_mode) && entry->d_name[0] != '.')
-                (*num_executables)++;
-        } else {
-            perror("Failed to get file status");
+
+static void add_path(path_list_t *list, const char *dir_path, const char *name) {
+    if (list->count == list->capacity) {
+        list->capacity = list->capacity > 0 ? list->capacity * 2 : SCAN_INITIAL_CAPACITY;
+        list->paths = realloc(list->paths, list->capacity * sizeof(char *));
+        if (list->paths == NULL) {
+            fprintf(stderr, "Error occured at line %d: realloc failed\n", __LINE__ - 2);
             exit(EXIT_FAILURE);
         }
     }
+    int len = strlen(dir_path) + strlen(name) + 2;  // '/' and the null terminator
+    char *path = malloc(len);
+    if (path == NULL) {
+        fprintf(stderr, "Error occured at line %d: malloc failed\n", __LINE__ - 2);
+        exit(EXIT_FAILURE);
+    }
+    snprintf(path, len, "%s/%s", dir_path, name);
+    list->paths[list->count++] = path;
+}
+
+
+// Whether the regular file name in dir_fd can be run: executable by us, and an ELF binary or a script
+static int is_runnable(int dir_fd, const char *name) {
+    if (faccessat(dir_fd, name, X_OK, AT_EACCESS) == -1) {
+        return 0;
+    }
+    int fd = openat(dir_fd, name, O_RDONLY | O_CLOEXEC | O_NOCTTY | O_NONBLOCK);
+    if (fd == -1) {
+        return 0;
+    }
+    unsigned char magic[4];
+    ssize_t len = read(fd, magic, sizeof(magic));
+    close(fd);
+    return (len == 4 && memcmp(magic, "\x7f" "ELF", 4) == 0) || (len >= 2 && magic[0] == '#' && magic[1] == '!');
+}
 
-    // Allocate memory for the array of strings
-    char **executables = (char **) malloc(*num_executables * sizeof(char *));
-    if (!executables) {
-        perror("Failed to allocate memory");
+
+static void scan_directory(int dir_fd, const char *dir_path, int recursive, scan_visit_fn visit, path_list_t *list) {
+    if (visit != NULL) {
+        visit(dir_path);
+    }
+    char *buffer = malloc(SCAN_BUFFER_SIZE);
+    if (buffer == NULL) {
+        fprintf(stderr, "Error occured at line %d: malloc failed\n", __LINE__ - 2);
         exit(EXIT_FAILURE);
     }
 
-    // Reset the directory stream
-    rewinddir(dir);
+    ssize_t nread;
+    while ((nread = getdents64(dir_fd, buffer, SCAN_BUFFER_SIZE)) > 0) {
+        for (ssize_t offset = 0; offset < nread; ) {
+            struct dirent64 *entry = (struct dirent64 *) (buffer + offset);
+            offset += entry->d_reclen;
 
-    // Read the file names
-    int i = 0;
-    while ((entry = readdir(dir)) != NULL) {
-        // Ignore hidden files
-        char path[PATH_MAX];
-        snprintf(path, sizeof(path), "%s/%s", solution_dir, entry->d_name);
+            // Ignore hidden files (and "." / "..")
+            if (entry->d_name[0] == '.') {
+                continue;
+            }
+            int type = entry->d_type;
+            if (type == DT_UNKNOWN || type == DT_LNK) {
+                // Symlinks count as what they point to, except that directories are not followed
+                struct stat st;
+                if (fstatat(dir_fd, entry->d_name, &st, 0) == -1) {
+                    if (errno != ENOENT) {
+                        perror("Failed to get file status");
+                    }
+                    continue;
+                }
+                type = S_ISREG(st.st_mode) ? DT_REG : (S_ISDIR(st.st_mode) && entry->d_type == DT_UNKNOWN ? DT_DIR : DT_UNKNOWN);
+            }
 
-        if (stat(path, &st) == 0) {
-            if (S_ISREG(st.st_mode) && entry->d_name[0] != '.') {
-                int len_executable = strlen(solution_dir) + strlen(entry->d_name) + 2;
-                executables[i] = (char *) malloc((len_executable) * sizeof(char));
-                if (!executables[i]) {
-                    perror("Failed to allocate memory");
+            if (type == DT_REG && is_runnable(dir_fd, entry->d_name)) {
+                add_path(list, dir_path, entry->d_name);
+            } else if (type == DT_DIR && recursive) {
+                int sub_fd = openat(dir_fd, entry->d_name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+                if (sub_fd == -1) {
+                    if (errno != ENOENT) {
+                        perror("Failed to open directory");
+                    }
+                    continue;
+                }
+                int len = strlen(dir_path) + strlen(entry->d_name) + 2;
+                char *sub_path = malloc(len);
+                if (sub_path == NULL) {
+                    fprintf(stderr, "Error occured at line %d: malloc failed\n", __LINE__ - 2);
                     exit(EXIT_FAILURE);
                 }
-                snprintf(executables[i], len_executable, "%s/%s", solution_dir, entry->d_name);
-                i++;
+                snprintf(sub_path, len, "%s/%s", dir_path, entry->d_name);
+                scan_directory(sub_fd, sub_path, recursive, visit, list);
+                free(sub_path);
+                close(sub_fd);
             }
         }
     }
-
-    // Close the directory
-    closedir(dir);
-
-    // Return the array of strings (remember to free the memory later)
-    return executables;
+    if (nread == -1) {
+        perror("getdents64");
+    }
+    free(buffer);
 }
 
 
-// TODO: Implement this function
-int get_batch_size() {
-    int batch_size = 0;
-    int bytes_read;  // bytes_read
-    int pipe_fd[2];  // create a pipe for outputs
-
-    if (pipe(pipe_fd) == -1) {
-        fprintf(stderr, "Error occurred at line %d: pipe failed\n", __LINE__ - 1);
+char **scan_executables(char *solution_dir, int recursive, scan_visit_fn visit, int *num_executables) {
+    int dir_fd = open(solution_dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dir_fd == -1) {
+        perror("Failed to open directory");
         exit(EXIT_FAILURE);
     }
+    scan_root = solution_dir;
 
-    pid_t pid = fork();
+    path_list_t list = { NULL, 0, 0 };
+    scan_directory(dir_fd, solution_dir, recursive, visit, &list);
+    close(dir_fd);
 
-    if (pid == 0) {  // child process
-        if (close(pipe_fd[0]) == -1) {  // Closing read end, won't need it.
-            fprintf(stderr, "Error occurred at line %d: close failed\n", __LINE__ - 1);
-            exit(EXIT_FAILURE);
-        }
-        if (dup2(pipe_fd[1], STDOUT_FILENO) == -1) {  // redirecting stdout to pipe
-            fprintf(stderr, "Error occured at line %d: dup2 failed\n", __LINE__ - 1);
+    // Always return an allocated array, even for an empty directory
+    if (list.paths == NULL) {
+        list.paths = malloc(sizeof(char *));
+        if (list.paths == NULL) {
+            fprintf(stderr, "Error occured at line %d: malloc failed\n", __LINE__ - 2);
             exit(EXIT_FAILURE);
         }
-        execlp("grep", "grep", "-c", "^processor", "/proc/cpuinfo", NULL);
-        fprintf(stderr, "Error occured at line %d: Failed to run execlp", __LINE__ - 1);
+    }
+    *num_executables = list.count;
+    return list.paths;
+}
+
+
+int is_submission(const char *path) {
+    const char *name = strrchr(path, '/');
+    name = name != NULL ? name + 1 : path;
+    struct stat st;
+    if (name[0] == '.' || stat(path, &st) == -1 || !S_ISREG(st.st_mode)) {
+        return 0;
+    }
+    return is_runnable(AT_FDCWD, path);
+}
+
+
+int *create_input_memfds(char **argv_params, int num_parameters) {
+    int *input_fds = malloc(num_parameters * sizeof(int));
+    if (input_fds == NULL) {
+        fprintf(stderr, "Error occurred at line %d: malloc failed\n", __LINE__ - 2);
         exit(EXIT_FAILURE);
-    } else if (pid > 0) {  // Parent process
-        if (close(pipe_fd[1]) == -1) {  // close off write
-            perror("Close Failed");
+    }
+
+    for (int i = 0; i < num_parameters; ++i) {
+        input_fds[i] = memfd_create(argv_params[i], MFD_CLOEXEC | MFD_ALLOW_SEALING);
+        if (input_fds[i] == -1) {
+            perror("memfd_create");
             exit(EXIT_FAILURE);
         }
-        char reader[BUFSIZ];
-        if ((bytes_read = read(pipe_fd[0], reader, BUFSIZ)) == -1) {  // read from pipe
-            perror("read failed");
+
+        size_t len = strlen(argv_params[i]);
+        size_t written = 0;
+        while (written < len) {
+            ssize_t bytes = write(input_fds[i], argv_params[i] + written, len - written);
+            if (bytes == -1) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                perror("Failed to write input");
+                exit(EXIT_FAILURE);
+            }
+            written += bytes;
+        }
+
+        // Nobody can change the payload once it is sealed, so every child can safely share it
+        if (fcntl(input_fds[i], F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL) == -1) {
+            perror("Failed to seal input");
             exit(EXIT_FAILURE);
         }
-        reader[bytes_read] = '\0';  // adding string term character to end of batch_size;
-        if (close(pipe_fd[0]) == -1) {  // closing read end of pipe.
+    }
+    return input_fds;
+}
+
+
+void close_input_memfds(int *input_fds, int num_parameters) {
+    for (int i = 0; i < num_parameters; ++i) {
+        if (close(input_fds[i]) == -1) {
             perror("close failed");
             exit(EXIT_FAILURE);
         }
+    }
+    free(input_fds);
+}
 
-        pid_t wait_result;
-        do {
-            wait_result = wait(NULL);
-            if (wait_result == -1 && errno != EINTR) {
-                perror("wait failed");
-                exit(EXIT_FAILURE);
-            }
-        } while (wait_result == -1 && errno == EINTR);
 
-        batch_size = atoi(reader);
-    } else {
-        perror("fork failed");
+long get_time_ms() {
+    struct timespec ts;
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) == -1) {
+        perror("clock_gettime");
         exit(EXIT_FAILURE);
     }
-    return batch_size;
+    return ts.tv_sec * 1000L + ts.tv_nsec / 1000000;
 }
 
 
-// TODO: Implement this function
-void create_input_files(char **argv_params, int num_parameters) {
-    for (int i = 0; i < num_parameters; ++i) {
-        size_t len_input_file = strlen("input/") + strlen(argv_params[i]) + strlen(".in") + 1;  // +1 for the null terminator
-        char *input_file = malloc(len_input_file);  // +1 for the null terminator
-        if (input_file == NULL) {
-            fprintf(stderr, "Error occurred at line %d: malloc failed\n", __LINE__ - 2);
-            exit(EXIT_FAILURE);
+int get_verdict(int wait_status, const char *output) {
+    if (WIFSIGNALED(wait_status)) {
+        if (WTERMSIG(wait_status) == SIGSEGV) {
+            return SEGFAULT;
         }
-        snprintf(input_file, len_input_file, "input/%s.in", argv_params[i]);
-        FILE *file = fopen(input_file, "w");
-        if (!file) {
-            perror("Failed to open file");
-            exit(EXIT_FAILURE);
+        return STUCK_OR_INFINITE;
+    }
+
+    // Only the first MAX_INT_CHARS characters of the output are considered
+    char answer[MAX_INT_CHARS + 1];  // +1 for the null terminator
+    strncpy(answer, output, MAX_INT_CHARS);
+    answer[MAX_INT_CHARS] = '\0';
+
+    // Anything but a 0 is wrong, output that is no number at all included. A submission's output
+    // must never end the run.
+    char *end;
+    long value = strtol(answer, &end, 10);
+    if (end != answer && value == 0) {
+        return CORRECT;
+    }
+    return INCORRECT;
+}
+
+
+int get_longest_len_executable(autograder_results_t *results, int num_executables) {
+    int longest_len = 0;
+    for (int i = 0; i < num_executables; i++) {
+        char *exe_name = get_result_name(results[i].exe_path);
+        int len = strlen(exe_name);
+        if (len > longest_len) {
+            longest_len = len;
         }
-        fprintf(file, "%s", argv_params[i]);
-        fclose(file);
-        free(input_file);
     }
+    return longest_len;
 }
 
 
-// TODO: Implement this function
-void start_timer(int seconds, void (*timeout_handler)(int)) {
-    struct sigaction sa;
-    struct itimerval interval;
-
-    sa.sa_handler = timeout_handler;
-    sa.sa_flags = 0;
-    if (sigemptyset(&sa.sa_mask) == -1) { 
-        perror("Failed to empty sig set");
-        exit(EXIT_FAILURE);
+// Sort key of one result, parsed once: the number after the last '_' of the executable name
+// (0 if there is none), then the whole name
+typedef struct {
+    int number;
+    const char *name;
+    int index;
+} sort_key_t;
+
+
+// Natural order: runs of digits compare by numeric value, so sol_2 < sol_10, and names without digits still work
+static int natural_compare(const char *a, const char *b) {
+    while (*a != '\0' && *b != '\0') {
+        if (isdigit((unsigned char) *a) && isdigit((unsigned char) *b)) {
+            while (*a == '0' && isdigit((unsigned char) a[1])) {
+                a++;
+            }
+            while (*b == '0' && isdigit((unsigned char) b[1])) {
+                b++;
+            }
+            int len_a = 0;
+            int len_b = 0;
+            while (isdigit((unsigned char) a[len_a])) {
+                len_a++;
+            }
+            while (isdigit((unsigned char) b[len_b])) {
+                len_b++;
+            }
+            if (len_a != len_b) {
+                return len_a - len_b;
+            }
+            int cmp = memcmp(a, b, len_a);
+            if (cmp != 0) {
+                return cmp;
+            }
+            a += len_a;
+            b += len_b;
+        } else {
+            if (*a != *b) {
+                return (unsigned char) *a - (unsigned char) *b;
+            }
+            a++;
+            b++;
+        }
     }
-    if (sigaction(SIGALRM, &sa, NULL) == -1) {
-        perror("Failed to set up signal handler");
-        exit(1);
+    return (unsigned char) *a - (unsigned char) *b;
+}
+
+
+static int compare_sort_keys(const void *a, const void *b) {
+    const sort_key_t *key_a = a;
+    const sort_key_t *key_b = b;
+    if (key_a->number != key_b->number) {
+        return key_a->number < key_b->number ? -1 : 1;
+    }
+    int cmp = natural_compare(key_a->name, key_b->name);
+    if (cmp == 0) {
+        // Equal up to leading zeros: fall back to plain bytes, then to the original order
+        cmp = strcmp(key_a->name, key_b->name);
     }
+    return cmp != 0 ? cmp : key_a->index - key_b->index;
+}
 
-    interval.it_interval.tv_sec = 0;
-    interval.it_interval.tv_usec = 0;
-    interval.it_value.tv_sec = TIMEOUT_SECS;
-    interval.it_value.tv_usec = 0;
 
-    if (setitimer(ITIMER_REAL, &interval, NULL) == -1) {
-        perror("Failed to set up timer");
-        exit(1);
+autograder_results_t *create_results(char **exe_paths, int num_executables, char **params, int total_params, int with_usage) {
+    size_t cells = (size_t) num_executables * total_params;
+    size_t params_offset = num_executables * sizeof(autograder_results_t);
+    size_t status_offset = params_offset + total_params * sizeof(int);
+    size_t usage_offset = (status_offset + cells + sizeof(long) - 1) & ~(sizeof(long) - 1);
+    size_t paths_offset = usage_offset + (with_usage ? 2 * cells * sizeof(long) : 0);
+    size_t size = paths_offset;
+    for (int i = 0; i < num_executables; i++) {
+        size += strlen(exe_paths[i]) + 1;
+    }
+
+    char *arena = malloc(size > 0 ? size : 1);
+    if (arena == NULL) {
+        fprintf(stderr, "Error occured at line %d: malloc failed\n", __LINE__ - 2);
+        exit(EXIT_FAILURE);
+    }
+    autograder_results_t *results = (autograder_results_t *) arena;
+    int *params_tested = (int *) (arena + params_offset);
+    uint8_t *status = (uint8_t *) (arena + status_offset);
+    long *usage = (long *) (arena + usage_offset);
+    char *paths = arena + paths_offset;
+
+    for (int j = 0; j < total_params; j++) {
+        params_tested[j] = atoi(params[j]);
     }
+    memset(status, 0, cells);
+    for (int i = 0; i < num_executables; i++) {
+        results[i].exe_path = paths;
+        paths = stpcpy(paths, exe_paths[i]) + 1;
+        results[i].params_tested = params_tested;
+        results[i].status = status + (size_t) i * total_params;
+        results[i].cpu_usec = with_usage ? usage + (size_t) i * total_params : NULL;
+        results[i].memory_peak = with_usage ? usage + cells + (size_t) i * total_params : NULL;
+    }
+    return results;
 }
 
 
-// TODO: Implement this function
-void cancel_timer() {
-    struct itimerval interval;
-    interval.it_interval.tv_sec = 0;
-    interval.it_interval.tv_usec = 0;
-    interval.it_value.tv_sec = 0;  // Stopping Timer.
-    interval.it_value.tv_usec = 0;
-
-    if (setitimer(ITIMER_REAL, &interval, 0)) {
-        perror("setitimer");
+void free_results(autograder_results_t *results) {
+    free(results);
+}
+
+
+void sort_results(autograder_results_t *results, int num_executables) {
+    sort_key_t *keys = malloc(num_executables * sizeof(sort_key_t));
+    autograder_results_t *sorted = malloc(num_executables * sizeof(autograder_results_t));
+    if ((keys == NULL || sorted == NULL) && num_executables > 0) {
+        fprintf(stderr, "Error occured at line %d: malloc failed\n", __LINE__ - 2);
         exit(EXIT_FAILURE);
     }
+    for (int i = 0; i < num_executables; i++) {
+        keys[i].name = get_result_name(results[i].exe_path);
+        char *suffix = strrchr(keys[i].name, '_');
+        keys[i].number = suffix != NULL ? atoi(suffix + 1) : 0;
+        keys[i].index = i;
+    }
+    qsort(keys, num_executables, sizeof(sort_key_t), compare_sort_keys);
+
+    for (int i = 0; i < num_executables; i++) {
+        sorted[i] = results[keys[i].index];
+    }
+    memcpy(results, sorted, num_executables * sizeof(autograder_results_t));
+    free(sorted);
+    free(keys);
 }
 
 
-// TODO: Implement this function
-void remove_input_files(char **argv_params, int num_parameters) {
-    for (int i = 0; i < num_parameters; ++i) {
-        size_t len_input_file = strlen("input/") + strlen(argv_params[i]) + strlen(".in") + 1;  // +1 for the null terminator
-        char *input_file = malloc(len_input_file);  // +1 for the null terminator
-        if (input_file == NULL) {
-            fprintf(stderr, "Error occurred at line %d: malloc failed\n", __LINE__ - 2);
-            exit(EXIT_FAILURE);
+// Shared state of the threads formatting one block of rows
+typedef struct {
+    const results_rows_t *rows;
+    int longest_len;
+    int row_len;
+    char (*param_cells)[16];      // "%5d (" of each parameter
+    int *param_cell_len;
+    char (*status_cells)[12];     // "%9s) " of every possible status byte
+} report_format_t;
+
+// One thread's share of a block
+typedef struct {
+    report_format_t *format;
+    int first_row;
+    int num_rows;
+    char *buffer;                 // num_rows * row_len bytes
+} report_slice_t;
+
+
+static void *format_rows(void *arg) {
+    report_slice_t *slice = arg;
+    report_format_t *format = slice->format;
+    const results_rows_t *rows = format->rows;
+    char *out = slice->buffer;
+
+    for (int i = slice->first_row; i < slice->first_row + slice->num_rows; i++) {
+        const char *name = rows->names[i];
+        int name_len = strlen(name);
+        memcpy(out, name, name_len);
+        memset(out + name_len, ' ', format->longest_len - name_len);
+        out += format->longest_len;
+        *out++ = ':';
+
+        for (int j = 0; j < rows->num_params; j++) {
+            int status = rows->byte_rows != NULL ? rows->byte_rows[(size_t) i * rows->num_params + j]
+                                                 : rows->status_rows[i][j];
+            memcpy(out, format->param_cells[j], format->param_cell_len[j]);
+            out += format->param_cell_len[j];
+            memcpy(out, format->status_cells[status & 0xff], REPORT_STATUS_CELL);
+            out += REPORT_STATUS_CELL;
         }
-        snprintf(input_file, len_input_file, "input/%s.in", argv_params[i]);
-        if (unlink(input_file) == -1) {
-            perror("Failed to unlink file");
-            free(input_file);
-            exit(EXIT_FAILURE);
+        *out++ = '\n';
+    }
+    return NULL;
+}
+
+
+// Write all iovecs, resuming after short writes
+static int writev_all(int fd, struct iovec *iov, int count) {
+    while (count > 0) {
+        ssize_t written = writev(fd, iov, count);
+        if (written == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        while (count > 0 && (size_t) written >= iov->iov_len) {
+            written -= iov->iov_len;
+            iov++;
+            count--;
+        }
+        if (count > 0) {
+            iov->iov_base = (char *) iov->iov_base + written;
+            iov->iov_len -= written;
         }
-        free(input_file);
     }
+    return 0;
 }
 
 
-// TODO: Implement this function
-void remove_output_files(autograder_results_t *results, int tested, int current_batch_size, char *param) {
-    for (int i = 0; i < current_batch_size; ++i) {
-        char *exe_name = get_exe_name(results[tested - current_batch_size + i].exe_path);
-        size_t len_output_file = strlen("output/") + strlen(exe_name) + strlen(param) + 2;  // +1 for the null terminator
-        char *output_file = malloc(len_output_file);
-        if (output_file == NULL) {
-            fprintf(stderr, "Error occurred at line %d: malloc failed\n", __LINE__ - 2);
-            exit(EXIT_FAILURE);
+int write_results_rows(const results_rows_t *rows, const char *path) {
+    report_format_t format;
+    format.rows = rows;
+    format.longest_len = 0;
+    for (int i = 0; i < rows->num_rows; i++) {
+        int len = strlen(rows->names[i]);
+        if (len > format.longest_len) {
+            format.longest_len = len;
         }
-        snprintf(output_file, len_output_file, "output/%s.%s", exe_name, param);
+    }
 
-        if (unlink(output_file) == -1) {
-            perror("Failed to unlink file");
-            free(output_file);
-            exit(EXIT_FAILURE);
+    // Every row has the same parameters, so every row has the same length and the cells can be preformatted
+    format.param_cells = malloc((rows->num_params + 1) * sizeof(*format.param_cells));
+    format.param_cell_len = malloc((rows->num_params + 1) * sizeof(int));
+    format.status_cells = malloc(256 * sizeof(*format.status_cells));
+    if (format.param_cells == NULL || format.param_cell_len == NULL || format.status_cells == NULL) {
+        fprintf(stderr, "Error occured at line %d: malloc failed\n", __LINE__ - 2);
+        exit(EXIT_FAILURE);
+    }
+    format.row_len = format.longest_len + 2;  // ':' and '\n'
+    for (int j = 0; j < rows->num_params; j++) {
+        format.param_cell_len[j] = snprintf(format.param_cells[j], sizeof(format.param_cells[j]), "%5d (", rows->params[j]);
+        format.row_len += format.param_cell_len[j] + REPORT_STATUS_CELL;
+    }
+    for (int status = 0; status < 256; status++) {
+        snprintf(format.status_cells[status], sizeof(format.status_cells[status]), "%9s) ", get_status_message(status));
+    }
+
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd == -1) {
+        perror("Failed to open file");
+        free(format.param_cells);
+        free(format.param_cell_len);
+        free(format.status_cells);
+        return -1;
+    }
+
+    // Small reports are formatted inline; big ones are split across threads, block by block
+    int num_threads = 1;
+    if ((long) rows->num_rows * rows->num_params >= REPORT_THREAD_MIN_CELLS) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        num_threads = cpus < 1 ? 1 : (cpus > REPORT_MAX_THREADS ? REPORT_MAX_THREADS : cpus);
+    }
+    int rows_per_block = REPORT_BLOCK_BYTES / format.row_len;
+    if (rows_per_block < num_threads) {
+        rows_per_block = num_threads;
+    }
+    char *buffer = malloc((size_t) rows_per_block * format.row_len);
+    if (buffer == NULL) {
+        fprintf(stderr, "Error occured at line %d: malloc failed\n", __LINE__ - 2);
+        exit(EXIT_FAILURE);
+    }
+
+    int failed = 0;
+    report_slice_t slices[REPORT_MAX_THREADS];
+    pthread_t threads[REPORT_MAX_THREADS];
+    struct iovec iov[REPORT_MAX_THREADS];
+    for (int first = 0; first < rows->num_rows && !failed; first += rows_per_block) {
+        int block_rows = rows->num_rows - first < rows_per_block ? rows->num_rows - first : rows_per_block;
+        int per_thread = (block_rows + num_threads - 1) / num_threads;
+        int num_slices = 0;
+        for (int row = 0; row < block_rows; row += per_thread) {
+            report_slice_t *slice = &slices[num_slices];
+            slice->format = &format;
+            slice->first_row = first + row;
+            slice->num_rows = block_rows - row < per_thread ? block_rows - row : per_thread;
+            slice->buffer = buffer + (size_t) row * format.row_len;
+            iov[num_slices].iov_base = slice->buffer;
+            iov[num_slices].iov_len = (size_t) slice->num_rows * format.row_len;
+            num_slices++;
         }
 
-        free(output_file);
+        // The calling thread formats the first slice itself
+        for (int t = 1; t < num_slices; t++) {
+            if (pthread_create(&threads[t], NULL, format_rows, &slices[t]) != 0) {
+                fprintf(stderr, "Error occured at line %d: pthread_create failed\n", __LINE__ - 1);
+                exit(EXIT_FAILURE);
+            }
+        }
+        format_rows(&slices[0]);
+        for (int t = 1; t < num_slices; t++) {
+            pthread_join(threads[t], NULL);
+        }
+
+        if (writev_all(fd, iov, num_slices) == -1) {
+            perror("Failed to write file");
+            failed = 1;
+        }
     }
+
+    if (close(fd) == -1 && !failed) {
+        perror("Failed to write file");
+        failed = 1;
+    }
+    free(buffer);
+    free(format.param_cells);
+    free(format.param_cell_len);
+    free(format.status_cells);
+    if (failed) {
+        return -1;
+    }
+
+    // Lookups without an index still work (find_results_row() scans), so this is not fatal
+    if (write_results_index(path, rows->names, rows->num_rows, format.row_len) == -1) {
+        fprintf(stderr, "Failed to write the index of %s\n", path);
+    }
+    return 0;
 }
 
 
-int get_longest_len_executable(autograder_results_t *results, int num_executables) {
-    int longest_len = 0;
-    for (int i = 0; i < num_executables; i++) {
-        char *exe_name = get_exe_name(results[i].exe_path);
-        int len = strlen(exe_name);
-        if (len > longest_len) {
-            longest_len = len;
+// FNV-1a hash of an executable name
+static uint64_t hash_name(const char *name) {
+    uint64_t hash = 1469598103934665603UL;
+    for (; *name != '\0'; name++) {
+        hash ^= (unsigned char) *name;
+        hash *= 1099511628211UL;
+    }
+    return hash;
+}
+
+
+int write_results_index(const char *results_path, const char **names, int num_rows, long row_len) {
+    uint32_t capacity = 16;
+    while (capacity < 2 * (uint64_t) num_rows) {
+        capacity <<= 1;
+    }
+    size_t size = sizeof(results_index_header_t) + (size_t) capacity * sizeof(results_index_bucket_t);
+    char *buffer = malloc(size);
+    if (buffer == NULL) {
+        fprintf(stderr, "Error occured at line %d: malloc failed\n", __LINE__ - 2);
+        exit(EXIT_FAILURE);
+    }
+
+    results_index_header_t *header = (results_index_header_t *) buffer;
+    memset(header, 0, sizeof(*header));
+    memcpy(header->magic, RESULTS_INDEX_MAGIC, sizeof(header->magic));
+    header->version = RESULTS_INDEX_VERSION;
+    header->num_rows = num_rows;
+    header->capacity = capacity;
+    header->row_len = row_len;
+    header->results_size = (uint64_t) num_rows * row_len;
+
+    // All ones marks a bucket as empty (row == RESULTS_INDEX_EMPTY)
+    results_index_bucket_t *buckets = (results_index_bucket_t *) (header + 1);
+    memset(buckets, 0xff, (size_t) capacity * sizeof(*buckets));
+    for (int row = 0; row < num_rows; row++) {
+        uint32_t hash = hash_name(names[row]);
+        uint32_t idx = hash & (capacity - 1);
+        while (buckets[idx].row != RESULTS_INDEX_EMPTY) {
+            idx = (idx + 1) & (capacity - 1);
         }
+        buckets[idx].hash = hash;
+        buckets[idx].row = row;
     }
-    return longest_len;
+
+    char index_path[PATH_MAX];
+    snprintf(index_path, sizeof(index_path), "%s%s", results_path, RESULTS_INDEX_SUFFIX);
+    int failed = 0;
+    int fd = open(index_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd == -1) {
+        perror("Failed to open file");
+        failed = 1;
+    } else {
+        struct iovec iov = { buffer, size };
+        if (writev_all(fd, &iov, 1) == -1) {
+            perror("Failed to write file");
+            failed = 1;
+        }
+        if (close(fd) == -1 && !failed) {
+            perror("Failed to write file");
+            failed = 1;
+        }
+    }
+    free(buffer);
+    return failed ? -1 : 0;
+}
+
+
+// Whether line (len bytes, no '\n') is exe_name's row: the name, padding, then ':'
+static int is_row_of(const char *line, size_t len, const char *exe_name) {
+    size_t name_len = strlen(exe_name);
+    if (name_len >= len || memcmp(line, exe_name, name_len) != 0) {
+        return 0;
+    }
+    size_t i = name_len;
+    while (i < len && line[i] == ' ') {
+        i++;
+    }
+    return i < len && line[i] == ':';
+}
+
+
+// Look exe_name up in the index of the results file open on results_fd. Returns 1 and sets *row if
+// found, -1 if there is no usable index or it has no row for exe_name. A hit is checked against the
+// row it points to, but a miss cannot be: the file may have been rewritten since with the same size
+// and other names, so the caller has to scan for it.
+static int lookup_results_index(const char *results_path, int results_fd, const char *exe_name, char **row) {
+    char index_path[PATH_MAX];
+    snprintf(index_path, sizeof(index_path), "%s%s", results_path, RESULTS_INDEX_SUFFIX);
+    int fd = open(index_path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        return -1;
+    }
+
+    // An index written for a different version of the results file is ignored
+    results_index_header_t header;
+    struct stat st;
+    if (pread(fd, &header, sizeof(header), 0) != sizeof(header) || fstat(results_fd, &st) == -1
+            || memcmp(header.magic, RESULTS_INDEX_MAGIC, sizeof(header.magic)) != 0
+            || header.version != RESULTS_INDEX_VERSION || header.row_len == 0
+            || header.capacity == 0 || (header.capacity & (header.capacity - 1)) != 0
+            || header.results_size != (uint64_t) st.st_size) {
+        close(fd);
+        return -1;
+    }
+
+    char *line = malloc(header.row_len);
+    if (line == NULL) {
+        fprintf(stderr, "Error occured at line %d: malloc failed\n", __LINE__ - 2);
+        exit(EXIT_FAILURE);
+    }
+    uint32_t hash = hash_name(exe_name);
+    uint32_t idx = hash & (header.capacity - 1);
+    for (uint32_t probes = 0; probes < header.capacity; probes++) {
+        results_index_bucket_t bucket;
+        off_t offset = sizeof(header) + (off_t) idx * sizeof(bucket);
+        if (pread(fd, &bucket, sizeof(bucket), offset) != sizeof(bucket)) {
+            break;
+        }
+        if (bucket.row == RESULTS_INDEX_EMPTY) {
+            break;
+        }
+        if (bucket.hash == hash && bucket.row < header.num_rows) {
+            off_t row_offset = (off_t) bucket.row * header.row_len;
+            if (pread(results_fd, line, header.row_len, row_offset) != (ssize_t) header.row_len) {
+                break;
+            }
+            if (is_row_of(line, header.row_len - 1, exe_name)) {
+                line[header.row_len - 1] = '\0';
+                *row = line;
+                close(fd);
+                return 1;
+            }
+        }
+        idx = (idx + 1) & (header.capacity - 1);
+    }
+    free(line);
+    close(fd);
+    return -1;
+}
+
+
+char *find_results_row(const char *results_path, const char *exe_name) {
+    int fd = open(results_path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        perror("Failed to open file");
+        return NULL;
+    }
+    char *row = NULL;
+    if (lookup_results_index(results_path, fd, exe_name, &row) == 1) {
+        close(fd);
+        return row;
+    }
+
+    // No usable index, or exe_name is not in it: scan the file
+    FILE *file = fdopen(fd, "r");
+    if (file == NULL) {
+        perror("Failed to open file");
+        close(fd);
+        return NULL;
+    }
+    char *line = NULL;
+    size_t line_cap = 0;
+    ssize_t len;
+    while ((len = getline(&line, &line_cap, file)) != -1) {
+        if (len > 0 && line[len - 1] == '\n') {
+            line[--len] = '\0';
+        }
+        if (is_row_of(line, len, exe_name)) {
+            fclose(file);
+            return line;
+        }
+    }
+    free(line);
+    fclose(file);
+    return NULL;
 }
 
 
 void write_results_to_file(autograder_results_t *results, int num_executables, int total_params) {
-    FILE *file = fopen("results.txt", "w");
+    sort_results(results, num_executables);
+
+    results_rows_t rows;
+    rows.num_rows = num_executables;
+    rows.num_params = num_executables > 0 ? total_params : 0;   // the parameters come from the rows (--watch may have none yet)
+    rows.params = num_executables > 0 ? results[0].params_tested : NULL;
+    rows.names = malloc(num_executables * sizeof(char *));
+    rows.status_rows = malloc(num_executables * sizeof(uint8_t *));
+    rows.byte_rows = NULL;
+    if ((rows.names == NULL || rows.status_rows == NULL) && num_executables > 0) {
+        fprintf(stderr, "Error occured at line %d: malloc failed\n", __LINE__ - 2);
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < num_executables; i++) {
+        rows.names[i] = get_result_name(results[i].exe_path);
+        rows.status_rows[i] = results[i].status;
+    }
+
+    write_results_rows(&rows, "results.txt");
+
+    free(rows.names);
+    free(rows.status_rows);
+}
+
+
+void write_usage_to_file(autograder_results_t *results, int num_executables, int total_params, char *usage_file) {
+    FILE *file = fopen(usage_file, "w");
     if (!file) {
         perror("Failed to open file");
         return;
     }
 
-    // Find the longest executable name (for formatting purposes)
     int longest_len = 0;
     for (int i = 0; i < num_executables; i++) {
-        char *exe_name = get_exe_name(results[i].exe_path);
-        int len = strlen(exe_name);
+        int len = strlen(get_result_name(results[i].exe_path));
         if (len > longest_len) {
             longest_len = len;
         }
     }
 
-    // Sort the results data structure by executable name (specifically number at the end)
     for (int i = 0; i < num_executables; i++) {
-        for (int j = i + 1; j < num_executables; j++) {
-            char *exe_name_i = get_exe_name(results[i].exe_path);
-            int num_i = atoi(strrchr(exe_name_i, '_') + 1);
-            char *exe_name_j = get_exe_name(results[j].exe_path);
-            int num_j = atoi(strrchr(exe_name_j, '_') + 1);
-            if (num_i > num_j) {
-                autograder_results_t temp = results[i];
-                results[i] = results[j];
-                results[j] = temp;
-            }
-        }
-    }
-
-    // Write results to file
-    for (int i = 0; i < num_executables; i++) {
-        char *exe_name = get_exe_name(results[i].exe_path);
-
-        char format[20];
-        snprintf(format, sizeof(format), "%%-%ds:", longest_len);
-        fprintf(file, format, exe_name);  // Write the program path
+        fprintf(file, "%-*s:", longest_len, get_result_name(results[i].exe_path));
         for (int j = 0; j < total_params; j++) {
-            fprintf(file, "%5d (", results[i].params_tested[j]);  // Write the pi value for the program
-            const char* message = get_status_message(results[i].status[j]);
-            fprintf(file, "%9s) ", message);  // Write each status
+            fprintf(file, "%5d (%8.1fms ", results[i].params_tested[j], results[i].cpu_usec[j] / 1000.0);
+            if (results[i].memory_peak[j] >= 0) {
+                fprintf(file, "%8ldK) ", results[i].memory_peak[j] / 1024);
+            } else {
+                fprintf(file, "%8s ) ", "-");
+            }
         }
         fprintf(file, "\n");
     }
@@ -335,38 +855,57 @@ double get_score(char *result_line) {
 }
 
 
-void write_scores_to_file(autograder_results_t *results, int num_executables, char *results_file) {
-    FILE *file = fopen(results_file, "r");
-    for (int i = 0; i < num_executables; i++) {
-        char *line = NULL;
-        size_t len = 0;
-        getline(&line, &len, file);
-        double student_score = get_score(line);
+// Number of cells in row equal to status. Sixteen cells are compared per vector operation; a true
+// lane compares to -1, so subtracting the mask counts matches. A byte lane holds at most 255, so
+// the lanes are summed every 255 vectors.
+static int count_status(const uint8_t *row, int n, int status) {
+    typedef uint8_t byte16_t __attribute__((vector_size(16)));
+    byte16_t target;
+    memset(&target, status, sizeof(target));
+    int count = 0;
+    int j = 0;
+    while (j + 16 <= n) {
+        byte16_t matches = { 0 };
+        for (int vectors = 0; vectors < 255 && j + 16 <= n; vectors++, j += 16) {
+            byte16_t cells;
+            memcpy(&cells, row + j, sizeof(cells));
+            matches -= (byte16_t) (cells == target);
+        }
+        for (int lane = 0; lane < 16; lane++) {
+            count += matches[lane];
+        }
+    }
+    for (; j < n; j++) {
+        count += row[j] == status;
+    }
+    return count;
+}
 
-        char *student_exe = get_exe_name(results[i].exe_path);
 
-        char score_file[] = "scores.txt";
+void write_scores_to_file(autograder_results_t *results, int num_executables, int total_params, char *scores_file) {
+    FILE *score_fp = fopen(scores_file, "w");
+    if (!score_fp) {
+        perror("Failed to open score file");
+        exit(1);
+    }
+    // One large buffer, so the whole file goes out in a few writes
+    setvbuf(score_fp, NULL, _IOFBF, 1 << 20);
 
-        FILE *score_fp;
-        if (i == 0)
-            score_fp = fopen(score_file, "w");
-        else
-            score_fp = fopen(score_file, "a");
+    int longest_len = get_longest_len_executable(results, num_executables);
+    for (int i = 0; i < num_executables; i++) {
+        int correct = count_status(results[i].status, total_params, CORRECT);
+        double student_score = total_params > 0 ? (double) correct / total_params : 0.0;
 
-        if (!score_fp) {
-            perror("Failed to open score file");
-            exit(1);
+        fprintf(score_fp, "%-*s: %5.3f (%d %s", longest_len, get_result_name(results[i].exe_path), student_score,
+                correct, get_status_message(CORRECT));
+        for (int status = INCORRECT; status <= INFINITE_LOOP; status++) {
+            fprintf(score_fp, ", %d %s", count_status(results[i].status, total_params, status), get_status_message(status));
         }
+        fprintf(score_fp, ")\n");
+    }
 
-        int longest_len = get_longest_len_executable(results, num_executables);
-
-        char format[20];
-        snprintf(format, sizeof(format), "%%-%ds: ", longest_len);
-        fprintf(score_fp, format, student_exe);
-        fprintf(score_fp, "%5.3f\n", student_score);
-
-        fclose(score_fp);
-        free(line);
+    if (fclose(score_fp) == EOF) {
+        perror("Failed to write score file");
+        exit(1);
     }
-    fclose(file);
 }
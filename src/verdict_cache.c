@@ -0,0 +1,327 @@
+#include "utils.h"
+#include "verdict_cache.h"
+
+#include <ctype.h>
+#include <sys/mman.h>
+
+#define VERDICT_CACHE_INITIAL_CAPACITY 256
+#define FNV_OFFSET 1469598103934665603UL
+#define FNV_PRIME 1099511628211UL
+
+
+// FNV-1a hash of a string, continuing from hash
+static uint64_t hash_string(uint64_t hash, const char *s) {
+    for (; *s != '\0'; s++) {
+        hash ^= (unsigned char) *s;
+        hash *= FNV_PRIME;
+    }
+    return hash;
+}
+
+
+// Fold one more word into an FNV-1a style hash
+static uint64_t hash_word(uint64_t hash, uint64_t word) {
+    hash ^= word;
+    hash *= FNV_PRIME;
+    return hash ^ (hash >> 29);
+}
+
+
+static uint64_t hash_key(const char *exe_path, const content_digest_t *digest, int input_mode, long timeout_ms,
+                         long cpu_budget_ms, const char *param) {
+    uint64_t hash = hash_string(FNV_OFFSET, exe_path);
+    uint64_t digest_word;
+    memcpy(&digest_word, digest->bytes, sizeof(digest_word));   // Any 8 bytes of a digest spread well
+    hash = hash_word(hash, digest_word);
+    hash = hash_word(hash, (uint64_t) input_mode);
+    hash = hash_word(hash, (uint64_t) timeout_ms);
+    hash = hash_word(hash, (uint64_t) cpu_budget_ms);
+    return hash_string(hash, param);
+}
+
+
+// Find the bucket holding the key, or the empty bucket where it would be inserted
+static int find_bucket(verdict_cache_t *cache, const char *exe_path, const content_digest_t *digest,
+                       int input_mode, long timeout_ms, long cpu_budget_ms, const char *param) {
+    int mask = cache->capacity - 1;
+    int idx = hash_key(exe_path, digest, input_mode, timeout_ms, cpu_budget_ms, param) & mask;
+    for (;; idx = (idx + 1) & mask) {
+        verdict_entry_t *entry = &cache->entries[idx];
+        if (entry->exe_path == NULL || (memcmp(&entry->digest, digest, sizeof(*digest)) == 0
+                && entry->input_mode == input_mode && entry->timeout_ms == timeout_ms && entry->cpu_budget_ms == cpu_budget_ms
+                && strcmp(entry->param, param) == 0 && strcmp(entry->exe_path, exe_path) == 0)) {
+            return idx;
+        }
+    }
+}
+
+
+static void grow_table(verdict_cache_t *cache, int capacity) {
+    verdict_entry_t *old_entries = cache->entries;
+    int old_capacity = cache->capacity;
+
+    cache->entries = calloc(capacity, sizeof(verdict_entry_t));
+    if (cache->entries == NULL) {
+        fprintf(stderr, "Error occured at line %d: calloc failed\n", __LINE__ - 2);
+        exit(EXIT_FAILURE);
+    }
+    cache->capacity = capacity;
+
+    for (int i = 0; i < old_capacity; i++) {
+        verdict_entry_t *entry = &old_entries[i];
+        if (entry->exe_path != NULL) {
+            int idx = find_bucket(cache, entry->exe_path, &entry->digest, entry->input_mode, entry->timeout_ms,
+                                  entry->cpu_budget_ms, entry->param);
+            cache->entries[idx] = *entry;
+        }
+    }
+    free(old_entries);
+}
+
+
+// Find exe_path's bucket in the table of current versions, or the empty bucket where it would go
+static int find_version(verdict_cache_t *cache, const char *exe_path) {
+    int mask = cache->versions_capacity - 1;
+    int idx = hash_string(FNV_OFFSET, exe_path) & mask;
+    while (cache->versions[idx].exe_path != NULL && strcmp(cache->versions[idx].exe_path, exe_path) != 0) {
+        idx = (idx + 1) & mask;
+    }
+    return idx;
+}
+
+
+static void grow_versions(verdict_cache_t *cache, int capacity) {
+    verdict_version_t *old_versions = cache->versions;
+    int old_capacity = cache->versions_capacity;
+
+    cache->versions = calloc(capacity, sizeof(verdict_version_t));
+    if (cache->versions == NULL) {
+        fprintf(stderr, "Error occured at line %d: calloc failed\n", __LINE__ - 2);
+        exit(EXIT_FAILURE);
+    }
+    cache->versions_capacity = capacity;
+
+    for (int i = 0; i < old_capacity; i++) {
+        if (old_versions[i].exe_path != NULL) {
+            cache->versions[find_version(cache, old_versions[i].exe_path)] = old_versions[i];
+        }
+    }
+    free(old_versions);
+}
+
+
+int digest_executable(const char *path, content_digest_t *digest) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        return -1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) == -1) {
+        close(fd);
+        return -1;
+    }
+
+    sha256_t ctx;
+    sha256_init(&ctx);
+    if (st.st_size > 0) {
+        const unsigned char *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED) {
+            close(fd);
+            return -1;
+        }
+        madvise((void *) data, st.st_size, MADV_SEQUENTIAL);
+        sha256_update(&ctx, data, st.st_size);
+        munmap((void *) data, st.st_size);
+    }
+    close(fd);
+    sha256_final(&ctx, digest->bytes);
+    return 0;
+}
+
+
+void format_digest(const content_digest_t *digest, char *hex) {
+    for (int i = 0; i < SHA256_DIGEST_SIZE; i++) {
+        snprintf(hex + 2 * i, 3, "%02x", digest->bytes[i]);
+    }
+}
+
+
+int parse_digest(const char *hex, content_digest_t *digest) {
+    for (int i = 0; i < SHA256_DIGEST_SIZE; i++) {
+        unsigned int byte;
+        if (!isxdigit((unsigned char) hex[2 * i]) || !isxdigit((unsigned char) hex[2 * i + 1])
+                || sscanf(hex + 2 * i, "%2x", &byte) != 1) {
+            return -1;
+        }
+        digest->bytes[i] = byte;
+    }
+    return 0;
+}
+
+
+void verdict_cache_retain(verdict_cache_t *cache, const char *exe_path, const content_digest_t *digest) {
+    // Keep the load factor at or below 1/2
+    if ((cache->versions_count + 1) * 2 > cache->versions_capacity) {
+        grow_versions(cache, cache->versions_capacity * 2);
+    }
+    int idx = find_version(cache, exe_path);
+    if (cache->versions[idx].exe_path == NULL) {
+        cache->versions[idx].exe_path = strdup(exe_path);
+        if (cache->versions[idx].exe_path == NULL) {
+            fprintf(stderr, "Error occured at line %d: strdup failed\n", __LINE__ - 2);
+            exit(EXIT_FAILURE);
+        }
+        cache->versions_count++;
+    }
+    cache->versions[idx].digest = *digest;
+}
+
+
+int verdict_cache_lookup(verdict_cache_t *cache, const char *exe_path, const content_digest_t *digest,
+                         int input_mode, long timeout_ms, long cpu_budget_ms, const char *param) {
+    int idx = find_bucket(cache, exe_path, digest, input_mode, timeout_ms, cpu_budget_ms, param);
+    return cache->entries[idx].exe_path != NULL ? cache->entries[idx].status : 0;
+}
+
+
+void verdict_cache_store(verdict_cache_t *cache, const char *exe_path, const content_digest_t *digest,
+                         int input_mode, long timeout_ms, long cpu_budget_ms, const char *param, int status) {
+    if (!VERDICT_CACHEABLE(status)) {
+        return;
+    }
+    // Keep the load factor at or below 1/2
+    if ((cache->count + 1) * 2 > cache->capacity) {
+        grow_table(cache, cache->capacity * 2);
+    }
+    int idx = find_bucket(cache, exe_path, digest, input_mode, timeout_ms, cpu_budget_ms, param);
+    verdict_entry_t *entry = &cache->entries[idx];
+    if (entry->exe_path == NULL) {
+        entry->exe_path = strdup(exe_path);
+        entry->param = strdup(param);
+        if (entry->exe_path == NULL || entry->param == NULL) {
+            fprintf(stderr, "Error occured at line %d: strdup failed\n", __LINE__ - 3);
+            exit(EXIT_FAILURE);
+        }
+        entry->digest = *digest;
+        entry->input_mode = input_mode;
+        entry->timeout_ms = timeout_ms;
+        entry->cpu_budget_ms = cpu_budget_ms;
+        cache->count++;
+    }
+    entry->status = status;
+}
+
+
+verdict_cache_t *load_verdict_cache(const char *path) {
+    verdict_cache_t *cache = malloc(sizeof(verdict_cache_t));
+    if (cache == NULL) {
+        fprintf(stderr, "Error occured at line %d: malloc failed\n", __LINE__ - 2);
+        exit(EXIT_FAILURE);
+    }
+    cache->path = strdup(path);
+    cache->entries = calloc(VERDICT_CACHE_INITIAL_CAPACITY, sizeof(verdict_entry_t));
+    cache->versions = calloc(VERDICT_CACHE_INITIAL_CAPACITY, sizeof(verdict_version_t));
+    if (cache->path == NULL || cache->entries == NULL || cache->versions == NULL) {
+        fprintf(stderr, "Error occured at line %d: allocation failed\n", __LINE__ - 1);
+        exit(EXIT_FAILURE);
+    }
+    cache->capacity = VERDICT_CACHE_INITIAL_CAPACITY;
+    cache->count = 0;
+    cache->versions_capacity = VERDICT_CACHE_INITIAL_CAPACITY;
+    cache->versions_count = 0;
+
+    FILE *file = fopen(path, "r");
+    if (file == NULL) {
+        if (errno != ENOENT) {
+            perror("Failed to open verdict cache");
+        }
+        return cache;
+    }
+
+    // VERDICT_CACHE_VERSION, then one line per pair:
+    // "<digest> <input_mode> <timeout_ms> <cpu_budget_ms> <param> <status> <exe_path>", the param as given
+    char *line = NULL;
+    size_t len = 0;
+    ssize_t nread;
+    // A file written by another version of the grader is ignored, so every pair is graded again
+    int current = getline(&line, &len, file) != -1 && strcmp(line, VERDICT_CACHE_VERSION "\n") == 0;
+    while (current && (nread = getline(&line, &len, file)) != -1) {
+        char hex[CONTENT_DIGEST_HEX_SIZE];
+        content_digest_t digest;
+        int input_mode, status;
+        long timeout_ms, cpu_budget_ms;
+        int param_start, param_end, offset;
+        if (nread > 0 && line[nread - 1] == '\n') {
+            line[nread - 1] = '\0';
+        }
+        if (sscanf(line, "%64s %d %ld %ld %n%*s%n %d %n", hex, &input_mode, &timeout_ms, &cpu_budget_ms,
+                   &param_start, &param_end, &status, &offset) != 5
+                || strlen(hex) != CONTENT_DIGEST_HEX_SIZE - 1 || parse_digest(hex, &digest) == -1 || line[offset] == '\0' || !VERDICT_CACHEABLE(status)) {
+            continue;  // Skip malformed lines; those pairs are simply graded again
+        }
+        line[param_end] = '\0';   // the parameter is the token before the status
+        verdict_cache_store(cache, line + offset, &digest, input_mode, timeout_ms, cpu_budget_ms, line + param_start, status);
+    }
+    free(line);
+    fclose(file);
+
+    return cache;
+}
+
+
+void save_verdict_cache(verdict_cache_t *cache) {
+    int len_tmp_path = strlen(cache->path) + strlen(".tmp") + 1;  // +1 for the null terminator
+    char *tmp_path = malloc(len_tmp_path);
+    if (tmp_path == NULL) {
+        fprintf(stderr, "Error occured at line %d: malloc failed\n", __LINE__ - 2);
+        exit(EXIT_FAILURE);
+    }
+    snprintf(tmp_path, len_tmp_path, "%s.tmp", cache->path);
+
+    FILE *file = fopen(tmp_path, "w");
+    if (file == NULL) {
+        perror("Failed to save verdict cache");
+        free(tmp_path);
+        return;
+    }
+    fprintf(file, "%s\n", VERDICT_CACHE_VERSION);
+    for (int i = 0; i < cache->capacity; i++) {
+        verdict_entry_t *entry = &cache->entries[i];
+        if (entry->exe_path == NULL) {
+            continue;
+        }
+        // Verdicts of a version that has since been replaced are never looked up again
+        verdict_version_t *version = &cache->versions[find_version(cache, entry->exe_path)];
+        if (version->exe_path != NULL && memcmp(&version->digest, &entry->digest, sizeof(entry->digest)) != 0) {
+            continue;
+        }
+        // A parameter the line format cannot hold is graded again next run
+        if (entry->param[0] == '\0' || entry->param[strcspn(entry->param, " \t\n\v\f\r")] != '\0') {
+            continue;
+        }
+        char hex[CONTENT_DIGEST_HEX_SIZE];
+        format_digest(&entry->digest, hex);
+        fprintf(file, "%s %d %ld %ld %s %d %s\n", hex, entry->input_mode,
+                entry->timeout_ms, entry->cpu_budget_ms, entry->param, entry->status, entry->exe_path);
+    }
+    if (fclose(file) == EOF || rename(tmp_path, cache->path) == -1) {
+        perror("Failed to save verdict cache");
+        unlink(tmp_path);
+    }
+    free(tmp_path);
+}
+
+
+void free_verdict_cache(verdict_cache_t *cache) {
+    for (int i = 0; i < cache->capacity; i++) {
+        free(cache->entries[i].exe_path);
+        free(cache->entries[i].param);
+    }
+    for (int i = 0; i < cache->versions_capacity; i++) {
+        free(cache->versions[i].exe_path);
+    }
+    free(cache->entries);
+    free(cache->versions);
+    free(cache->path);
+    free(cache);
+}
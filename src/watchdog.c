@@ -0,0 +1,255 @@
+#include "utils.h"
+#include "watchdog.h"
+
+#include <sys/timerfd.h>
+#include <sys/syscall.h>
+
+
+watchdog_t *create_watchdog(int num_slots) {
+    watchdog_t *watchdog = malloc(sizeof(watchdog_t));
+    if (watchdog == NULL) {
+        fprintf(stderr, "Error occured at line %d: malloc failed\n", __LINE__ - 2);
+        exit(EXIT_FAILURE);
+    }
+    watchdog->num_slots = num_slots;
+    watchdog->watched = malloc(num_slots * sizeof(int));
+    watchdog->blocked_since = malloc(num_slots * sizeof(long));
+    watchdog->verdict = malloc(num_slots * sizeof(int));
+    watchdog->cpu_base = malloc(num_slots * sizeof(unsigned long));
+    if (watchdog->watched == NULL || watchdog->blocked_since == NULL || watchdog->verdict == NULL || watchdog->cpu_base == NULL) {
+        fprintf(stderr, "Error occured at line %d: malloc failed\n", __LINE__ - 2);
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < num_slots; i++) {
+        watchdog->watched[i] = 0;
+        watchdog->blocked_since[i] = -1;
+        watchdog->verdict[i] = 0;
+        watchdog->cpu_base[i] = 0;
+    }
+
+    watchdog->clock_ticks = sysconf(_SC_CLK_TCK);
+    if (watchdog->clock_ticks <= 0) {
+        watchdog->clock_ticks = 100;
+    }
+
+    watchdog->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+    if (watchdog->timer_fd == -1) {
+        perror("timerfd_create");
+        exit(EXIT_FAILURE);
+    }
+    struct itimerspec spec;
+    spec.it_value.tv_sec = 0;
+    spec.it_value.tv_nsec = WATCHDOG_INTERVAL_MS * 1000000L;
+    spec.it_interval = spec.it_value;
+    if (timerfd_settime(watchdog->timer_fd, 0, &spec, NULL) == -1) {
+        perror("timerfd_settime");
+        exit(EXIT_FAILURE);
+    }
+
+    return watchdog;
+}
+
+
+void watchdog_watch(watchdog_t *watchdog, int slot) {
+    watchdog->watched[slot] = 1;
+    watchdog->blocked_since[slot] = -1;
+    watchdog->verdict[slot] = 0;
+    watchdog->cpu_base[slot] = 0;
+}
+
+
+void watchdog_forget(watchdog_t *watchdog, int slot) {
+    watchdog->watched[slot] = 0;
+}
+
+
+int watchdog_verdict(watchdog_t *watchdog, int slot) {
+    return watchdog->verdict[slot];
+}
+
+
+// Read a small /proc file into buffer. Returns the number of bytes read, -1 if the process is gone.
+static int read_proc_file(const char *path, char *buffer, int size) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        return -1;
+    }
+    ssize_t bytes_read = read(fd, buffer, size - 1);
+    close(fd);
+    if (bytes_read < 0) {
+        return -1;
+    }
+    buffer[bytes_read] = '\0';
+    return bytes_read;
+}
+
+
+// Parse the fields we need from /proc/<pid>/stat (or /proc/<pid>/task/<tid>/stat).
+// The command name is in parentheses and may contain anything, so parsing starts after the last ')'.
+static int read_stat(const char *path, char *state, unsigned long *cpu_ticks, long *num_threads) {
+    char buffer[1024];
+    if (read_proc_file(path, buffer, sizeof(buffer)) <= 0) {
+        return -1;
+    }
+    char *fields = strrchr(buffer, ')');
+    if (fields == NULL) {
+        return -1;
+    }
+    unsigned long utime;
+    unsigned long stime;
+    if (sscanf(fields + 2, "%c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu %*d %*d %*d %*d %ld",
+               state, &utime, &stime, num_threads) != 4) {
+        return -1;
+    }
+    *cpu_ticks = utime + stime;
+    return 0;
+}
+
+
+// Whether the process is blocked in pause() or sigsuspend(), i.e. waiting for a signal nobody will send
+static int blocked_in_pause(pid_t pid) {
+    char path[64];
+    char buffer[128];
+
+    snprintf(path, sizeof(path), "/proc/%d/wchan", pid);
+    if (read_proc_file(path, buffer, sizeof(buffer)) > 0 && strcmp(buffer, "0") != 0) {
+        return strstr(buffer, "pause") != NULL || strstr(buffer, "sigsuspend") != NULL;
+    }
+
+    // No symbol names in wchan (e.g. kallsyms hidden): fall back to the syscall the process is in
+    snprintf(path, sizeof(path), "/proc/%d/syscall", pid);
+    if (read_proc_file(path, buffer, sizeof(buffer)) <= 0) {
+        return 0;
+    }
+    long nr = atol(buffer);
+    #ifdef SYS_pause
+        if (nr == SYS_pause) {
+            return 1;
+        }
+    #endif
+    return nr == SYS_rt_sigsuspend;
+}
+
+
+// Whether every thread of a multithreaded process is asleep (a single-threaded one was checked already)
+static int all_threads_sleeping(pid_t pid) {
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%d/task", pid);
+    DIR *dir = opendir(path);
+    if (dir == NULL) {
+        return 0;
+    }
+    int sleeping = 1;
+    struct dirent *entry;
+    while (sleeping && (entry = readdir(dir)) != NULL) {
+        if (entry->d_name[0] == '.') {
+            continue;
+        }
+        char task_path[PATH_MAX];
+        char state;
+        unsigned long cpu_ticks;
+        long num_threads;
+        snprintf(task_path, sizeof(task_path), "/proc/%d/task/%s/stat", pid, entry->d_name);
+        if (read_stat(task_path, &state, &cpu_ticks, &num_threads) == 0 && state != 'S') {
+            sleeping = 0;
+        }
+    }
+    closedir(dir);
+    return sleeping;
+}
+
+
+// Classify one child: STUCK, INFINITE_LOOP or 0 (still undecided)
+static int classify(watchdog_t *watchdog, int slot, pid_t pid, long now) {
+    char path[64];
+    char state;
+    unsigned long cpu_ticks;
+    long num_threads;
+    snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+    if (read_stat(path, &state, &cpu_ticks, &num_threads) == -1 || state == 'Z') {
+        // Exited, about to be reaped
+        return 0;
+    }
+
+    if ((cpu_ticks - watchdog->cpu_base[slot]) * 1000 / watchdog->clock_ticks >= WATCHDOG_CPU_BUDGET_MS) {
+        return INFINITE_LOOP;
+    }
+
+    if (state == 'S' && blocked_in_pause(pid) && (num_threads == 1 || all_threads_sleeping(pid))) {
+        if (watchdog->blocked_since[slot] == -1) {
+            watchdog->blocked_since[slot] = now;
+        } else if (now - watchdog->blocked_since[slot] >= WATCHDOG_STUCK_MS) {
+            return STUCK;
+        }
+    } else {
+        watchdog->blocked_since[slot] = -1;
+    }
+    return 0;
+}
+
+
+void watchdog_rewatch(watchdog_t *watchdog, int slot, pid_t pid) {
+    watchdog_watch(watchdog, slot);
+    char path[64];
+    char state;
+    long num_threads;
+    snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+    if (read_stat(path, &state, &watchdog->cpu_base[slot], &num_threads) == -1) {
+        watchdog->cpu_base[slot] = 0;
+    }
+}
+
+
+void watchdog_expire(watchdog_t *watchdog, int slot, pid_t pid) {
+    if (!watchdog->watched[slot] || watchdog->verdict[slot] != 0) {
+        return;
+    }
+    char path[64];
+    char state;
+    unsigned long cpu_ticks;
+    long num_threads;
+    snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+    if (read_stat(path, &state, &cpu_ticks, &num_threads) == -1) {
+        return;
+    }
+    if (state == 'R') {
+        watchdog->verdict[slot] = INFINITE_LOOP;
+    } else if (state == 'S' && blocked_in_pause(pid)) {
+        watchdog->verdict[slot] = STUCK;
+    }
+}
+
+
+void watchdog_sample(watchdog_t *watchdog, pid_t *pids) {
+    // Drain the expiration count so the fd stops polling readable
+    unsigned long long expirations;
+    if (read(watchdog->timer_fd, &expirations, sizeof(expirations)) == -1 && errno != EAGAIN) {
+        perror("read timerfd");
+        exit(EXIT_FAILURE);
+    }
+
+    long now = get_time_ms();
+    for (int slot = 0; slot < watchdog->num_slots; slot++) {
+        if (!watchdog->watched[slot] || watchdog->verdict[slot] != 0 || pids[slot] == -1) {
+            continue;
+        }
+        int verdict = classify(watchdog, slot, pids[slot], now);
+        if (verdict != 0) {
+            watchdog->verdict[slot] = verdict;
+            if (kill(pids[slot], SIGKILL) == -1 && errno != ESRCH) {
+                perror("kill");
+                exit(EXIT_FAILURE);
+            }
+        }
+    }
+}
+
+
+void free_watchdog(watchdog_t *watchdog) {
+    close(watchdog->timer_fd);
+    free(watchdog->watched);
+    free(watchdog->blocked_since);
+    free(watchdog->verdict);
+    free(watchdog->cpu_base);
+    free(watchdog);
+}
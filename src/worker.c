@@ -1,344 +1,432 @@
 #include "utils.h"
-
-// Run the (executable, parameter) pairs in batches of 8 to avoid timeouts due to 
-// having too many child processes running at once
+#include "reaper.h"
+#include "launcher.h"
+#include "concurrency.h"
+#include "shmring.h"
+#include "placement.h"
+#include "session.h"
+
+#include <sys/timerfd.h>
+
+// Run at most 8 (executable, parameter) pairs at once to avoid timeouts due to 
+// having too many child processes running at once. Within that, the concurrency
+// controller decides how many actually run (see concurrency.h).
 #define PAIRS_BATCH_SIZE 8
 
 typedef struct {
     char *executable_path;
     int parameter;
     int status;
+    uint32_t exe_id;       // where the autograder stores the result (see mq_result_t)
+    uint16_t param_idx;
+    long duration_ms;
 } pairs_t;
 
-// Store the pairs tested by this worker and the results
-pairs_t *pairs;
+// Slots in use: PAIRS_BATCH_SIZE, or one per CPU of the worker if that is fewer and slots are pinned
+int num_slots;
 
-// Information about the child processes and their results
-pid_t *pids;
-int *child_status;     // Contains status of child processes (-1 for done, 1 for still running)
+// The pair running in each slot and its result
+pairs_t *pairs;
 
-int curr_batch_size;   // At most PAIRS_BATCH_SIZE (executable, parameter) pairs will be run at once
-long worker_id;        // Used for sending/receiving messages from the message queue
+// Information about the child processes running in each slot
+int *child_status;     // Contains status of the child in each slot (-1 for idle, 1 for still running)
+spawn_plan_t *slot_plan;                      // Launch plan of the pair running in each slot
+char (*slot_param)[MAX_INT_CHARS + 2];        // Parameter of each slot as a string (+2 for sign and null terminator)
+long *slot_start;      // Monotonic time (ms) at which the child in each slot was launched
+
+// With --pin, every slot's children run on a CPU of their own from the CPUs the autograder gave us
+int pin_slots;
+int *worker_cpus;      // CPUs this worker may use; slot j runs its children on worker_cpus[j]
+int num_worker_cpus;
+
+long worker_id;        // Which of the shared channels is ours (channels->channels[worker_id - 1])
+
+// Rings and work queue shared with mq_autograder (see shmring.h)
+shm_channels_t *channels;
+shm_channel_t *channel;
+pid_t autograder_pid;  // To notice the autograder going away while we wait on it
+
+// Results not sent yet, laid out as the MQ_RESULTS record that carries them
+struct {
+    mq_results_header_t header;
+    mq_result_t records[MQ_RESULTS_BATCH];
+} batch;
+int flush_fd;          // timerfd, armed for MQ_RESULTS_FLUSH_MS by the first result of a batch; wakes the reaper or sessions
+
+// Reaps children in the order they finish and enforces their deadlines - same as in autograder.c
+reaper_t *reaper;
+
+// Limits the children in flight from CPU quota and pressure - same as in autograder.c
+concurrency_t *concurrency;
+
+// In session mode (channels->session_params != 0): the persistent process of each slot's executable,
+// and the run of pairs each slot has claimed (see shm_claim_run())
+session_pool_t *sessions;
+int *slot_run;         // Index of the run's first pair in the queue, -1 for idle slots
+int *slot_run_len;
+int *slot_next;        // Pair of the run being answered, counted from its first
+
+
+// Stop if the autograder is gone: nobody is left to read our results
+void check_autograder_alive() {
+    if (getppid() != autograder_pid) {
+        fprintf(stderr, "Worker %ld: autograder exited\n", worker_id);
+        exit(EXIT_FAILURE);
+    }
+}
 
 
-// TODO: Timeout handler for alarm signal - should be the same as the one in autograder.c
-void timeout_handler(int signum) {
-    for (int j = 0; j < curr_batch_size; j++) {
-        if (child_status[j] == 1) {  // Checks if child is still running
-            if (kill(pids[j], SIGKILL) == -1) {  // does check on kill signal to see if successful
-                perror("Kill Failed");
-                exit(EXIT_FAILURE);
-            }
+// Wait for the next record from the autograder. It stays in the ring until shm_ring_consume().
+const char *receive_record(uint32_t *type, uint32_t *length) {
+    const char *payload;
+    while ((payload = shm_ring_peek(&channel->dispatch, type, length)) == NULL) {
+        uint32_t seq = shm_prepare_wait(&channel->waiter);
+        if ((payload = shm_ring_peek(&channel->dispatch, type, length)) != NULL) {
+            shm_cancel_wait(&channel->waiter);
+            break;
         }
+        shm_wait(&channel->waiter, seq, SHM_WAIT_MS);
+        check_autograder_alive();
     }
+    return payload;
 }
 
 
-// Execute the student's executable using exec()
-void execute_solution(char *executable_path, int param, int batch_idx) {
- 
-    pid_t pid = fork();
+// Send a record to the autograder, waiting for room in our results ring
+void send_record(uint32_t type, const void *payload, uint32_t length) {
+    while (shm_ring_try_send(&channel->results, &channels->waiter, type, payload, length) == -1) {
+        uint32_t seq = shm_prepare_wait(&channel->waiter);
+        if (shm_ring_try_send(&channel->results, &channels->waiter, type, payload, length) == 0) {
+            shm_cancel_wait(&channel->waiter);
+            return;
+        }
+        shm_wait(&channel->waiter, seq, SHM_WAIT_MS);
+        check_autograder_alive();
+    }
+}
 
-    // Child process
-    if (pid == 0) {
-        char *executable_name = get_exe_name(executable_path);
 
-        // TODO: Redirect STDOUT to output/<executable>.<param> file
-        char param_str[20];
-        sprintf(param_str, "%d", param);
-        int len_output_path = strlen("output/") + strlen(executable_name) + strlen(param_str) + 2;  // +2 for the null terminator and the dot
-        char *output_path = malloc(len_output_path);
-        if (output_path == NULL) {
-            fprintf(stderr, "Error occured at line %d: malloc failed\n", __LINE__ - 2);
-            exit(EXIT_FAILURE);
-        }
-        snprintf(output_path, len_output_path, "output/%s.%s", executable_name, param_str);
+// Execute the student's executable using posix_spawn()
+void execute_solution(char *executable_path, int param, int slot) {
+    // TODO: Capture STDOUT through a pipe
+    // TODO: Input to child program can be handled as in the EXEC case (see template.c)
+    snprintf(slot_param[slot], sizeof(slot_param[slot]), "%d", param);
+    init_spawn_plan(&slot_plan[slot], executable_path, slot_param[slot], INPUT_EXEC, -1);
 
-        int fd;
-        if ((fd = open(output_path, O_CREAT | O_WRONLY | O_TRUNC, 0644)) == -1) {
-            free(output_path);
-            fprintf(stderr, "Error occured at line %d: open failed\n", __LINE__ - 2);
-            exit(EXIT_FAILURE);
-        }
-        if (dup2(fd, STDOUT_FILENO) == -1) {
-            fprintf(stderr, "Error occured at line %d: dup2 failed\n", __LINE__ - 1);
-            exit(EXIT_FAILURE);
-        }
-        if (close(fd) == -1) {
-            fprintf(stderr, "Error occured at line %d: close failed\n", __LINE__ - 1);
-            exit(EXIT_FAILURE);
-        }
-        free(output_path);
-        
-        // TODO: Input to child program can be handled as in the EXEC case (see template.c)
-        execl(executable_path, executable_name, param_str, NULL);
-        perror("Failed to execute program in worker");
-        exit(1);
+    // The child inherits our affinity, so narrow it to the slot's CPU just for the spawn
+    if (pin_slots && set_cpu_affinity(0, &worker_cpus[slot], 1) == -1) {
+        perror("Failed to pin slot");
     }
-    // Parent process
-    else if (pid > 0) {
-        pids[batch_idx] = pid;
+    pid_t pid = spawn_solution(&slot_plan[slot], reaper_child_sigmask());
+    if (pin_slots && set_cpu_affinity(0, worker_cpus, num_worker_cpus) == -1) {
+        perror("Failed to restore affinity");
     }
-    // Fork failed
-    else {
-        perror("Failed to fork");
-        exit(1);
+
+    child_status[slot] = 1;
+    slot_start[slot] = get_time_ms();
+    if (pid == -1) {
+        reaper_add_failed(reaper, slot, INCORRECT);   // cannot be started
+        return;
     }
+    reaper_add(reaper, slot, pid, slot_plan[slot].output_fd, -1, TIMEOUT_MS);
 }
 
 
-// Wait for the batch to finish and check results
-void monitor_and_evaluate_solutions(int finished) {
-    // Keep track of finished processes for alarm handler
-    child_status = malloc(curr_batch_size * sizeof(int));
-    for (int j = 0; j < curr_batch_size; j++) {
-        child_status[j] = 1;
+// Wait for the next child to finish (or time out) and check its result. Returns its slot, which
+// is also the index of its pair in pairs, or -1 if the batch of results is due first.
+int monitor_and_evaluate_solutions() {
+    int status;
+    int slot = reaper_wait(reaper, &status);
+    if (slot == -1) {
+        return -1;
     }
+    pairs[slot].duration_ms = get_time_ms() - slot_start[slot];
+    concurrency_record(concurrency, reaper_cpu_usec(reaper, slot), pairs[slot].duration_ms);
+
+    // TODO: Check if the process finished normally, segfaulted, or timed out and update the 
+    //       pairs array with the results. Use the macros defined in the enum in utils.h for 
+    //       the status field of the pairs_t struct (e.g. CORRECT, INCORRECT, SEGFAULT, etc.)
+    //       This should be the same as the evaluation in autograder.c, just updating `pairs` 
+    //       instead of `results`.
+    // A child the watchdog classified early was killed, so its wait status alone would read as a timeout
+    int final_status = reaper_verdict(reaper, slot);
+    if (final_status == 0) {
+        final_status = get_verdict(status, reaper_output(reaper, slot));
+    }
+    pairs[slot].status = final_status;
 
-    // MAIN EVALUATION LOOP: Wait until each process has finished or timed out
-    for (int j = 0; j < curr_batch_size; j++) {
-        char *current_exe_path = pairs[finished + j].executable_path;
-        int current_param = pairs[finished + j].parameter;
-
-        int status;
-        pid_t pid;
-        // TODO: What if waitpid is interrupted by a signal?
-        do {
-            pid = waitpid(pids[j], &status, 0);
-            if (pid == -1 && errno != EINTR) {
-                perror("waitpid");
-                exit(EXIT_FAILURE);
-            }
-        } while (pid == -1 && errno == EINTR);
-
-        int exit_status = WEXITSTATUS(status);
-        int exited = WIFEXITED(status);
-        int signaled = WIFSIGNALED(status);
-
-        // TODO: Check if the process finished normally, segfaulted, or timed out and update the 
-        //       pairs array with the results. Use the macros defined in the enum in utils.h for 
-        //       the status field of the pairs_t struct (e.g. CORRECT, INCORRECT, SEGFAULT, etc.)
-        //       This should be the same as the evaluation in autograder.c, just updating `pairs` 
-        //       instead of `results`.
-        int final_status = NULL;
-        if (signaled) {
-            if (WTERMSIG(status) == SIGSEGV) {
-                final_status = SEGFAULT;
-            } else {
-                final_status = STUCK_OR_INFINITE;
-            }
-        } else if (exited) {
-            char *executable_name = get_exe_name(current_exe_path);
-            char param_str[20];
-            sprintf(param_str, "%d", current_param);
-            int length_output_path = strlen("output/") + strlen(executable_name) + strlen(param_str) + 2;  // +2 for the null terminator and the dot
-            char *output_path = malloc(length_output_path);    // +2 for the null terminator and the dot
-
-            if (output_path == NULL) {
-                fprintf(stderr, "Error occured at line %d: malloc failed\n", __LINE__ - 2);
-                exit(EXIT_FAILURE);
-            }
-            snprintf(output_path, length_output_path, "output/%s.%s", executable_name, param_str);
+    // Mark the slot as idle so the next pair can be launched into it
+    child_status[slot] = -1;
+    return slot;
+}
 
-            int fd;
-            if ((fd = open(output_path, O_RDONLY)) == -1) {
-                free(output_path);
-                fprintf(stderr, "Error occured at line %d: open failed\n", __LINE__ - 3);
-                exit(EXIT_FAILURE);
-            }
-            free(output_path);
-            free(executable_name);
-
-            int bytes_read;
-            char output[MAX_INT_CHARS + 1];  // +1 for the null terminator
-            if ((bytes_read = read(fd, output, MAX_INT_CHARS)) == -1) {
-                perror("Read Failed");
-                exit(EXIT_FAILURE);
-            }
-            if (close(fd) == -1) {
-                perror("close failed");
-                exit(EXIT_FAILURE);
-            }
-            output[bytes_read] = '\0';
-            if (atoi(output) == 0) {
-                final_status = CORRECT;
-            } else if (atoi(output) == 1) {
-                final_status = INCORRECT;
-            } else {
-                perror("Invalid output");
-                exit(EXIT_FAILURE);
-            }
-            
-        }
-        if (final_status == NULL) {
-            perror("No final status received");
-            exit(EXIT_FAILURE);
-        }
-        pairs[finished + j].status = final_status;
 
-        // Mark the process as finished
-        child_status[j] = -1;
-        free(current_exe_path);
+// Arm flush_fd for MQ_RESULTS_FLUSH_MS from now, or disarm it with 0. Setting it also discards an
+// expiry that has not been read yet.
+void set_flush_timer(long ms) {
+    struct itimerspec flush = { { 0, 0 }, { ms / 1000, (ms % 1000) * 1000000L } };
+    if (timerfd_settime(flush_fd, 0, &flush, NULL) == -1) {
+        perror("timerfd_settime");
+        exit(EXIT_FAILURE);
     }
-    
-    free(child_status);
 }
 
 
-// Send results for the current batch back to the autograder
-void send_results(int msqid, long mtype, int finished) {
-    // Format of message should be ("%s %d %d", executable_path, parameter, status)
-    for (int i = 0; i < curr_batch_size; i++) {
-        //Locally declaring executable_path, parameter, & status, for simplicity.
-        char *executable_path = pairs[finished - curr_batch_size + i].executable_path;
-        int parameter = pairs[finished - curr_batch_size + i].parameter;
-        int status = pairs[finished - curr_batch_size + i].status;
-        
-        // Setting up message. 
-        msgbuf_t message;
-        message.mtype = mtype;
-
-        //Setting message text
-        int length_msg = strlen(executable_path) + parameter + status + 3;  // +3 for the null terminator and the 2 spaces
-        char *message_text = malloc(length_msg);
-
-        if (message_text == NULL) {
-            perror("malloc of message_text failed");
-            exit(EXIT_FAILURE);
-        }
+// Send the batched results to the autograder in one record
+void flush_results() {
+    if (batch.header.count == 0) {
+        return;
+    }
+    set_flush_timer(0);
+    batch.header.version = MQ_RESULTS_VERSION;
+    batch.header.record_size = sizeof(mq_result_t);
+    send_record(MQ_RESULTS, &batch, sizeof(batch.header) + batch.header.count * sizeof(mq_result_t));
+    batch.header.count = 0;
+}
 
-        snprintf(message_text, length_msg, "%s %d %d", executable_path, parameter, status);
 
-        strncpy(message.mtext, message_text, MESSAGE_SIZE - 1);
-        message.mtext[MESSAGE_SIZE - 1] = '\0';
-        
-        if (msgsnd(msqid, &message, sizeof(message), 0) == -1) {
-            free(message_text);
-            free(executable_path);
-            perror("Failed to send results");
-            exit(EXIT_FAILURE);
-        }
-        free(message_text);
-        free(executable_path);
+// Add the result of a finished pair to the batch, sending the batch once it is full. A partial
+// batch is sent by the wait that flush_fd ends once its first result is MQ_RESULTS_FLUSH_MS old.
+void send_results(int pair_idx) {
+    if (batch.header.count == 0) {
+        set_flush_timer(MQ_RESULTS_FLUSH_MS);
+    }
+    mq_result_t *record = &batch.records[batch.header.count++];
+    record->exe_id = pairs[pair_idx].exe_id;
+    record->param_idx = pairs[pair_idx].param_idx;
+    record->status = pairs[pair_idx].status;
+    record->reserved = 0;
+    record->duration_ms = pairs[pair_idx].duration_ms;
+
+    if (batch.header.count == MQ_RESULTS_BATCH) {
+        flush_results();
     }
 }
 
 
-// Send DONE message to autograder to indicate that the worker has finished testing
-void send_done_msg(int msqid, long mtype) {
-    msgbuf_t message;
-    message.mtype = mtype;
-    char message_to_send[] = "DONE";
-    strcpy(message.mtext, message_to_send);
-
-    if (msgsnd(msqid, &message, sizeof(message), 0) == -1) {
-        perror("Failed to send DONE");
-        exit(EXIT_FAILURE);
+// Keep up to 8 pairs running and send each result back to autograder as soon as it is known.
+// Every free slot claims the next pair of the shared queue, so the workers that finish early
+// take over the pairs the others have not reached yet.
+void run_pairs() {
+    reaper = create_reaper(num_slots);
+    reaper_wake_on(reaper, flush_fd);
+    shm_pair_t *queue = shm_pairs(channels);
+    int more = 1;
+    int running = 0;
+    while (more || running > 0) {
+        concurrency_update(concurrency);
+        for (int j = 0; j < num_slots && more && running < concurrency_limit(concurrency); j++) {
+            if (child_status[j] == -1) {
+                int pair_idx = shm_claim_pair(channels);
+                if (pair_idx == -1) {
+                    more = 0;
+                    break;
+                }
+                // TODO: Execute the student executable
+                pairs[j].executable_path = (char *) channels + queue[pair_idx].path_offset;
+                pairs[j].parameter = queue[pair_idx].param;
+                pairs[j].exe_id = queue[pair_idx].exe_id;
+                pairs[j].param_idx = queue[pair_idx].param_idx;
+                execute_solution(pairs[j].executable_path, pairs[j].parameter, j);
+                running++;
+            }
+        }
+        if (running == 0) {
+            continue;
+        }
+
+        // TODO: Wait for the next child to finish and check its result
+        int slot = monitor_and_evaluate_solutions();
+        if (slot == -1) {
+            flush_results();
+            continue;
+        }
+        running--;
+
+        // TODO: Send the result (intermediate results) back to autograder
+        send_results(slot);
     }
+    free_reaper(reaper);
 }
 
 
-int main(int argc, char **argv) {
-    if (argc < 3) {
-        fprintf(stderr, "Usage: %s <msqid> <worker_id>\n", argv[0]);
-        return 1;
+// Send the next pair of the slot's run to its session, starting the process on the slot's CPU if needed
+void ask_session(int slot) {
+    shm_pair_t *pair = &shm_pairs(channels)[slot_run[slot] + slot_next[slot]];
+    pairs[slot].executable_path = (char *) channels + pair->path_offset;
+    pairs[slot].parameter = pair->param;
+    pairs[slot].exe_id = pair->exe_id;
+    pairs[slot].param_idx = pair->param_idx;
+
+    int launches = pin_slots && !session_alive(sessions, slot);
+    if (launches && set_cpu_affinity(0, &worker_cpus[slot], 1) == -1) {
+        perror("Failed to pin slot");
     }
+    session_ask(sessions, slot, pairs[slot].parameter, TIMEOUT_MS);
+    if (launches && set_cpu_affinity(0, worker_cpus, num_worker_cpus) == -1) {
+        perror("Failed to restore affinity");
+    }
+}
 
-    int msqid = atoi(argv[1]);
-    worker_id = atoi(argv[2]);
 
-    // TODO: Receive initial message from autograder specifying the number of (executable, parameter) 
-    // pairs that the worker will test (should just be an integer in the message body). (mtype = worker_id)
-    msgbuf_t init_msg;
-    if (msgrcv(msqid, &init_msg, sizeof(init_msg), worker_id, 0) == -1) {
-        perror("Initial setup message from master receive failed");
+// Same as run_pairs(), but every free slot claims a whole executable: one process answers its
+// parameters in turn and is only started again after a crash or timeout (see session.h)
+void run_sessions() {
+    sessions = create_session_pool(num_slots);
+    session_wake_on(sessions, flush_fd);
+    slot_run = malloc(num_slots * sizeof(int));
+    slot_run_len = malloc(num_slots * sizeof(int));
+    slot_next = malloc(num_slots * sizeof(int));
+    if (slot_run == NULL || slot_run_len == NULL || slot_next == NULL) {
+        fprintf(stderr, "Error occured at line %d: malloc failed\n", __LINE__ - 1);
         exit(EXIT_FAILURE);
     }
+    for (int j = 0; j < num_slots; j++) {
+        slot_run[j] = -1;
+    }
 
-    // TODO: Parse message and set up pairs_t array
-
-    int pairs_to_test = atoi(init_msg.mtext);
-    pairs = malloc(pairs_to_test);
+    int more = 1;
+    int running = 0;
+    while (more || running > 0) {
+        concurrency_update(concurrency);
+        for (int j = 0; j < num_slots && more && running < concurrency_limit(concurrency); j++) {
+            if (slot_run[j] == -1) {
+                int first = shm_claim_run(channels, channels->session_params);
+                if (first == -1) {
+                    more = 0;
+                    break;
+                }
+                slot_run[j] = first;
+                slot_run_len[j] = channels->num_pairs - first < channels->session_params
+                                      ? (int) (channels->num_pairs - first) : (int) channels->session_params;
+                slot_next[j] = 0;
+                session_open(sessions, j, (char *) channels + shm_pairs(channels)[first].path_offset);
+                ask_session(j);
+                running++;
+            }
+        }
+        if (running == 0) {
+            continue;
+        }
 
-    // TODO: Receive (executable, parameter) pairs from autograder and store them in pairs_t array.
-    //       Messages will have the format ("%s %d", executable_path, parameter). (mtype = worker_id)
-    for (int i = 0; i < pairs_to_test; i++) {
-        msgbuf_t pair;
-        if (msgrcv(msqid, &pair, sizeof(pair), worker_id, 0) == -1) {
-            perror("Pair retrieval failed");
-            exit(EXIT_FAILURE);
+        int status;
+        long duration_ms;
+        int slot = session_wait(sessions, &status, &duration_ms);
+        if (slot == -1) {
+            flush_results();
+            continue;
         }
+        pairs[slot].status = status;
+        pairs[slot].duration_ms = duration_ms;
+        send_results(slot);
 
-        char message_received[MESSAGE_SIZE] = pair.mtext;
-        
-        char *pair_part = strtok(message_received, " ");
-        pairs[i].executable_path = malloc(strlen(pair_part) + 1); //1 for null terminator.
-        
-        // Retrieving executable_path
-        strcpy(pairs[i].executable_path, pair_part);
-        
-        // Retrieving parameter
-        pair_part = strtok(NULL, " ");
-        if (pair_part != NULL) {
-            pairs[i].parameter = atoi(pair_part);
+        // Move on to the executable's next parameter, or free the slot once it has answered them all
+        if (++slot_next[slot] < slot_run_len[slot]) {
+            ask_session(slot);
         } else {
-            perror("Parameter missing");
-            exit(EXIT_FAILURE);
+            session_close(sessions, slot);
+            slot_run[slot] = -1;
+            running--;
         }
-        free(pair_part);
     }
 
-    // TODO: Send ACK message to mq_autograder after all pairs received (mtype = BROADCAST_MTYPE)
-    msgbuf_t ack;
-    ack.mtype = BROADCAST_MTYPE;
-    char ack_message[] = "ACK";
-    strcpy(ack.mtext, ack_message);
-    if (msgsnd(msqid, &ack, sizeof(ack), 0) == -1) {
-        perror("msgsnd");
-        exit(EXIT_FAILURE);
-    }
+    free_session_pool(sessions);
+    free(slot_run);
+    free(slot_run_len);
+    free(slot_next);
+}
 
 
-    // TODO: Wait for SYNACK from autograder to start testing (mtype = BROADCAST_MTYPE).
-    //       Be careful to account for the possibility of receiving ACK messages just sent.
-    
+// Send DONE message to autograder to indicate that the worker has finished testing
+void send_done_msg() {
+    send_record(MQ_DONE, NULL, 0);
+}
 
-    // Run the pairs in batches of 8 and send results back to autograder
-    for (int i = 0; i < pairs_to_test; i+= PAIRS_BATCH_SIZE) {
-        int remaining = pairs_to_test - i;
-        curr_batch_size = remaining < PAIRS_BATCH_SIZE ? remaining : PAIRS_BATCH_SIZE;
-        pids = malloc(curr_batch_size * sizeof(pid_t));
 
-        for (int j = 0; j < curr_batch_size; j++) {
-            // TODO: Execute the student executable
-            execute_solution(pairs[i + j].executable_path, pairs[i + j].parameter, j);
-        }
+int main(int argc, char **argv) {
+    if (argc < 3 || (argc == 4 && strcmp(argv[3], "--pin") != 0) || argc > 4) {
+        fprintf(stderr, "Usage: %s <channels fd> <worker_id> [--pin]\n", argv[0]);
+        return 1;
+    }
 
-        // TODO: Setup timer to determine if child process is stuck
-        start_timer(TIMEOUT_SECS, timeout_handler);  // Implement this function (src/utils.c)
+    autograder_pid = getppid();
+    channels = attach_shm_channels(atoi(argv[1]));
+    worker_id = atoi(argv[2]);
+    if (worker_id < 1 || worker_id > channels->num_workers) {
+        fprintf(stderr, "Invalid worker id %ld\n", worker_id);
+        return 1;
+    }
+    channel = &channels->channels[worker_id - 1];
 
-        // TODO: Wait for the batch to finish and check results
-        monitor_and_evaluate_solutions(i);
+    // Send ACK to mq_autograder once attached
+    send_record(MQ_ACK, NULL, 0);
 
-        // TODO: Cancel the timer if all child processes have finished
-        if (child_status == NULL) {
-            cancel_timer();
+    // Wait for SYNACK from autograder to start testing
+    uint32_t type, length;
+    receive_record(&type, &length);
+    if (type != MQ_SYNACK) {
+        fprintf(stderr, "Expected SYNACK, got record type %u\n", type);
+        exit(EXIT_FAILURE);
+    }
+    shm_ring_consume(&channel->dispatch, &channels->waiter);
+
+    // Pinned slots never share a CPU, so there are no more of them than CPUs
+    num_slots = PAIRS_BATCH_SIZE;
+    pin_slots = argc == 4;
+    if (pin_slots) {
+        num_worker_cpus = get_allowed_cpus(&worker_cpus);
+        if (num_worker_cpus < 1) {
+            fprintf(stderr, "Worker %ld: cannot read its CPUs, slots are not pinned\n", worker_id);
+            pin_slots = 0;
+        } else if (num_worker_cpus < num_slots) {
+            num_slots = num_worker_cpus;
         }
+    }
+    for (int j = 0; pin_slots && j < num_slots; j++) {
+        printf("Worker %ld slot %d: CPU %d\n", worker_id, j, worker_cpus[j]);
+    }
+    fflush(stdout);
+
+    pairs = malloc(num_slots * sizeof(pairs_t));
+    child_status = malloc(num_slots * sizeof(int));
+    slot_plan = malloc(num_slots * sizeof(spawn_plan_t));
+    slot_param = malloc(num_slots * sizeof(*slot_param));
+    slot_start = malloc(num_slots * sizeof(long));
+    if (pairs == NULL || child_status == NULL || slot_plan == NULL || slot_param == NULL || slot_start == NULL) {
+        fprintf(stderr, "Error occured at line %d: malloc failed\n", __LINE__ - 1);
+        exit(EXIT_FAILURE);
+    }
+    for (int j = 0; j < num_slots; j++) {
+        child_status[j] = -1;
+    }
+    concurrency = create_concurrency(num_slots);
+    flush_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (flush_fd == -1) {
+        perror("timerfd_create");
+        exit(EXIT_FAILURE);
+    }
 
-        // TODO: Send batch results (intermediate results) back to autograder
-        send_results(msqid, worker_id, i);
-
-        free(pids);
+    if (channels->session_params != 0) {
+        run_sessions();
+    } else {
+        run_pairs();
     }
 
     // TODO: Send DONE message to autograder to indicate that the worker has finished testing
-    send_done_msg(msqid, worker_id);
+    flush_results();
+    send_done_msg();
 
-    // Free the pairs_t array
-    for (int i = 0; i < pairs_to_test; i++) {
-        free(pairs[i].executable_path);
-    }
+    // The paths live in the shared region
     free(pairs);
 
-    free(pids);
+    free_concurrency(concurrency);
+    close(flush_fd);
+    free(child_status);
+    free(slot_plan);
+    free(slot_param);
+    free(slot_start);
+    if (pin_slots) {
+        free(worker_cpus);
+    }
+    free_shm_channels(channels);
 }
@@ -0,0 +1,27 @@
+#!/bin/sh
+# Grade test_cases/exec with a coordinator and three agents on this machine (see "make test-dist").
+# One agent is killed, with its children, while it holds pairs: the coordinator has to hand them to
+# the others. Another agent starts with a cache whose blob for sol_1 is really sol_2, which it
+# must notice and fetch again. The results have to match the single-host run.
+PORT=${PORT:-47061}
+CACHE=$(mktemp -d)
+trap 'rm -rf "$CACHE"' EXIT
+
+DIGEST=$(sha256sum test_cases/exec/sol_1 | cut -c1-64)
+mkdir -p "$CACHE/stale/$DIGEST"
+cp test_cases/exec/sol_2 "$CACHE/stale/$DIGEST/.blob"
+ln "$CACHE/stale/$DIGEST/.blob" "$CACHE/stale/$DIGEST/sol_1"
+
+./coordinator --mode exec "$PORT" test_cases/exec 1 2 3 > /dev/null &
+COORDINATOR=$!
+sleep 1
+
+./agent localhost "$PORT" "$CACHE/stale" > /dev/null 2>&1 &
+./agent localhost "$PORT" "$CACHE/fresh" > /dev/null 2>&1 &
+# In its own process group, so its children die with it like on a machine that goes down
+setsid ./agent localhost "$PORT" "$CACHE/victim" > /dev/null 2>&1 &
+VICTIM=$!
+
+sleep 3
+kill -KILL -"$VICTIM"
+wait "$COORDINATOR"
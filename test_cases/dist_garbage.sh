@@ -0,0 +1,15 @@
+#!/bin/sh
+# Grade test_cases/garbage with a coordinator and two agents (see "make test-dist"). sol_1 and sol_2
+# print something that is no answer: the agents have to grade them INCORRECT and go on. If they died
+# on them instead, the coordinator would be left without agents and never finish.
+PORT=${PORT:-47062}
+CACHE=$(mktemp -d)
+trap 'rm -rf "$CACHE"' EXIT
+
+./coordinator --mode exec "$PORT" test_cases/garbage 1 2 3 > /dev/null &
+COORDINATOR=$!
+sleep 1
+
+./agent localhost "$PORT" "$CACHE/first" > /dev/null 2>&1 &
+./agent localhost "$PORT" "$CACHE/second" > /dev/null 2>&1 &
+wait "$COORDINATOR"
@@ -0,0 +1,28 @@
+#!/bin/sh
+# Grade test_cases/garbage in watch mode (see "make test-simple"). The daemon starts on an empty
+# directory, sol_1 and sol_2 (output that is no answer) are dropped in first and sol_3 only once they
+# have been graded: the daemon has to grade them INCORRECT and still be there to grade sol_3.
+DIR=$(mktemp -d)
+trap 'kill "$AUTOGRADER" 2> /dev/null; rm -rf "$DIR"' EXIT
+
+# Wait up to 30 s for results.txt to have a row for $1
+wait_for_row() {
+    for i in $(seq 1 300); do
+        grep -q "^$1" results.txt 2> /dev/null && return 0
+        sleep 0.1
+    done
+    echo "no row for $1" >&2
+    return 1
+}
+
+rm -f results.txt
+./autograder --no-cache --watch "$DIR" 1 2 3 > /dev/null &
+AUTOGRADER=$!
+sleep 1
+
+cp test_cases/garbage/sol_1 test_cases/garbage/sol_2 "$DIR"
+wait_for_row sol_2 || exit 1
+kill -0 "$AUTOGRADER" 2> /dev/null || { echo "autograder exited on garbage output" >&2; exit 1; }
+
+cp test_cases/garbage/sol_3 "$DIR"
+wait_for_row sol_3 || exit 1